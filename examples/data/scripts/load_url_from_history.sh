@@ -7,6 +7,14 @@ readonly DMENU_OPTIONS="xmms vertical resize"
 . "$UZBL_UTIL_DIR/uzbl-dir.sh"
 . "$UZBL_UTIL_DIR/uzbl-util.sh"
 
+# The event manager's url_history plugin keeps an indexed database of visited
+# pages which is already free of duplicates and ranked by frecency.
+if [ -r "$UZBL_HISTORY_DB" ] && command -v sqlite3 >/dev/null 2>&1; then
+    goto="$( sqlite3 -separator ' ' "$UZBL_HISTORY_DB" 'SELECT uri, title FROM urls ORDER BY frecency DESC' | $DMENU | cut -d ' ' -f 1 )"
+    [ -n "$goto" ] && uzbl_control "uri $goto\n"
+    exit 0
+fi
+
 [ -r "$UZBL_HISTORY_FILE" ] || exit 1
 
 # choose from all entries, sorted and uniqued
@@ -4,6 +4,9 @@
 # Example configuration usage:
 #
 #    @on_event LOAD_COMMIT spawn @scripts_dir/per-site-settings.py @data_home/uzbl/per-site-settings
+#
+# uzbl-core reads the same format natively with the site_settings command,
+# which avoids spawning this script on every page load.
 
 # Format of the settings file:
 #
@@ -27,4 +27,5 @@ readonly UZBL_SESSION_COOKIE_FILE="${UZBL_SESSION_COOKIE_FILE:-$UZBL_DATA_DIR/co
 readonly UZBL_BOOKMARKS_FILE="${UZBL_BOOKMARKS_FILE:-$UZBL_DATA_DIR/bookmarks}"
 readonly UZBL_TEMPS_FILE="${UZBL_TEMPS_FILE:-$UZBL_DATA_DIR/temps}"
 readonly UZBL_HISTORY_FILE="${UZBL_HISTORY_FILE:-$UZBL_DATA_DIR/history}"
+readonly UZBL_HISTORY_DB="${UZBL_HISTORY_DB:-$UZBL_DATA_DIR/history.db}"
 readonly UZBL_SESSION_FILE="${UZBL_SESSION_FILE:-$UZBL_DATA_DIR/browser-session}"
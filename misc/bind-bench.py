@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+# usage: bind-bench.py [binds per mode] [modes]
+#
+# Measures the per keystroke latency of the bind plugin with many binds, by
+# feeding KEYCMD_UPDATE and KEYCMD_EXEC events through a mocked event manager
+# the way tests/event-manager/testbind.py does.
+
+import os
+import random
+import sys
+import time
+
+root = os.path.join(os.path.dirname(__file__), '..')
+sys.path.insert(0, root)
+sys.path.insert(0, os.path.join(root, 'tests', 'event-manager'))
+
+from emtest import EventManagerMock
+from uzbl.plugins.bind import BindPlugin
+from uzbl.plugins.config import Config
+from uzbl.plugins.keycmd import KeyCmd, Keylet
+
+
+def random_glob(rng):
+    keys = ''.join(rng.choice('abcdefghijklmnopqrstuvwxyz')
+                   for _ in range(rng.randint(1, 4)))
+    return keys + rng.choice(['', '', '*', '_', '!'])
+
+
+def main():
+    per_mode = int(sys.argv[1]) if len(sys.argv) > 1 else 200
+    modes = int(sys.argv[2]) if len(sys.argv) > 2 else 4
+
+    event_manager = EventManagerMock((), (Config, KeyCmd, BindPlugin))
+    uzbl = event_manager.add()
+    bind = BindPlugin[uzbl]
+    rng = random.Random(0)
+
+    start = time.time()
+    for mode in ['global'] + ['mode%d' % i for i in range(1, modes)]:
+        for _ in range(per_mode):
+            bind.mode_bind(mode, random_glob(rng), 'js void(0)')
+    print('%-30s %10.3f ms' % ('add %d binds' % (per_mode * modes),
+                               (time.time() - start) * 1000))
+
+    Config[uzbl].data['mode'] = 'mode1' if modes > 1 else 'global'
+    typed = ''.join(rng.choice('abcdefghijklmnopqrstuvwxyz ')
+                    for _ in range(2000))
+
+    keylet = Keylet()
+    for on_exec in (False, True):
+        start = time.time()
+        for i in range(len(typed)):
+            keylet.keycmd = typed[max(0, i - 8):i + 1].lstrip()
+            bind.key_event(set(), keylet, on_exec=on_exec)
+        elapsed = (time.time() - start) * 1e6 / len(typed)
+        print('%-30s %10.3f us' % (
+            'KEYCMD_%s per key' % ('EXEC' if on_exec else 'UPDATE'), elapsed))
+
+
+if __name__ == '__main__':
+    main()
@@ -1,12 +1,21 @@
 #!/bin/bash
-echo "Creating dummy file of 50MB in size (625000 entries of 80chars)"
-echo "Note: this takes about an hour and a half"
-entries_per_iteration=1000
-for i in `seq 1 625`
-do
-	echo "Iteration $i of 625 ( $entries_per_iteration each )"
-	for j in `seq 1 $entries_per_iteration`
-	do
-		echo "`date +'%Y-%m-%d %H:%M:%S'` `date +%s`abcdefhijklmno`date +%s | md5sum`" >> ./dummy_history_file
-	done
-done
+# usage: dmenu-performancetest-generate-dummy-history-file.sh [entries] [file]
+#
+# Writes entries in the format of examples/data/scripts/history.sh. Pages are
+# revisited like in a real history: about one in ten entries is a new page.
+# Needs GNU awk for strftime.
+entries="${1:-625000}"
+file="${2:-./dummy_history_file}"
+echo "Creating dummy history file $file with $entries entries"
+awk -v entries="$entries" -v now="$(date +%s)" '
+BEGIN {
+    srand(1);
+    pages = int(entries / 10) + 1;
+    for (i = 0; i < entries; i++) {
+        # favour a small set of pages, like real browsing does
+        page = int(pages * rand() * rand());
+        t = now - (entries - i) * 30;
+        printf("%s http://site%d.example.org/path/%d Dummy page %d abcdefhijklmno\n",
+            strftime("%Y-%m-%d %H:%M:%S", t), page % 997, page, page);
+    }
+}' > "$file"
@@ -0,0 +1,69 @@
+#!/usr/bin/env python2
+# usage: tabbed-bench.py [tabs] [title changes]
+#
+# Measures how long uzbl-tabbed takes to open many tabs and to redraw its
+# tablist when titles change. No uzbl-browser is started: spawning is stubbed
+# out and TITLE_CHANGED events are fed to each tab's event dispatcher the way
+# its socket client would. Needs a display.
+
+import imp
+import os
+import sys
+import time
+
+root = os.path.join(os.path.dirname(__file__), '..')
+tabbed = imp.load_source('uzbl_tabbed', os.path.join(root, 'bin', 'uzbl-tabbed'))
+
+tabbed.config['save_session'] = False
+tabbed.gobject.spawn_async = lambda *args, **kwargs: None
+
+
+def flush():
+    while tabbed.gtk.events_pending():
+        tabbed.gtk.main_iteration(False)
+
+
+def report(label, start, count=1):
+    elapsed = (time.time() - start) * 1000 / count
+    print('%-30s %10.3f ms' % (label, elapsed))
+
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 500
+    changes = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+
+    app = tabbed.UzblTabbed()
+    flush()
+
+    start = time.time()
+    for i in range(count):
+        app.new_tab('http://example.com/%d' % i, switch=False)
+        flush()
+    report('open %d tabs' % count, start)
+
+    uzbls = [app.tabs[tab] for tab in app.notebook]
+
+    start = time.time()
+    for (i, uzbl) in enumerate(uzbls):
+        uzbl.dispatcher.dispatch('TITLE_CHANGED', ['Example page %d' % i])
+    flush()
+    report('retitle %d tabs at once' % count, start)
+
+    start = time.time()
+    for i in range(changes):
+        uzbl = uzbls[(i * 7) % count]
+        uzbl.dispatcher.dispatch('TITLE_CHANGED', ['Loading %d' % i])
+        flush()
+    report('single title change', start, changes)
+
+    start = time.time()
+    for i in range(changes):
+        app.next_tab()
+        flush()
+    report('switch tab', start, changes)
+
+    app.close_socket()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+# usage: url-history-bench.py [history file]
+#
+# Compares the flat history file pipeline used by load_url_from_history.sh with
+# the url_history event manager plugin. Generate a file first with
+# dmenu-performancetest-generate-dummy-history-file.sh.
+
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..'))
+from uzbl.plugins.url_history import UrlHistoryStore
+
+
+def timed(what, func, repeat=1):
+    start = time.time()
+    for _ in range(repeat):
+        result = func()
+    print('%-40s %10.3f ms' % (what, (time.time() - start) * 1000 / repeat))
+    return result
+
+
+def main():
+    history_file = sys.argv[1] if len(sys.argv) > 1 else 'dummy_history_file'
+
+    timed("tac | awk '!a[$3]++'", lambda: subprocess.check_output(
+        "tac '%s' | awk '!a[$3]++'" % history_file, shell=True))
+
+    with tempfile.NamedTemporaryFile(suffix='.db') as db:
+        store = UrlHistoryStore(db.name)
+
+        def load():
+            with open(history_file) as f:
+                for line in f:
+                    fields = line.split(' ', 3)
+                    stamp = time.mktime(time.strptime(
+                        fields[0] + ' ' + fields[1], '%Y-%m-%d %H:%M:%S'))
+                    store.visit(fields[2], fields[3].strip(), now=stamp,
+                                commit=False)
+            store.db.commit()
+
+        timed('import into url_history', load)
+        timed('full list by frecency', lambda: store.db.execute(
+            'SELECT uri, title FROM urls ORDER BY frecency DESC').fetchall())
+        for text in ('site1', 'site12.example.org/path/1', 'nothing'):
+            timed('prefix %r' % text, lambda: store.prefix(text), 100)
+        for text in ('s12p3', 'dummy 42'):
+            timed('fuzzy %r' % text, lambda: store.fuzzy(text), 10)
+        store.close()
+
+
+if __name__ == '__main__':
+    main()
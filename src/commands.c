@@ -1,13 +1,19 @@
 #include "commands.h"
 
+#include "decision-cache.h"
+#include "downloads.h"
 #include "events.h"
 #include "gui.h"
 #include "io.h"
 #include "js.h"
 #include "menu.h"
+#include "request-filter.h"
 #include "requests.h"
 #include "scheme.h"
 #include "setup.h"
+#include "site-settings.h"
+#include "snapshot.h"
+#include "spawn-pool.h"
 #include "soup.h"
 #include "type.h"
 #include "util.h"
@@ -251,6 +257,82 @@ uzbl_commands_run (const gchar *cmd, GString *result)
     uzbl_commands_args_free (argv);
 }
 
+typedef struct {
+    const UzblCommand    *info;
+    /* Kept for COMMAND_EXECUTED, which is sent once the child is done. */
+    GArray               *argv;
+    UzblCommandsCallback  callback;
+    gpointer              data;
+} UzblSpawnRequest;
+
+static GArray *
+spawn_args (GArray *argv);
+static GArray *
+spawn_sh_args (GArray *argv);
+static void
+spawn_done (GString *output, gpointer data);
+
+GArray *
+uzbl_commands_spawn_argv (const UzblCommand *info, GArray *argv)
+{
+    if (!info) {
+        return NULL;
+    }
+
+    if (!g_strcmp0 (info->name, "spawn_sync")) {
+        return spawn_args (argv);
+    } else if (!g_strcmp0 (info->name, "spawn_sh_sync")) {
+        return spawn_sh_args (argv);
+    }
+
+    return NULL;
+}
+
+gboolean
+uzbl_commands_run_async (const UzblCommand *info, GArray *argv, UzblCommandsCallback callback, gpointer data)
+{
+    if (!info) {
+        return FALSE;
+    }
+
+    gboolean shell = !g_strcmp0 (info->name, "spawn_sh_sync");
+
+    if (!shell &&
+        g_strcmp0 (info->name, "spawn_sync") &&
+        g_strcmp0 (info->name, "spawn_sync_exec")) {
+        return FALSE;
+    }
+
+    GArray *args = shell ? spawn_sh_args (argv) : spawn_args (argv);
+
+    if (!args) {
+        return FALSE;
+    }
+
+    UzblSpawnRequest *request = g_malloc (sizeof (UzblSpawnRequest));
+    request->info = info;
+    request->argv = NULL;
+    request->callback = callback;
+    request->data = data;
+
+    if (info->send_event) {
+        request->argv = uzbl_commands_args_new ();
+
+        guint i;
+        for (i = 0; i < argv->len; ++i) {
+            uzbl_commands_args_append (request->argv, g_strdup (argv_idx (argv, i)));
+        }
+    }
+
+    /* A lone script can run on a pooled shell. */
+    const gchar *script = (shell && (argv->len == 1)) ? argv_idx (argv, 0) : NULL;
+
+    uzbl_spawn_pool_run_async (script, args, spawn_done, request);
+    uzbl_commands_args_free (args);
+
+    return TRUE;
+}
+
 typedef void (*UzblLineCallback) (const gchar *line, gpointer data);
 
 static gboolean
@@ -273,8 +355,44 @@ uzbl_commands_load_file (const gchar *path)
 
 /* ===================== HELPER IMPLEMENTATIONS ===================== */
 
+static void
+run_output_commands (gchar *output);
+
+void
+spawn_done (GString *output, gpointer data)
+{
+    UzblSpawnRequest *request = (UzblSpawnRequest *)data;
+
+    if (!g_strcmp0 (request->info->name, "spawn_sh_sync")) {
+        remove_trailing_newline (output->str);
+        g_string_truncate (output, strlen (output->str));
+    } else if (!g_strcmp0 (request->info->name, "spawn_sync_exec")) {
+        gchar *commands = g_strdup (output->str);
+        run_output_commands (commands);
+        g_free (commands);
+    }
+
+    g_free (uzbl.state.last_result);
+    uzbl.state.last_result = g_strdup (output->str);
+
+    if (request->argv) {
+        uzbl_events_send (COMMAND_EXECUTED, NULL,
+            TYPE_NAME, request->info->name,
+            TYPE_STR_ARRAY, request->argv,
+            NULL);
+
+        uzbl_commands_args_free (request->argv);
+    }
+
+    request->callback (output, request->data);
+
+    g_free (request);
+}
+
 static JSValueRef
 call_command (JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception);
+static JSValueRef
+command_result_value (JSContextRef ctx, const UzblCommand *info, const GString *result);
 
 void
 init_js_commands_api ()
@@ -307,7 +425,9 @@ init_js_commands_api ()
 
     const UzblCommand *cmd = builtin_command_table;
     while (cmd->name) {
-        JSObjectRef command_obj = JSObjectMake (uzbl.state.jscontext, command_class, NULL);
+        /* The command is kept as private data so that calls need not look
+         * it up by name. */
+        JSObjectRef command_obj = JSObjectMake (uzbl.state.jscontext, command_class, (void *)cmd);
 
         JSStringRef name = JSStringCreateWithUTF8CString (cmd->name);
         JSValueRef name_val = JSValueMakeString(uzbl.state.jscontext, name);
@@ -393,36 +513,144 @@ parse_command_from_file_cb (const gchar *line, gpointer data)
     parse_command_from_file (line);
 }
 
+static gboolean
+is_json_space (gchar c);
+static gboolean
+is_json_number (const gchar *p, const gchar *end);
+
+JSValueRef
+command_result_value (JSContextRef ctx, const UzblCommand *info, const GString *result)
+{
+    const gchar *start = result->str;
+    const gchar *end = result->str + result->len;
+
+    while ((start < end) && is_json_space (*start)) {
+        ++start;
+    }
+    while ((end > start) && is_json_space (*(end - 1))) {
+        --end;
+    }
+
+    gsize len = end - start;
+
+    /* Scalars are built directly; only objects, arrays and quoted strings
+     * need the JSON parser. */
+    if ((len == 4) && !strncmp (start, "true", len)) {
+        return JSValueMakeBoolean (ctx, true);
+    } else if ((len == 5) && !strncmp (start, "false", len)) {
+        return JSValueMakeBoolean (ctx, false);
+    } else if ((len == 4) && !strncmp (start, "null", len)) {
+        return JSValueMakeNull (ctx);
+    } else if (is_json_number (start, end)) {
+        return JSValueMakeNumber (ctx, g_ascii_strtod (start, NULL));
+    }
+
+    JSStringRef result_str = JSStringCreateWithUTF8CString (result->str);
+    JSValueRef ret = NULL;
+
+    if (len && strchr ("{[\"", *start)) {
+        ret = JSValueMakeFromJSONString (ctx, result_str);
+
+        if (!ret) {
+            uzbl_debug ("Failed to parse result as JSON for command \'%s\': %s\n", info->name, result->str);
+        }
+    }
+
+    if (!ret) {
+        ret = JSValueMakeString (ctx, result_str);
+    }
+
+    JSStringRelease (result_str);
+
+    return ret;
+}
+
+gboolean
+is_json_space (gchar c)
+{
+    return ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r'));
+}
+
+gboolean
+is_json_number (const gchar *p, const gchar *end)
+{
+    if ((p < end) && (*p == '-')) {
+        ++p;
+    }
+
+    if ((p == end) || !g_ascii_isdigit (*p)) {
+        return FALSE;
+    }
+
+    if (*p == '0') {
+        ++p;
+    } else {
+        while ((p < end) && g_ascii_isdigit (*p)) {
+            ++p;
+        }
+    }
+
+    if ((p < end) && (*p == '.')) {
+        ++p;
+
+        if ((p == end) || !g_ascii_isdigit (*p)) {
+            return FALSE;
+        }
+
+        while ((p < end) && g_ascii_isdigit (*p)) {
+            ++p;
+        }
+    }
+
+    if ((p < end) && ((*p == 'e') || (*p == 'E'))) {
+        ++p;
+
+        if ((p < end) && ((*p == '+') || (*p == '-'))) {
+            ++p;
+        }
+
+        if ((p == end) || !g_ascii_isdigit (*p)) {
+            return FALSE;
+        }
+
+        while ((p < end) && g_ascii_isdigit (*p)) {
+            ++p;
+        }
+    }
+
+    return (p == end);
+}
+
 JSValueRef
 call_command (JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception)
 {
     UZBL_UNUSED (thisObject);
 
     JSValueRef json_ret = NULL;
-    JSValueRef command_val = uzbl_js_get (ctx, function, "name");
-    gchar *command = uzbl_js_to_string (ctx, command_val);
-
-    UzblCommand *info = g_hash_table_lookup (uzbl.commands->table, command);
+    const UzblCommand *info = JSObjectGetPrivate (function);
 
     if (!info) {
-        gchar *error_str = g_strdup_printf ("Unknown command: %s", command);
-        JSStringRef error = JSStringCreateWithUTF8CString (error_str);
+        JSValueRef command_val = uzbl_js_get (ctx, function, "name");
+        gchar *command = uzbl_js_to_string (ctx, command_val);
 
-        *exception = JSValueMakeString (ctx, error);
+        info = g_hash_table_lookup (uzbl.commands->table, command);
 
-        JSStringRelease (error);
-        g_free (error_str);
+        if (!info) {
+            gchar *error_str = g_strdup_printf ("Unknown command: %s", command);
+            JSStringRef error = JSStringCreateWithUTF8CString (error_str);
 
-        json_ret = JSValueMakeUndefined (ctx);
+            *exception = JSValueMakeString (ctx, error);
 
-        g_free (command);
-        return json_ret;
-    }
+            JSStringRelease (error);
+            g_free (error_str);
 
-    g_free (command);
+            json_ret = JSValueMakeUndefined (ctx);
 
-    if (json_ret) {
-        return json_ret;
+            g_free (command);
+            return json_ret;
+        }
+
+        g_free (command);
     }
 
     GArray *argv = uzbl_commands_args_new ();
@@ -437,17 +665,8 @@ call_command (JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, si
 
     uzbl_commands_run_parsed (info, argv, result);
 
-    JSStringRef result_str = JSStringCreateWithUTF8CString (result->str);
-
-    json_ret = JSValueMakeFromJSONString (ctx, result_str);
+    json_ret = command_result_value (ctx, info, result);
 
-    if (!json_ret) {
-        uzbl_debug ("Failed to parse result as JSON for command \'%s\': %s\n", info->name, result->str);
-
-        json_ret = JSValueMakeString (ctx, result_str);
-    }
-
-    JSStringRelease (result_str);
     g_string_free (result, TRUE);
     uzbl_commands_args_free (argv);
 
@@ -575,9 +794,17 @@ DECLARE_COMMAND (frame);
 /* Cookie commands */
 DECLARE_COMMAND (cookie);
 
-#if WEBKIT_CHECK_VERSION (1, 11, 92)
-#define HAVE_SNAPSHOT
-#endif
+/* Site settings commands */
+DECLARE_COMMAND (site_settings);
+
+/* Request filter commands */
+DECLARE_COMMAND (request_filter);
+
+/* Decision cache commands */
+DECLARE_COMMAND (decision_cache);
+
+/* Scheme cache commands */
+DECLARE_COMMAND (scheme_cache);
 
 /* Display commands */
 DECLARE_COMMAND (scroll);
@@ -625,6 +852,8 @@ DECLARE_COMMAND (spawn_sh_sync);
 /* Uzbl commands */
 DECLARE_COMMAND (chain);
 DECLARE_COMMAND (include);
+DECLARE_COMMAND (suspend);
+DECLARE_COMMAND (resume);
 DECLARE_COMMAND (exit);
 
 /* Variable commands */
@@ -635,6 +864,8 @@ DECLARE_COMMAND (dump_config_as_events);
 DECLARE_COMMAND (print);
 
 /* Event commands */
+DECLARE_COMMAND (bind);
+DECLARE_COMMAND (keycmd);
 DECLARE_COMMAND (event);
 DECLARE_COMMAND (choose);
 DECLARE_COMMAND (request);
@@ -657,6 +888,18 @@ builtin_command_table[] = {
     /* Cookie commands */
     { "cookie",                         cmd_cookie,                   TRUE,  TRUE  },
 
+    /* Site settings commands */
+    { "site_settings",                  cmd_site_settings,            TRUE,  TRUE  },
+
+    /* Request filter commands */
+    { "request_filter",                 cmd_request_filter,           TRUE,  TRUE  },
+
+    /* Decision cache commands */
+    { "decision_cache",                 cmd_decision_cache,           TRUE,  TRUE  },
+
+    /* Scheme cache commands */
+    { "scheme_cache",                   cmd_scheme_cache,             TRUE,  TRUE  },
+
     /* Display commands */
     { "scroll",                         cmd_scroll,                   TRUE,  TRUE  },
     { "zoom",                           cmd_zoom,                     TRUE,  TRUE  },
@@ -704,6 +947,8 @@ builtin_command_table[] = {
     /* Uzbl commands */
     { "chain",                          cmd_chain,                    TRUE,  TRUE  },
     { "include",                        cmd_include,                  FALSE, TRUE  },
+    { "suspend",                        cmd_suspend,                  TRUE,  TRUE  },
+    { "resume",                         cmd_resume,                   FALSE, FALSE },
     { "exit",                           cmd_exit,                     TRUE,  TRUE  },
 
     /* Variable commands */
@@ -715,6 +960,8 @@ builtin_command_table[] = {
     { "print",                          cmd_print,                    FALSE, TRUE  },
 
     /* Event commands */
+    { "bind",                           cmd_bind,                     TRUE,  FALSE },
+    { "keycmd",                         cmd_keycmd,                   TRUE,  FALSE },
     { "event",                          cmd_event,                    FALSE, FALSE },
     { "choose",                         cmd_choose,                   TRUE,  TRUE  },
     { "request",                        cmd_request,                  TRUE,  TRUE  },
@@ -824,12 +1071,32 @@ IMPLEMENT_COMMAND (uri)
 
 IMPLEMENT_COMMAND (download)
 {
-    UZBL_UNUSED (result);
-
     ARG_CHECK (argv, 1);
 
     const gchar *uri = argv_idx (argv, 0);
 
+    /* None of these are valid URIs. */
+    if (!g_strcmp0 (uri, "list")) {
+        if (!result) {
+            return;
+        }
+
+        uzbl_downloads_list (result);
+        return;
+    } else if (!g_strcmp0 (uri, "cancel")) {
+        ARG_CHECK (argv, 2);
+
+        guint id = strtoul (argv_idx (argv, 1), NULL, 10);
+
+        if (!uzbl_downloads_cancel (id)) {
+            uzbl_debug ("No running download with id %u\n", id);
+        }
+        return;
+    } else if (!g_strcmp0 (uri, "clear")) {
+        uzbl_downloads_clear ();
+        return;
+    }
+
     const gchar *destination = NULL;
 
     if (1 < argv->len) {
@@ -840,7 +1107,7 @@ IMPLEMENT_COMMAND (download)
     WebKitDownload *download = webkit_download_new (req);
     g_object_unref (req);
 
-    handle_download (download, destination);
+    uzbl_downloads_add (download, destination, FALSE);
 
     g_object_unref (download);
 }
@@ -940,6 +1207,11 @@ IMPLEMENT_COMMAND (frame)
 
 /* Cookie commands */
 
+static void
+cookie_add (GArray *argv, guint offset);
+static void
+cookie_delete (GArray *argv, guint offset);
+
 IMPLEMENT_COMMAND (cookie)
 {
     UZBL_UNUSED (result);
@@ -951,62 +1223,34 @@ IMPLEMENT_COMMAND (cookie)
     if (!g_strcmp0 (command, "add")) {
         ARG_CHECK (argv, 7);
 
-        /* Parse with same syntax as ADD_COOKIE event. */
-        gchar *host = argv_idx (argv, 1);
-        gchar *path = argv_idx (argv, 2);
-        gchar *name = argv_idx (argv, 3);
-        gchar *value = argv_idx (argv, 4);
-        gchar *scheme = argv_idx (argv, 5);
-        gchar *expires_arg = argv_idx (argv, 6);
-
-        gboolean secure = FALSE;
-        gboolean httponly = FALSE;
-        SoupDate *expires = NULL;
-
-        if (g_str_has_prefix (scheme, "http")) {
-            secure = (scheme[4] == 's');
-            httponly = g_str_has_prefix (scheme + 4 + secure, "Only");
-        }
-        if (*expires_arg) {
-            expires = soup_date_new_from_time_t (strtoul (expires_arg, NULL, 10));
-        }
-
-        /* Create new cookie. */
-        /* TODO: Add support for adding non-session cookies. */
-        static const int session_cookie = -1;
-        SoupCookie *cookie = soup_cookie_new (name, value, host, path, session_cookie);
-        soup_cookie_set_secure (cookie, secure);
-        soup_cookie_set_http_only (cookie, httponly);
-        if (expires) {
-            soup_cookie_set_expires (cookie, expires);
-        }
-
-        /* Add cookie to jar. */
         uzbl.net.soup_cookie_jar->in_manual_add = 1;
-        soup_cookie_jar_add_cookie (SOUP_COOKIE_JAR (uzbl.net.soup_cookie_jar), cookie);
+        cookie_add (argv, 1);
         uzbl.net.soup_cookie_jar->in_manual_add = 0;
+    } else if (!g_strcmp0 (command, "add_many")) {
+        static const guint cookie_fields = 6;
+        guint offset;
 
-        if (expires) {
-            soup_date_free (expires);
+        /* Cookies are given back to back with the same fields as "add"; a
+         * trailing partial cookie is ignored. */
+        uzbl.net.soup_cookie_jar->in_manual_add = 1;
+        for (offset = 1; offset + cookie_fields <= argv->len; offset += cookie_fields) {
+            cookie_add (argv, offset);
         }
+        uzbl.net.soup_cookie_jar->in_manual_add = 0;
     } else if (!g_strcmp0 (command, "delete")) {
         ARG_CHECK (argv, 5);
 
-        const gchar *domain = argv_idx (argv, 1);
-        const gchar *path = argv_idx (argv, 2);
-        const gchar *name = argv_idx (argv, 3);
-        const gchar *value = argv_idx (argv, 4);
-
-        static const int expired_cookie = 0;
-        SoupCookie *cookie = soup_cookie_new (
-            name,
-            value,
-            domain,
-            path,
-            expired_cookie);
+        uzbl.net.soup_cookie_jar->in_manual_add = 1;
+        cookie_delete (argv, 1);
+        uzbl.net.soup_cookie_jar->in_manual_add = 0;
+    } else if (!g_strcmp0 (command, "delete_many")) {
+        static const guint cookie_fields = 4;
+        guint offset;
 
         uzbl.net.soup_cookie_jar->in_manual_add = 1;
-        soup_cookie_jar_delete_cookie (SOUP_COOKIE_JAR (uzbl.net.soup_cookie_jar), cookie);
+        for (offset = 1; offset + cookie_fields <= argv->len; offset += cookie_fields) {
+            cookie_delete (argv, offset);
+        }
         uzbl.net.soup_cookie_jar->in_manual_add = 0;
     } else if (!g_strcmp0 (command, "clear")) {
         ARG_CHECK (argv, 2);
@@ -1014,11 +1258,17 @@ IMPLEMENT_COMMAND (cookie)
         const gchar *type = argv_idx (argv, 1);
 
         if (!g_strcmp0 (type, "all")) {
-            /* Replace the current cookie jar with a new empty jar. */
+            UzblCookieJar *old_jar = uzbl.net.soup_cookie_jar;
+
+            /* Replace the current cookie jar with a new empty jar which keeps
+             * using the (now empty) cookie database. */
+            uzbl_cookie_jar_clear_store (old_jar);
             soup_session_remove_feature (uzbl.net.soup_session,
-                SOUP_SESSION_FEATURE (uzbl.net.soup_cookie_jar));
-            g_object_unref (G_OBJECT (uzbl.net.soup_cookie_jar));
+                SOUP_SESSION_FEATURE (old_jar));
             uzbl.net.soup_cookie_jar = uzbl_cookie_jar_new ();
+            uzbl.net.soup_cookie_jar->store = old_jar->store;
+            old_jar->store = NULL;
+            g_object_unref (G_OBJECT (old_jar));
             soup_session_add_feature (uzbl.net.soup_session,
                 SOUP_SESSION_FEATURE (uzbl.net.soup_cookie_jar));
         } else {
@@ -1029,6 +1279,100 @@ IMPLEMENT_COMMAND (cookie)
     }
 }
 
+/* Site settings commands */
+
+IMPLEMENT_COMMAND (site_settings)
+{
+    UZBL_UNUSED (result);
+
+    ARG_CHECK (argv, 1);
+
+    const gchar *command = argv_idx (argv, 0);
+
+    if (!g_strcmp0 (command, "load")) {
+        ARG_CHECK (argv, 2);
+
+        uzbl_site_settings_load (argv_idx (argv, 1), argv_idx (argv, 2));
+    } else if (!g_strcmp0 (command, "clear")) {
+        uzbl_site_settings_load (NULL, NULL);
+    } else if (!g_strcmp0 (command, "apply")) {
+        const gchar *uri = argv_idx (argv, 1);
+
+        uzbl_site_settings_apply (uri ? uri : uzbl.state.uri);
+    } else {
+        uzbl_debug ("Unrecognized site_settings command: %s\n", command);
+    }
+}
+
+/* Request filter commands */
+
+IMPLEMENT_COMMAND (request_filter)
+{
+    ARG_CHECK (argv, 1);
+
+    const gchar *command = argv_idx (argv, 0);
+
+    if (!g_strcmp0 (command, "add")) {
+        guint i;
+
+        for (i = 1; i < argv->len; ++i) {
+            uzbl_request_filter_add (argv_idx (argv, i));
+        }
+    } else if (!g_strcmp0 (command, "clear")) {
+        uzbl_request_filter_clear ();
+    } else if (!g_strcmp0 (command, "stats")) {
+        if (!result) {
+            return;
+        }
+
+        uzbl_request_filter_stats (result);
+    } else {
+        uzbl_debug ("Unrecognized request_filter command: %s\n", command);
+    }
+}
+
+/* Decision cache commands */
+
+IMPLEMENT_COMMAND (decision_cache)
+{
+    ARG_CHECK (argv, 1);
+
+    const gchar *command = argv_idx (argv, 0);
+
+    if (!g_strcmp0 (command, "clear")) {
+        uzbl_decision_cache_clear ();
+    } else if (!g_strcmp0 (command, "stats")) {
+        if (!result) {
+            return;
+        }
+
+        uzbl_decision_cache_stats (result);
+    } else {
+        uzbl_debug ("Unrecognized decision_cache command: %s\n", command);
+    }
+}
+
+/* Scheme cache commands */
+
+IMPLEMENT_COMMAND (scheme_cache)
+{
+    ARG_CHECK (argv, 1);
+
+    const gchar *command = argv_idx (argv, 0);
+
+    if (!g_strcmp0 (command, "clear")) {
+        uzbl_scheme_clear_cache (argv_idx (argv, 1));
+    } else if (!g_strcmp0 (command, "stats")) {
+        if (!result) {
+            return;
+        }
+
+        uzbl_scheme_cache_stats (result);
+    } else {
+        uzbl_debug ("Unrecognized scheme_cache command: %s\n", command);
+    }
+}
+
 /* Display commands */
 
 /*
@@ -1216,32 +1560,63 @@ IMPLEMENT_COMMAND (snapshot)
 
     ARG_CHECK (argv, 3);
 
-    cairo_surface_t *surface = NULL;
-
     const gchar *path = argv_idx (argv, 0);
-    const gchar *format = argv_idx (argv, 1);
+    const gchar *format_str = argv_idx (argv, 1);
     const gchar *region_str = argv_idx (argv, 2);
 
-    if (!g_strcmp0 (region_str, "visible")) {
+    UzblSnapshotFormat format;
+
+    if (!g_strcmp0 (format_str, "png")) {
+        format = UZBL_SNAPSHOT_PNG;
+    } else if (!g_strcmp0 (format_str, "ppm")) {
+        format = UZBL_SNAPSHOT_PPM;
+    } else if (!g_strcmp0 (format_str, "raw")) {
+        format = UZBL_SNAPSHOT_RAW;
     } else {
-        uzbl_debug ("Unrecognized snapshot region: %s\n", region_str);
+        uzbl_debug ("Unrecognized snapshot format: %s\n", format_str);
         return;
     }
 
-    surface = webkit_web_view_get_snapshot (uzbl.gui.web_view);
+    GdkRectangle document;
+    GdkRectangle region;
 
-    if (!surface) {
-        uzbl_debug ("Failed to create a valid snapshot\n");
-        return;
-    }
+    document.x = 0;
+    document.y = 0;
+    document.width = gtk_adjustment_get_upper (uzbl.gui.bar_h);
+    document.height = gtk_adjustment_get_upper (uzbl.gui.bar_v);
 
-    if (!g_strcmp0 (format, "png")) {
-        cairo_surface_write_to_png (surface, path);
+    if (!g_strcmp0 (region_str, "visible")) {
+        region.x = gtk_adjustment_get_value (uzbl.gui.bar_h);
+        region.y = gtk_adjustment_get_value (uzbl.gui.bar_v);
+        region.width = gtk_adjustment_get_page_size (uzbl.gui.bar_h);
+        region.height = gtk_adjustment_get_page_size (uzbl.gui.bar_v);
+    } else if (!g_strcmp0 (region_str, "document")) {
+        region = document;
     } else {
-        uzbl_debug ("Unrecognized snapshot format: %s\n", format);
+        int x = 0;
+        int y = 0;
+        unsigned int w = 0;
+        unsigned int h = 0;
+
+        int ret = XParseGeometry (region_str, &x, &y, &w, &h);
+
+        if (!(ret & WidthValue) || !(ret & HeightValue) || (ret & (XNegative | YNegative))) {
+            uzbl_debug ("Unrecognized snapshot region: %s\n", region_str);
+            return;
+        }
+
+        region.x = x;
+        region.y = y;
+        region.width = w;
+        region.height = h;
+    }
+
+    if (!gdk_rectangle_intersect (&region, &document, &region)) {
+        uzbl_debug ("Snapshot region is outside of the page: %s\n", region_str);
+        return;
     }
 
-    cairo_surface_destroy (surface);
+    uzbl_snapshot_save (path, format, &region);
 }
 #endif
 
@@ -1970,24 +2345,30 @@ IMPLEMENT_COMMAND (js)
         return;
     }
 
-    gchar *script = NULL;
+    JSObjectRef globalobject = JSContextGetGlobalObject (jsctx);
+    JSStringRef js_script = NULL;
     gchar *path = NULL;
 
     if (!g_strcmp0 (where, "string")) {
-        script = g_strdup (value);
+        js_script = JSStringCreateWithUTF8CString (value);
         path = g_strdup ("(uzbl command)");
     } else if (!g_strcmp0 (where, "file")) {
         const gchar *req_path = value;
+        const gchar *text = NULL;
 
         if ((path = find_existing_file (req_path))) {
-            GIOChannel *chan = g_io_channel_new_file (path, "r", NULL);
-            if (chan) {
-                gsize len;
-                g_io_channel_read_to_end (chan, &script, &len, NULL);
-                g_io_channel_unref (chan);
-            }
+            js_script = uzbl_js_script_file (path, &text);
+        }
+
+        if (!js_script) {
+            uzbl_debug ("Failed to load JavaScript file: %s\n", req_path);
+            g_free (path);
+            goto js_exit;
+        }
 
-            uzbl_debug ("External JavaScript file loaded: %s\n", req_path);
+        if (text && (3 < argv->len)) {
+            /* Scripts using %N slots get their arguments substituted. */
+            gchar *script = g_strdup (text);
 
             guint i;
             for (i = argv->len; 3 < i; --i) {
@@ -2001,19 +2382,42 @@ IMPLEMENT_COMMAND (js)
                 g_free (script);
                 script = new_file_contents;
             }
+
+            JSStringRelease (js_script);
+            js_script = JSStringCreateWithUTF8CString (script);
+            g_free (script);
         }
     } else {
         uzbl_debug ("Unrecognized code source: %s\n", where);
         goto js_exit;
     }
 
-    JSObjectRef globalobject = JSContextGetGlobalObject (jsctx);
+    /* Arguments are always available in the uzbl_args array as well. */
+    guint nargs = (3 < argv->len) ? argv->len - 3 : 0;
+    JSValueRef *js_args = g_malloc0_n (nargs + 1, sizeof (JSValueRef));
+
+    guint i;
+    for (i = 0; i < nargs; ++i) {
+        JSStringRef arg = JSStringCreateWithUTF8CString (argv_idx (argv, i + 3));
+        js_args[i] = JSValueMakeString (jsctx, arg);
+        JSStringRelease (arg);
+    }
+
+    uzbl_js_set (jsctx,
+        globalobject, "uzbl_args", JSObjectMakeArray (jsctx, nargs, js_args, NULL),
+        kJSPropertyAttributeDontEnum);
+
+    g_free (js_args);
+
     JSValueRef js_exc = NULL;
 
-    JSStringRef js_script = JSStringCreateWithUTF8CString (script);
     JSStringRef js_file = JSStringCreateWithUTF8CString (path);
     JSValueRef js_result = JSEvaluateScript (jsctx, js_script, globalobject, js_file, 0, &js_exc);
 
+    JSStringRef args_name = JSStringCreateWithUTF8CString ("uzbl_args");
+    JSObjectDeleteProperty (jsctx, globalobject, args_name, NULL);
+    JSStringRelease (args_name);
+
     if (result && js_result && !JSValueIsUndefined (jsctx, js_result)) {
         gchar *result_utf8 = uzbl_js_to_string (jsctx, js_result);
 
@@ -2039,7 +2443,6 @@ IMPLEMENT_COMMAND (js)
     JSStringRelease (js_file);
     JSStringRelease (js_script);
 
-    g_free (script);
     g_free (path);
 
 js_exit:
@@ -2134,6 +2537,115 @@ IMPLEMENT_COMMAND (include)
     }
 }
 
+/* Form fields are identified by their position among all fields of the page
+ * and checked against their name when restored. Only fields changed by the
+ * user are recorded and passwords are never recorded. The JSON is URI encoded
+ * so that it survives being passed back as a command argument. */
+static const gchar *suspend_forms_js =
+    "(function () {"
+    "    var fields = [];"
+    "    var elements = document.querySelectorAll ('input, textarea, select');"
+    "    for (var i = 0; i < elements.length; ++i) {"
+    "        var e = elements[i];"
+    "        var type = (e.type || '').toLowerCase ();"
+    "        if (type === 'password' || type === 'hidden' || type === 'file') {"
+    "            continue;"
+    "        }"
+    "        if (type === 'checkbox' || type === 'radio') {"
+    "            if (e.checked !== e.defaultChecked) {"
+    "                fields.push ([i, e.name, e.checked]);"
+    "            }"
+    "        } else if (e.tagName === 'SELECT') {"
+    "            for (var j = 0; j < e.options.length; ++j) {"
+    "                if (e.options[j].selected !== e.options[j].defaultSelected) {"
+    "                    fields.push ([i, e.name, e.selectedIndex]);"
+    "                    break;"
+    "                }"
+    "            }"
+    "        } else if (e.value !== e.defaultValue) {"
+    "            fields.push ([i, e.name, e.value]);"
+    "        }"
+    "    }"
+    "    return encodeURIComponent (JSON.stringify (fields)).replace (/'/g, '%27');"
+    "}) ()";
+
+static const gchar *resume_forms_js =
+    "(function (fields) {"
+    "    var elements = document.querySelectorAll ('input, textarea, select');"
+    "    fields.forEach (function (field) {"
+    "        var e = elements[field[0]];"
+    "        if (!e || (e.name !== field[1])) {"
+    "            return;"
+    "        }"
+    "        var type = (e.type || '').toLowerCase ();"
+    "        if (type === 'checkbox' || type === 'radio') {"
+    "            e.checked = field[2];"
+    "        } else if (e.tagName === 'SELECT') {"
+    "            e.selectedIndex = field[2];"
+    "        } else {"
+    "            e.value = field[2];"
+    "        }"
+    "    });"
+    "}) (JSON.parse (decodeURIComponent ('%s')))";
+
+static void
+run_page_js (const gchar *script, GString *result);
+
+IMPLEMENT_COMMAND (suspend)
+{
+    if (!uzbl.state.started) {
+        cmd_exit (argv, result);
+        return;
+    }
+
+    GString *forms = g_string_new ("");
+    run_page_js (suspend_forms_js, forms);
+
+    uzbl_events_send (INSTANCE_SUSPEND, NULL,
+        TYPE_STR, uzbl.state.uri ? uzbl.state.uri : "",
+        TYPE_DOUBLE, gtk_adjustment_get_value (uzbl.gui.bar_v),
+        TYPE_DOUBLE, gtk_adjustment_get_value (uzbl.gui.bar_h),
+        TYPE_STR, forms->len ? forms->str : "%5B%5D",
+        NULL);
+
+    g_string_free (forms, TRUE);
+
+    /* The process is what holds the memory; the controller restarts it with
+     * the recorded state when it is needed again. */
+    cmd_exit (argv, result);
+}
+
+IMPLEMENT_COMMAND (resume)
+{
+    UZBL_UNUSED (result);
+
+    ARG_CHECK (argv, 1);
+
+    gchar **split = g_strsplit (argv_idx (argv, 0), " ", 3);
+    guint len = g_strv_length (split);
+
+    if (len < 2) {
+        uzbl_debug ("resume: expected <VERTICAL> <HORIZONTAL> [FORMS]\n");
+        g_strfreev (split);
+        return;
+    }
+
+    gtk_adjustment_set_value (uzbl.gui.bar_v, g_ascii_strtod (split[0], NULL));
+    gtk_adjustment_set_value (uzbl.gui.bar_h, g_ascii_strtod (split[1], NULL));
+
+    const gchar *forms = (2 < len) ? g_strstrip (split[2]) : "";
+
+    if (strpbrk (forms, "'\\")) {
+        uzbl_debug ("resume: invalid form state\n");
+    } else if (*forms) {
+        gchar *script = g_strdup_printf (resume_forms_js, forms);
+        run_page_js (script, NULL);
+        g_free (script);
+    }
+
+    g_strfreev (split);
+}
+
 IMPLEMENT_COMMAND (exit)
 {
     UZBL_UNUSED (argv);
@@ -2234,6 +2746,57 @@ IMPLEMENT_COMMAND (dump_config_as_events)
     uzbl_variables_dump_events ();
 }
 
+IMPLEMENT_COMMAND (bind)
+{
+    UZBL_UNUSED (result);
+
+    ARG_CHECK (argv, 1);
+
+    /* The event manager quotes each argument, so keystrokes such as a space
+     * survive, and escapes '@' in the bind command so that variables are
+     * expanded when the bind runs rather than now. */
+    const gchar *command = argv_idx (argv, 0);
+
+    if (!g_strcmp0 (command, "sync")) {
+        uzbl_gui_bind_sync ();
+    } else if (!g_strcmp0 (command, "add") && (argv->len == 4)) {
+        uzbl_gui_bind_add (argv_idx (argv, 1), argv_idx (argv, 2), argv_idx (argv, 3));
+    } else if (!g_strcmp0 (command, "mask") && (argv->len >= 3)) {
+        uzbl_gui_bind_add (argv_idx (argv, 1), argv_idx (argv, 2), NULL);
+    } else if (!g_strcmp0 (command, "remove") && (argv->len >= 3)) {
+        uzbl_gui_bind_remove (argv_idx (argv, 1), argv_idx (argv, 2));
+    } else if (!g_strcmp0 (command, "clear")) {
+        uzbl_gui_bind_clear ();
+    } else {
+        uzbl_debug ("Unrecognized bind command: %s\n", command);
+    }
+}
+
+IMPLEMENT_COMMAND (keycmd)
+{
+    UZBL_UNUSED (result);
+
+    ARG_CHECK (argv, 1);
+
+    const gchar *command = argv_idx (argv, 0);
+
+    if (!g_strcmp0 (command, "splice")) {
+        ARG_CHECK (argv, 4);
+
+        /* Replace <count> characters at <pos> with [text] and move the cursor
+         * so that the event manager only has to send what changed. */
+        glong pos = strtol (argv_idx (argv, 1), NULL, 10);
+        glong count = strtol (argv_idx (argv, 2), NULL, 10);
+        glong cursor = strtol (argv_idx (argv, 3), NULL, 10);
+
+        uzbl_gui_keycmd_splice (pos, count, cursor, argv_idx (argv, 4));
+    } else if (!g_strcmp0 (command, "clear")) {
+        uzbl_gui_keycmd_clear ();
+    } else {
+        uzbl_debug ("Unrecognized keycmd command: %s\n", command);
+    }
+}
+
 IMPLEMENT_COMMAND (event)
 {
     UZBL_UNUSED (result);
@@ -2314,6 +2877,67 @@ make_uri_from_user_input (const gchar *uri)
     return g_strconcat ("http://", uri, NULL);
 }
 
+void
+cookie_add (GArray *argv, guint offset)
+{
+    /* Parse with same syntax as ADD_COOKIE event. */
+    gchar *host = argv_idx (argv, offset + 0);
+    gchar *path = argv_idx (argv, offset + 1);
+    gchar *name = argv_idx (argv, offset + 2);
+    gchar *value = argv_idx (argv, offset + 3);
+    gchar *scheme = argv_idx (argv, offset + 4);
+    gchar *expires_arg = argv_idx (argv, offset + 5);
+
+    gboolean secure = FALSE;
+    gboolean httponly = FALSE;
+    SoupDate *expires = NULL;
+
+    if (g_str_has_prefix (scheme, "http")) {
+        secure = (scheme[4] == 's');
+        httponly = g_str_has_prefix (scheme + 4 + secure, "Only");
+    }
+    if (*expires_arg) {
+        expires = soup_date_new_from_time_t (strtoul (expires_arg, NULL, 10));
+    }
+
+    /* Create new cookie. It is a session cookie unless an expiry was given. */
+    static const int session_cookie = -1;
+    SoupCookie *cookie = soup_cookie_new (name, value, host, path, session_cookie);
+    soup_cookie_set_secure (cookie, secure);
+    soup_cookie_set_http_only (cookie, httponly);
+    if (expires) {
+        soup_cookie_set_expires (cookie, expires);
+    }
+
+    /* Add cookie to jar. */
+    soup_cookie_jar_add_cookie (SOUP_COOKIE_JAR (uzbl.net.soup_cookie_jar), cookie);
+
+    if (expires) {
+        soup_date_free (expires);
+    }
+}
+
+void
+cookie_delete (GArray *argv, guint offset)
+{
+    const gchar *domain = argv_idx (argv, offset + 0);
+    const gchar *path = argv_idx (argv, offset + 1);
+    const gchar *name = argv_idx (argv, offset + 2);
+    const gchar *value = argv_idx (argv, offset + 3);
+
+    static const int expired_cookie = 0;
+    SoupCookie *cookie = soup_cookie_new (
+        name,
+        value,
+        domain,
+        path,
+        expired_cookie);
+
+    soup_cookie_jar_delete_cookie (SOUP_COOKIE_JAR (uzbl.net.soup_cookie_jar), cookie);
+
+    soup_cookie_free (cookie);
+}
+
 #ifdef HAVE_PLUGIN_API
 void
 plugin_toggle_one (WebKitWebPlugin *plugin, gpointer data)
@@ -2349,7 +2973,65 @@ run_system_command (GArray *args, char **output_stdout);
 void
 spawn (GArray *argv, GString *result, gboolean exec)
 {
-    ARG_CHECK (argv, 1);
+    GArray *args = spawn_args (argv);
+
+    if (!args) {
+        return;
+    }
+
+    gchar *r = NULL;
+    run_system_command (args, result ? &r : NULL);
+    if (result && r) {
+        g_string_append (result, r);
+        if (exec) {
+            run_output_commands (r);
+        }
+    }
+
+    g_free (r);
+    uzbl_commands_args_free (args);
+}
+
+void
+spawn_sh (GArray *argv, GString *result)
+{
+    /* A lone script can run on a pooled shell instead of a new one. */
+    if (result && (argv->len == 1)) {
+        GString *output = g_string_new ("");
+
+        if (uzbl_spawn_pool_run (argv_idx (argv, 0), output)) {
+            remove_trailing_newline (output->str);
+            g_string_append (result, output->str);
+            g_string_free (output, TRUE);
+            return;
+        }
+
+        g_string_free (output, TRUE);
+    }
+
+    GArray *sh_cmd = spawn_sh_args (argv);
+
+    if (!sh_cmd) {
+        return;
+    }
+
+    gchar *r = NULL;
+    run_system_command (sh_cmd, result ? &r : NULL);
+    if (result && r) {
+        remove_trailing_newline (r);
+        g_string_append (result, r);
+    }
+
+    g_free (r);
+    uzbl_commands_args_free (sh_cmd);
+}
+
+GArray *
+spawn_args (GArray *argv)
+{
+    if (argv->len < 1) {
+        return NULL;
+    }
 
     const gchar *req_path = argv_idx (argv, 0);
 
@@ -2370,42 +3052,25 @@ spawn (GArray *argv, GString *result, gboolean exec)
         uzbl_commands_args_append (args, g_strdup (arg));
     }
 
-    gchar *r = NULL;
-    run_system_command (args, result ? &r : NULL);
-    if (result && r) {
-        g_string_append (result, r);
-        if (exec) {
-            /* Run each line of output from the program as a command. */
-            gchar *head = r;
-            gchar *tail;
-            while ((tail = strchr (head, '\n'))) {
-                *tail = '\0';
-                parse_command_from_file (head);
-                head = tail + 1;
-            }
-        }
-    }
-
-    g_free (r);
-    uzbl_commands_args_free (args);
+    return args;
 }
 
-void
-spawn_sh (GArray *argv, GString *result)
+GArray *
+spawn_sh_args (GArray *argv)
 {
     gchar *shell = uzbl_variables_get_string ("shell_cmd");
 
     if (!*shell) {
         uzbl_debug ("spawn_sh: shell_cmd is not set!\n");
         g_free (shell);
-        return;
+        return NULL;
     }
     guint i;
 
     GArray *sh_cmd = split_quoted (shell, TRUE);
     g_free (shell);
     if (!sh_cmd) {
-        return;
+        return NULL;
     }
 
     for (i = 0; i < argv->len; ++i) {
@@ -2413,15 +3078,20 @@ spawn_sh (GArray *argv, GString *result)
         uzbl_commands_args_append (sh_cmd, g_strdup (arg));
     }
 
-    gchar *r = NULL;
-    run_system_command (sh_cmd, result ? &r : NULL);
-    if (result && r) {
-        remove_trailing_newline (r);
-        g_string_append (result, r);
-    }
+    return sh_cmd;
+}
 
-    g_free (r);
-    uzbl_commands_args_free (sh_cmd);
+void
+run_output_commands (gchar *output)
+{
+    /* Run each line of output from the program as a command. */
+    gchar *head = output;
+    gchar *tail;
+    while ((tail = strchr (head, '\n'))) {
+        *tail = '\0';
+        parse_command_from_file (head);
+        head = tail + 1;
+    }
 }
 
 void
@@ -2504,3 +3174,17 @@ run_system_command (GArray *args, char **output_stdout)
 
     return result;
 }
+
+void
+run_page_js (const gchar *script, GString *result)
+{
+    GArray *js_argv = uzbl_commands_args_new ();
+
+    uzbl_commands_args_append (js_argv, g_strdup ("page"));
+    uzbl_commands_args_append (js_argv, g_strdup ("string"));
+    uzbl_commands_args_append (js_argv, g_strdup (script));
+
+    cmd_js (js_argv, result);
+
+    uzbl_commands_args_free (js_argv);
+}
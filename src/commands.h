@@ -22,6 +22,19 @@ uzbl_commands_run_argv (const gchar *cmd, GArray *argv, GString *result);
 void
 uzbl_commands_run (const gchar *cmd, GString *result);
 
+/* Return the arguments of the child spawn_sync or spawn_sh_sync would run
+ * for argv, or NULL for other commands. */
+GArray *
+uzbl_commands_spawn_argv (const UzblCommand *info, GArray *argv);
+
+typedef void (*UzblCommandsCallback)(GString *result, gpointer data);
+
+/* Run spawn_sync, spawn_sync_exec and spawn_sh_sync without waiting for the
+ * child; callback is called with the result once it is done. Returns FALSE if
+ * the command can not be run this way. */
+gboolean
+uzbl_commands_run_async (const UzblCommand *info, GArray *argv, UzblCommandsCallback callback, gpointer data);
+
 void
 uzbl_commands_load_file (const gchar *path);
 
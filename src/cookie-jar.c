@@ -2,9 +2,18 @@
 
 #include "events.h"
 #include "type.h"
+#include "uzbl-core.h"
 
 #include <libsoup/soup.h>
 
+#ifdef HAVE_LIBSOUP_CHECK_VERSION
+#include <libsoup/soup-version.h>
+
+#if SOUP_CHECK_VERSION (2, 42, 0)
+#define HAVE_COOKIE_JAR_DB
+#endif
+#endif
+
 /* =========================== PUBLIC API =========================== */
 
 static void
@@ -20,12 +29,65 @@ uzbl_cookie_jar_new ()
     return g_object_new (UZBL_TYPE_COOKIE_JAR, NULL);
 }
 
+gboolean
+uzbl_cookie_jar_set_store (UzblCookieJar *jar, const gchar *path)
+{
+    if (jar->store) {
+        g_object_unref (jar->store);
+        jar->store = NULL;
+    }
+
+    if (!path || !*path) {
+        return TRUE;
+    }
+
+#ifdef HAVE_COOKIE_JAR_DB
+    /* The database is read when it is opened; expired cookies are skipped. */
+    jar->store = soup_cookie_jar_db_new (path, FALSE);
+
+    GSList *cookies = soup_cookie_jar_all_cookies (jar->store);
+    GSList *iter;
+
+    jar->in_manual_add = 1;
+    for (iter = cookies; iter; iter = g_slist_next (iter)) {
+        /* The jar takes ownership of the cookie. */
+        soup_cookie_jar_add_cookie (SOUP_COOKIE_JAR (jar), iter->data);
+    }
+    jar->in_manual_add = 0;
+
+    g_slist_free (cookies);
+
+    return TRUE;
+#else
+    uzbl_debug ("Cookie databases require libsoup 2.42\n");
+    return FALSE;
+#endif
+}
+
+void
+uzbl_cookie_jar_clear_store (UzblCookieJar *jar)
+{
+    if (!jar->store) {
+        return;
+    }
+
+    GSList *cookies = soup_cookie_jar_all_cookies (jar->store);
+    GSList *iter;
+
+    for (iter = cookies; iter; iter = g_slist_next (iter)) {
+        soup_cookie_jar_delete_cookie (jar->store, iter->data);
+    }
+
+    soup_cookies_free (cookies);
+}
+
 /* ===================== HELPER IMPLEMENTATIONS ===================== */
 
 void
 soup_cookie_jar_socket_init (UzblCookieJar *jar)
 {
     jar->in_manual_add = 0;
+    jar->store = NULL;
 }
 
 static void
@@ -56,6 +118,18 @@ changed (SoupCookieJar *jar, SoupCookie *old_cookie, SoupCookie *new_cookie)
         return;
     }
 
+    /* Only changes made by this instance are written to the database;
+     * cookies added by commands come from the database itself or from
+     * another instance which has already stored them. */
+    if (uzbl_jar->store) {
+        if (new_cookie) {
+            /* Replaces any cookie with the same name, domain, and path. */
+            soup_cookie_jar_add_cookie (uzbl_jar->store, soup_cookie_copy (new_cookie));
+        } else {
+            soup_cookie_jar_delete_cookie (uzbl_jar->store, old_cookie);
+        }
+    }
+
     gchar *base_scheme = cookie->secure ? "https" : "http";
     gchar *scheme = g_strdup (base_scheme);
 
@@ -86,5 +160,12 @@ changed (SoupCookieJar *jar, SoupCookie *old_cookie, SoupCookie *new_cookie)
 void
 finalize (GObject *object)
 {
+    UzblCookieJar *uzbl_jar = UZBL_COOKIE_JAR (object);
+
+    if (uzbl_jar->store) {
+        g_object_unref (uzbl_jar->store);
+        uzbl_jar->store = NULL;
+    }
+
     G_OBJECT_CLASS (soup_cookie_jar_socket_parent_class)->finalize (object);
 }
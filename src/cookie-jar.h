@@ -11,6 +11,9 @@ typedef struct {
     SoupCookieJar parent;
 
     gboolean in_manual_add;
+
+    /* Optional on-disk jar changes are mirrored into. */
+    SoupCookieJar *store;
 } UzblCookieJar;
 
 typedef struct {
@@ -20,4 +23,15 @@ typedef struct {
 UzblCookieJar *
 uzbl_cookie_jar_new ();
 
+/* Attach the SQLite cookie database at path to the jar. Persistent cookies in
+ * the database are loaded into the jar without sending events and cookies
+ * changed by the page are written back. A NULL or empty path detaches the
+ * current database. */
+gboolean
+uzbl_cookie_jar_set_store (UzblCookieJar *jar, const gchar *path);
+
+/* Delete every cookie in the attached database. */
+void
+uzbl_cookie_jar_clear_store (UzblCookieJar *jar);
+
 #endif
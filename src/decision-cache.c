@@ -0,0 +1,241 @@
+#include "decision-cache.h"
+
+#include "setup.h"
+#include "uzbl-core.h"
+
+#include <libsoup/soup.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    gchar  *key;
+    gchar  *result;
+    gint64  expires;
+    GList   link;
+} UzblDecisionEntry;
+
+struct _UzblDecisionCache {
+    GHashTable *entries;
+    /* Entries, most recently used first. */
+    GQueue      lru;
+    guint       size;
+
+    guint64     hits;
+    guint64     misses;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+static void
+entry_free (gpointer data);
+static gchar *
+make_key (const gchar *handler, const gchar *key, const gchar *uri, gboolean host);
+static const gchar *
+lookup_key (const gchar *full_key);
+static void
+remove_entry (UzblDecisionEntry *entry);
+
+void
+uzbl_decision_cache_init ()
+{
+    uzbl.decision_cache = g_malloc0 (sizeof (UzblDecisionCache));
+
+    uzbl.decision_cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+        NULL, entry_free);
+    g_queue_init (&uzbl.decision_cache->lru);
+}
+
+void
+uzbl_decision_cache_free ()
+{
+    uzbl_decision_cache_clear ();
+    g_hash_table_destroy (uzbl.decision_cache->entries);
+
+    g_free (uzbl.decision_cache);
+    uzbl.decision_cache = NULL;
+}
+
+gchar *
+uzbl_decision_cache_lookup (const gchar *handler, const gchar *key, const gchar *uri)
+{
+    UzblDecisionCache *cache = uzbl.decision_cache;
+
+    if (!cache->size) {
+        return NULL;
+    }
+
+    gchar *full_key = make_key (handler, key, uri, FALSE);
+    const gchar *result = lookup_key (full_key);
+    g_free (full_key);
+
+    if (!result && uri) {
+        full_key = make_key (handler, key, uri, TRUE);
+        if (full_key) {
+            result = lookup_key (full_key);
+            g_free (full_key);
+        }
+    }
+
+    if (result) {
+        ++cache->hits;
+    } else {
+        ++cache->misses;
+    }
+
+    return g_strdup (result);
+}
+
+void
+uzbl_decision_cache_store (const gchar *handler, const gchar *key, const gchar *uri, GString *result)
+{
+    UzblDecisionCache *cache = uzbl.decision_cache;
+    gsize line_len = strcspn (result->str, "\n");
+    gchar *hint = g_strrstr_len (result->str, line_len, ";cache=");
+
+    if (!hint) {
+        return;
+    }
+
+    gchar *end = NULL;
+    gulong seconds = strtoul (hint + strlen (";cache="), &end, 10);
+    gboolean host = FALSE;
+
+    if (!strncmp (end, ",host", strlen (",host"))) {
+        host = TRUE;
+        end += strlen (",host");
+    }
+
+    if (end != result->str + line_len) {
+        /* Not a hint after all. */
+        return;
+    }
+
+    g_string_erase (result, hint - result->str, end - hint);
+
+    if (!cache->size || !seconds) {
+        return;
+    }
+
+    gchar *full_key = make_key (handler, key, uri, host);
+    if (!full_key) {
+        return;
+    }
+
+    UzblDecisionEntry *entry = g_hash_table_lookup (cache->entries, full_key);
+    if (entry) {
+        remove_entry (entry);
+    }
+
+    entry = g_malloc0 (sizeof (UzblDecisionEntry));
+    entry->key = full_key;
+    entry->result = g_strdup (result->str);
+    entry->expires = g_get_monotonic_time () + seconds * G_USEC_PER_SEC;
+    entry->link.data = entry;
+
+    g_hash_table_insert (cache->entries, entry->key, entry);
+    g_queue_push_head_link (&cache->lru, &entry->link);
+
+    uzbl_decision_cache_set_size (cache->size);
+}
+
+void
+uzbl_decision_cache_set_size (guint size)
+{
+    UzblDecisionCache *cache = uzbl.decision_cache;
+
+    cache->size = size;
+
+    while (g_queue_get_length (&cache->lru) > size) {
+        remove_entry ((UzblDecisionEntry *)g_queue_peek_tail (&cache->lru));
+    }
+}
+
+void
+uzbl_decision_cache_clear ()
+{
+    UzblDecisionCache *cache = uzbl.decision_cache;
+
+    while (!g_queue_is_empty (&cache->lru)) {
+        remove_entry ((UzblDecisionEntry *)g_queue_peek_head (&cache->lru));
+    }
+}
+
+void
+uzbl_decision_cache_stats (GString *result)
+{
+    UzblDecisionCache *cache = uzbl.decision_cache;
+
+    g_string_append_printf (result, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %u",
+        cache->hits, cache->misses, g_queue_get_length (&cache->lru));
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+void
+entry_free (gpointer data)
+{
+    UzblDecisionEntry *entry = (UzblDecisionEntry *)data;
+
+    g_free (entry->key);
+    g_free (entry->result);
+    g_free (entry);
+}
+
+gchar *
+make_key (const gchar *handler, const gchar *key, const gchar *uri, gboolean host)
+{
+    if (!uri) {
+        return g_strdup_printf ("%s\n\n%s", handler, key);
+    }
+
+    if (host) {
+        SoupURI *soup_uri = soup_uri_new (uri);
+        gchar *full_key = NULL;
+
+        if (soup_uri && soup_uri->host) {
+            full_key = g_strdup_printf ("%s\nhost %s\n%s", handler, soup_uri->host, key);
+        }
+
+        if (soup_uri) {
+            soup_uri_free (soup_uri);
+        }
+
+        return full_key;
+    }
+
+    /* The fragment never changes a decision. */
+    gsize len = strcspn (uri, "#");
+
+    return g_strdup_printf ("%s\nuri %.*s\n%s", handler, (int)len, uri, key);
+}
+
+const gchar *
+lookup_key (const gchar *full_key)
+{
+    UzblDecisionCache *cache = uzbl.decision_cache;
+    UzblDecisionEntry *entry = g_hash_table_lookup (cache->entries, full_key);
+
+    if (!entry) {
+        return NULL;
+    }
+
+    if (entry->expires <= g_get_monotonic_time ()) {
+        remove_entry (entry);
+        return NULL;
+    }
+
+    g_queue_unlink (&cache->lru, &entry->link);
+    g_queue_push_head_link (&cache->lru, &entry->link);
+
+    return entry->result;
+}
+
+void
+remove_entry (UzblDecisionEntry *entry)
+{
+    UzblDecisionCache *cache = uzbl.decision_cache;
+
+    g_queue_unlink (&cache->lru, &entry->link);
+    g_hash_table_remove (cache->entries, entry->key);
+}
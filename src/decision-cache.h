@@ -0,0 +1,27 @@
+#ifndef UZBL_DECISION_CACHE_H
+#define UZBL_DECISION_CACHE_H
+
+#include <glib.h>
+
+/* Handler results ending in ";cache=<SECONDS>" on their first line are kept
+ * for that long, keyed by the handler and its arguments. With ",host" the
+ * result applies to the whole host of the URI. */
+
+/* Return a copy of the cached result of handler for key or, if uri is not
+ * NULL, for the host of uri. Returns NULL on a miss. */
+gchar *
+uzbl_decision_cache_lookup (const gchar *handler, const gchar *key, const gchar *uri);
+/* Remove the cache hint from result, keeping the result if it had one. */
+void
+uzbl_decision_cache_store (const gchar *handler, const gchar *key, const gchar *uri, GString *result);
+
+/* Keep at most size results; 0 disables the cache. */
+void
+uzbl_decision_cache_set_size (guint size);
+void
+uzbl_decision_cache_clear ();
+/* Append the number of hits, misses and cached results to result. */
+void
+uzbl_decision_cache_stats (GString *result);
+
+#endif
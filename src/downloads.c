@@ -0,0 +1,565 @@
+#include "downloads.h"
+
+#include "commands.h"
+#include "events.h"
+#include "setup.h"
+#include "type.h"
+#include "util.h"
+#include "uzbl-core.h"
+#include "variables.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    DOWNLOAD_RESOLVING,
+    DOWNLOAD_QUEUED,
+    DOWNLOAD_ACTIVE,
+    /* Final states. */
+    DOWNLOAD_FINISHED,
+    DOWNLOAD_FAILED,
+    DOWNLOAD_CANCELLED
+} UzblDownloadState;
+
+typedef struct {
+    guint              id;
+    WebKitDownload    *download;
+    UzblDownloadState  state;
+    /* A file:// URI, set once download_handler answered. */
+    gchar             *destination;
+    /* Only set while the download-requested signal is being handled. */
+    gboolean           webkit_starts;
+
+    gint64             progress_time;
+    gdouble            progress;
+} UzblDownload;
+
+struct _UzblDownloads {
+    /* All downloads by id. */
+    GHashTable *table;
+    /* Downloads waiting for a free slot, oldest first. */
+    GQueue      queue;
+    guint       next_id;
+    guint       active;
+
+    guint       max_active;
+    guint       progress_interval;
+    guint       progress_step;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+static void
+download_free (gpointer data);
+
+void
+uzbl_downloads_init ()
+{
+    uzbl.downloads = g_malloc0 (sizeof (UzblDownloads));
+
+    uzbl.downloads->table = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, download_free);
+    g_queue_init (&uzbl.downloads->queue);
+}
+
+void
+uzbl_downloads_free ()
+{
+    g_queue_clear (&uzbl.downloads->queue);
+    g_hash_table_destroy (uzbl.downloads->table);
+
+    g_free (uzbl.downloads);
+    uzbl.downloads = NULL;
+}
+
+static void
+download_size_cb (WebKitDownload *download, GParamSpec *param_spec, gpointer data);
+static void
+download_status_cb (WebKitDownload *download, GParamSpec *param_spec, gpointer data);
+static gboolean
+download_error_cb (WebKitDownload *download, gint error_code, gint error_detail, gchar *reason, gpointer data);
+static void
+decide_destination (UzblDownload *dl, const gchar *suggested_destination);
+
+void
+uzbl_downloads_add (WebKitDownload *download, const gchar *destination, gboolean webkit_starts)
+{
+    UzblDownload *dl = g_malloc0 (sizeof (UzblDownload));
+
+    dl->id = ++uzbl.downloads->next_id;
+    dl->download = g_object_ref (download);
+    dl->state = DOWNLOAD_RESOLVING;
+    dl->webkit_starts = webkit_starts;
+
+    g_hash_table_insert (uzbl.downloads->table, GUINT_TO_POINTER (dl->id), dl);
+
+    g_object_connect (G_OBJECT (download),
+        "signal::notify::current-size", G_CALLBACK (download_size_cb),      dl,
+        "signal::notify::status",       G_CALLBACK (download_status_cb),    dl,
+        "signal::error",                G_CALLBACK (download_error_cb),     dl,
+        NULL);
+
+    decide_destination (dl, destination);
+
+    dl->webkit_starts = FALSE;
+}
+
+static void
+start_queued ();
+
+void
+uzbl_downloads_set_max_active (guint max)
+{
+    uzbl.downloads->max_active = max;
+
+    start_queued ();
+}
+
+void
+uzbl_downloads_set_progress_interval (guint interval)
+{
+    uzbl.downloads->progress_interval = interval;
+}
+
+void
+uzbl_downloads_set_progress_step (guint step)
+{
+    uzbl.downloads->progress_step = step;
+}
+
+static gint
+compare_ids (gconstpointer a, gconstpointer b);
+static const gchar *
+state_name (UzblDownloadState state);
+
+void
+uzbl_downloads_list (GString *result)
+{
+    GList *ids = g_list_sort (g_hash_table_get_keys (uzbl.downloads->table), compare_ids);
+    GList *l;
+
+    for (l = ids; l; l = l->next) {
+        UzblDownload *dl = g_hash_table_lookup (uzbl.downloads->table, l->data);
+        gdouble progress = 0;
+
+        if (dl->state != DOWNLOAD_RESOLVING) {
+            g_object_get (dl->download,
+                "progress", &progress,
+                NULL);
+        }
+
+        g_string_append_printf (result, "%u %s %.3f %s %s\n",
+            dl->id, state_name (dl->state), progress,
+            webkit_download_get_uri (dl->download),
+            dl->destination ? dl->destination + strlen ("file://") : "");
+    }
+
+    g_list_free (ids);
+}
+
+static void
+send_download_error (const gchar *destination, WebKitDownloadError err, const gchar *message);
+static void
+download_done (UzblDownload *dl, UzblDownloadState state);
+
+gboolean
+uzbl_downloads_cancel (guint id)
+{
+    UzblDownload *dl = g_hash_table_lookup (uzbl.downloads->table, GUINT_TO_POINTER (id));
+
+    if (!dl) {
+        return FALSE;
+    }
+
+    switch (dl->state) {
+    case DOWNLOAD_RESOLVING:
+        /* The pending handler result is ignored. */
+        dl->state = DOWNLOAD_CANCELLED;
+        webkit_download_cancel (dl->download);
+        break;
+    case DOWNLOAD_QUEUED:
+        g_queue_remove (&uzbl.downloads->queue, dl);
+        dl->state = DOWNLOAD_CANCELLED;
+        /* Close the paused connection now rather than when the download is
+         * cleared. WebKit does not know the destination yet, so the error is
+         * reported here instead of from download_error_cb. */
+        g_signal_handlers_block_by_func (dl->download, download_error_cb, dl);
+        webkit_download_cancel (dl->download);
+        g_signal_handlers_unblock_by_func (dl->download, download_error_cb, dl);
+        send_download_error (dl->destination,
+            WEBKIT_DOWNLOAD_ERROR_CANCELLED_BY_USER, "Cancelled while queued");
+        break;
+    case DOWNLOAD_ACTIVE:
+        webkit_download_cancel (dl->download);
+        download_done (dl, DOWNLOAD_CANCELLED);
+        break;
+    default:
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+is_done (gpointer key, gpointer value, gpointer data);
+
+void
+uzbl_downloads_clear ()
+{
+    g_hash_table_foreach_remove (uzbl.downloads->table, is_done, NULL);
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+void
+download_free (gpointer data)
+{
+    UzblDownload *dl = (UzblDownload *)data;
+
+    g_signal_handlers_disconnect_by_data (dl->download, dl);
+    g_object_unref (dl->download);
+    g_free (dl->destination);
+    g_free (dl);
+}
+
+static void
+send_progress (UzblDownload *dl, gdouble progress);
+
+void
+download_size_cb (WebKitDownload *download, GParamSpec *param_spec, gpointer data)
+{
+    UZBL_UNUSED (param_spec);
+
+    UzblDownload *dl = (UzblDownload *)data;
+    UzblDownloads *downloads = uzbl.downloads;
+
+    if (dl->state != DOWNLOAD_ACTIVE) {
+        return;
+    }
+
+    gdouble progress;
+    g_object_get (download,
+        "progress", &progress,
+        NULL);
+
+    /* The last update is never held back. */
+    if (progress < 1) {
+        gint64 now = g_get_monotonic_time ();
+
+        if ((now - dl->progress_time) < (gint64)downloads->progress_interval * 1000) {
+            return;
+        }
+
+        if ((progress - dl->progress) * 100 < downloads->progress_step) {
+            return;
+        }
+    } else if (dl->progress >= 1) {
+        return;
+    }
+
+    send_progress (dl, progress);
+}
+
+void
+download_status_cb (WebKitDownload *download, GParamSpec *param_spec, gpointer data)
+{
+    UZBL_UNUSED (param_spec);
+
+    UzblDownload *dl = (UzblDownload *)data;
+    WebKitDownloadStatus status = webkit_download_get_status (download);
+
+    switch (status) {
+    case WEBKIT_DOWNLOAD_STATUS_CREATED:
+    case WEBKIT_DOWNLOAD_STATUS_STARTED:
+        break;
+    case WEBKIT_DOWNLOAD_STATUS_CANCELLED:
+        download_done (dl, DOWNLOAD_CANCELLED);
+        break;
+    case WEBKIT_DOWNLOAD_STATUS_ERROR:
+        /* The error itself is sent from download_error_cb. */
+        download_done (dl, DOWNLOAD_FAILED);
+        break;
+    case WEBKIT_DOWNLOAD_STATUS_FINISHED:
+        if (dl->progress < 1) {
+            send_progress (dl, 1);
+        }
+
+        uzbl_events_send (DOWNLOAD_COMPLETE, NULL,
+            TYPE_STR, dl->destination + strlen ("file://"),
+            NULL);
+
+        download_done (dl, DOWNLOAD_FINISHED);
+        break;
+    default:
+        uzbl_debug ("Unknown download status: %d\n", status);
+        break;
+    }
+}
+
+gboolean
+download_error_cb (WebKitDownload *download, gint error_code, gint error_detail, gchar *reason, gpointer data)
+{
+    UZBL_UNUSED (error_code);
+    UZBL_UNUSED (data);
+
+    const gchar *destination = webkit_download_get_destination_uri (download);
+
+    send_download_error (destination, error_detail, reason);
+
+    return TRUE;
+}
+
+static void
+destination_decided (GString *result, gpointer data);
+
+void
+decide_destination (UzblDownload *dl, const gchar *suggested_destination)
+{
+    WebKitDownload *download = dl->download;
+
+    /* Get the URI being downloaded. */
+    const gchar *uri = webkit_download_get_uri (download);
+
+    uzbl_debug ("Download requested -> %s\n", uri);
+
+    gchar *handler = uzbl_variables_get_string ("download_handler");
+
+    GArray *args = uzbl_commands_args_new ();
+    const UzblCommand *download_command = uzbl_commands_parse (handler, args);
+    g_free (handler);
+    if (!download_command) {
+        dl->state = DOWNLOAD_CANCELLED;
+        webkit_download_cancel (download);
+        uzbl_commands_args_free (args);
+        return;
+    }
+
+    /* Get the mimetype of the download. */
+    const gchar *content_type = NULL;
+    guint64 total_size = 0;
+    WebKitNetworkResponse *response = webkit_download_get_network_response (download);
+    /* Downloads can be initiated from the context menu, in that case there is
+     * no network response yet and trying to get one would crash. */
+    if (WEBKIT_IS_NETWORK_RESPONSE (response)) {
+        SoupMessage        *message = webkit_network_response_get_message (response);
+        SoupMessageHeaders *headers = NULL;
+        g_object_get (G_OBJECT (message),
+            "response-headers", &headers,
+            NULL);
+        /* Some versions of libsoup don't have "response-headers" here. */
+        if (headers) {
+            content_type = soup_message_headers_get_one (headers, "Content-Type");
+        }
+    }
+
+    /* Get the filesize of the download, as given by the server. It may be
+     * inaccurate, but there's nothing we can do about that. */
+    total_size = webkit_download_get_total_size (download);
+
+    if (!content_type) {
+        content_type = "application/octet-stream";
+    }
+
+    const gchar *suggested_filename = webkit_download_get_suggested_filename (download);
+
+    uzbl_commands_args_append (args, g_strdup (uri));
+    uzbl_commands_args_append (args, g_strdup (suggested_filename));
+    uzbl_commands_args_append (args, g_strdup (content_type));
+    gchar *total_size_s = g_strdup_printf ("%" G_GUINT64_FORMAT, total_size);
+    uzbl_commands_args_append (args, total_size_s);
+    uzbl_commands_args_append (args, g_strdup (suggested_destination ? suggested_destination : ""));
+
+    /* Handlers which spawn a child are not waited for. The download is then
+     * started once the destination is known. */
+    if (!uzbl_commands_run_async (download_command, args, destination_decided, GUINT_TO_POINTER (dl->id))) {
+        GString *result = g_string_new ("");
+        uzbl_commands_run_parsed (download_command, args, result);
+        destination_decided (result, GUINT_TO_POINTER (dl->id));
+        g_string_free (result, TRUE);
+    }
+
+    uzbl_commands_args_free (args);
+}
+
+static void
+download_begin (UzblDownload *dl);
+
+void
+destination_decided (GString *result, gpointer data)
+{
+    if (!uzbl.downloads) {
+        return;
+    }
+
+    UzblDownload *dl = g_hash_table_lookup (uzbl.downloads->table, data);
+
+    if (!dl || (dl->state != DOWNLOAD_RESOLVING)) {
+        return;
+    }
+
+    /* No response, cancel the download. */
+    if (!result->len) {
+        dl->state = DOWNLOAD_CANCELLED;
+        webkit_download_cancel (dl->download);
+        return;
+    }
+
+    gboolean is_file_uri = g_str_has_prefix (result->str, "file:///");
+
+    gchar *destination_uri;
+    /* Convert relative path to absolute path. */
+    if (!is_file_uri) {
+        if (*result->str == '/') {
+            destination_uri = g_strconcat ("file://", result->str, NULL);
+        } else {
+            gchar *cwd = g_get_current_dir ();
+            destination_uri = g_strconcat ("file://", cwd, "/", result->str, NULL);
+            g_free (cwd);
+        }
+    } else {
+        destination_uri = g_strdup (result->str);
+    }
+
+    int len = strlen (destination_uri);
+    if (destination_uri[len - 1] == '\n') {
+        destination_uri[len - 1] = '\0';
+    }
+
+    dl->destination = destination_uri;
+
+    UzblDownloads *downloads = uzbl.downloads;
+
+    if (downloads->max_active && (downloads->active >= downloads->max_active)) {
+        dl->state = DOWNLOAD_QUEUED;
+        g_queue_push_tail (&downloads->queue, dl);
+        return;
+    }
+
+    download_begin (dl);
+}
+
+void
+download_begin (UzblDownload *dl)
+{
+    dl->state = DOWNLOAD_ACTIVE;
+    ++uzbl.downloads->active;
+
+    uzbl_events_send (DOWNLOAD_STARTED, NULL,
+        TYPE_STR, dl->destination + strlen ("file://"),
+        NULL);
+
+    webkit_download_set_destination_uri (dl->download, dl->destination);
+
+    if (!dl->webkit_starts) {
+        webkit_download_start (dl->download);
+    }
+}
+
+void
+download_done (UzblDownload *dl, UzblDownloadState state)
+{
+    if (dl->state != DOWNLOAD_ACTIVE) {
+        return;
+    }
+
+    dl->state = state;
+    --uzbl.downloads->active;
+
+    start_queued ();
+}
+
+void
+start_queued ()
+{
+    UzblDownloads *downloads = uzbl.downloads;
+
+    while (!g_queue_is_empty (&downloads->queue) &&
+           (!downloads->max_active || (downloads->active < downloads->max_active))) {
+        download_begin ((UzblDownload *)g_queue_pop_head (&downloads->queue));
+    }
+}
+
+void
+send_progress (UzblDownload *dl, gdouble progress)
+{
+    dl->progress_time = g_get_monotonic_time ();
+    dl->progress = progress;
+
+    uzbl_events_send (DOWNLOAD_PROGRESS, NULL,
+        TYPE_STR, dl->destination + strlen ("file://"),
+        TYPE_DOUBLE, progress,
+        TYPE_ULL, (unsigned long long)webkit_download_get_current_size (dl->download),
+        TYPE_ULL, (unsigned long long)webkit_download_get_total_size (dl->download),
+        NULL);
+}
+
+void
+send_download_error (const gchar *destination, WebKitDownloadError err, const gchar *message)
+{
+    const gchar *str;
+
+    switch (err) {
+    case WEBKIT_DOWNLOAD_ERROR_CANCELLED_BY_USER:
+        str = "cancelled";
+        break;
+    case WEBKIT_DOWNLOAD_ERROR_DESTINATION:
+        str = "destination";
+        break;
+    case WEBKIT_DOWNLOAD_ERROR_NETWORK:
+        str = "network";
+        break;
+    default:
+        str = "unknown";
+        break;
+    }
+
+    uzbl_events_send (DOWNLOAD_ERROR, NULL,
+        TYPE_STR, destination ? destination : "",
+        TYPE_STR, str,
+        TYPE_INT, err,
+        TYPE_STR, message,
+        NULL);
+}
+
+gint
+compare_ids (gconstpointer a, gconstpointer b)
+{
+    guint x = GPOINTER_TO_UINT (a);
+    guint y = GPOINTER_TO_UINT (b);
+
+    return (x < y) ? -1 : (x > y);
+}
+
+const gchar *
+state_name (UzblDownloadState state)
+{
+    switch (state) {
+    case DOWNLOAD_RESOLVING:
+        return "resolving";
+    case DOWNLOAD_QUEUED:
+        return "queued";
+    case DOWNLOAD_ACTIVE:
+        return "active";
+    case DOWNLOAD_FINISHED:
+        return "finished";
+    case DOWNLOAD_FAILED:
+        return "failed";
+    case DOWNLOAD_CANCELLED:
+        return "cancelled";
+    default:
+        g_assert_not_reached ();
+    }
+
+    return NULL;
+}
+
+gboolean
+is_done (gpointer key, gpointer value, gpointer data)
+{
+    UZBL_UNUSED (key);
+    UZBL_UNUSED (data);
+
+    UzblDownload *dl = (UzblDownload *)value;
+
+    return (dl->state > DOWNLOAD_ACTIVE);
+}
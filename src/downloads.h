@@ -0,0 +1,32 @@
+#ifndef UZBL_DOWNLOADS_H
+#define UZBL_DOWNLOADS_H
+
+#include "webkit.h"
+
+/* Track download and ask download_handler for its destination. The handler is
+ * run asynchronously when it spawns a child. If webkit_starts is TRUE, WebKit
+ * starts the download itself if the destination is set before this returns
+ * (as is the case for the download-requested signal). */
+void
+uzbl_downloads_add (WebKitDownload *download, const gchar *destination, gboolean webkit_starts);
+
+/* Run at most max downloads at once; 0 means no limit. */
+void
+uzbl_downloads_set_max_active (guint max);
+/* Send DOWNLOAD_PROGRESS at most every interval milliseconds and only once the
+ * progress advanced by step percent. */
+void
+uzbl_downloads_set_progress_interval (guint interval);
+void
+uzbl_downloads_set_progress_step (guint step);
+
+/* Append a line for each download to result. */
+void
+uzbl_downloads_list (GString *result);
+gboolean
+uzbl_downloads_cancel (guint id);
+/* Forget downloads which are no longer running. */
+void
+uzbl_downloads_clear ();
+
+#endif
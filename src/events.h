@@ -14,6 +14,7 @@
     call (REQUEST_QUEUED),      \
     call (REQUEST_STARTING),    \
     call (REQUEST_FINISHED),    \
+    call (REQUEST_FILTERED),    \
     call (KEY_PRESS),           \
     call (KEY_RELEASE),         \
     call (MOD_PRESS),           \
@@ -58,6 +59,10 @@
     call (SCRIPT_MESSAGE),      \
     call (SHOW_NOTIFICATION),   \
     call (CLOSE_NOTIFICATION),  \
+    call (BIND_EXECUTED),       \
+    call (INSTANCE_SUSPEND),    \
+    call (SNAPSHOT_SAVED),      \
+    call (SNAPSHOT_ERROR),      \
     /* Must be last entry. */   \
     call (LAST_EVENT)
 
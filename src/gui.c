@@ -1,9 +1,13 @@
 #include "gui.h"
 
 #include "commands.h"
+#include "decision-cache.h"
+#include "downloads.h"
 #include "events.h"
 #include "io.h"
 #include "menu.h"
+#include "request-filter.h"
+#include "site-settings.h"
 #include "status-bar.h"
 #include "type.h"
 #include "util.h"
@@ -44,6 +48,15 @@ struct _UzblGui {
 
     GdkEventButton *last_button;
     WebKitWebView *tmp_web_view;
+
+    /* Native binds */
+    GHashTable *binds;
+    guint binds_pending;
+    guint native_keyval;
+
+    /* Keycmd */
+    GString *keycmd;
+    glong keycmd_cursor;
 };
 
 /* =========================== PUBLIC API =========================== */
@@ -81,6 +94,10 @@ uzbl_gui_init ()
     gtk_im_context_reset (uzbl.gui_->im_context);
     g_signal_connect (uzbl.gui_->im_context, "commit",
         G_CALLBACK (uzbl_input_commit_cb), uzbl.gui_);
+
+    uzbl.gui_->binds = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, g_free);
+    uzbl.gui_->keycmd = g_string_new ("");
 }
 
 void
@@ -101,6 +118,9 @@ uzbl_gui_free ()
         g_object_unref (uzbl.gui_->tmp_web_view);
     }
 
+    g_hash_table_destroy (uzbl.gui_->binds);
+    g_string_free (uzbl.gui_->keycmd, TRUE);
+
     g_free (uzbl.gui_);
     uzbl.gui_ = NULL;
 }
@@ -150,8 +170,179 @@ uzbl_gui_update_title ()
     g_free (title_format);
 }
 
+static gchar *
+native_bind_lookup_key (const gchar *mode, const gchar *keystroke);
+
+void
+uzbl_gui_bind_add (const gchar *mode, const gchar *keystroke, const gchar *command)
+{
+    gchar *key = native_bind_lookup_key (mode, keystroke);
+
+    if (!key) {
+        uzbl_debug ("Invalid native bind keystroke: %s\n", keystroke);
+        return;
+    }
+
+    /* Presses forwarded before the table was in use were not counted, and
+     * the event manager only answers presses once it has sent a bind. */
+    if (!g_hash_table_size (uzbl.gui_->binds)) {
+        uzbl.gui_->binds_pending = 0;
+    }
+
+    /* A NULL command masks the keystroke so that it is always sent to the
+     * event manager, even if a global bind exists for it. */
+    g_hash_table_replace (uzbl.gui_->binds, key, g_strdup (command));
+}
+
+void
+uzbl_gui_bind_remove (const gchar *mode, const gchar *keystroke)
+{
+    gchar *key = native_bind_lookup_key (mode, keystroke);
+
+    if (key) {
+        g_hash_table_remove (uzbl.gui_->binds, key);
+        g_free (key);
+    }
+}
+
+void
+uzbl_gui_bind_clear ()
+{
+    /* Key presses still in flight keep being waited for. */
+    g_hash_table_remove_all (uzbl.gui_->binds);
+}
+
+void
+uzbl_gui_bind_sync ()
+{
+    if (uzbl.gui_->binds_pending) {
+        --uzbl.gui_->binds_pending;
+    }
+}
+
+static void
+keycmd_changed ();
+
+void
+uzbl_gui_keycmd_splice (glong pos, glong count, glong cursor, const gchar *text)
+{
+    GString *keycmd = uzbl.gui_->keycmd;
+    glong len = g_utf8_strlen (keycmd->str, keycmd->len);
+
+    /* Positions count characters, not bytes. */
+    pos = CLAMP (pos, 0, len);
+    count = CLAMP (count, 0, len - pos);
+
+    gchar *start = g_utf8_offset_to_pointer (keycmd->str, pos);
+    gchar *end = g_utf8_offset_to_pointer (start, count);
+    gssize offset = start - keycmd->str;
+
+    g_string_erase (keycmd, offset, end - start);
+    if (text) {
+        g_string_insert (keycmd, offset, text);
+    }
+
+    len = g_utf8_strlen (keycmd->str, keycmd->len);
+    uzbl.gui_->keycmd_cursor = CLAMP (cursor, 0, len);
+
+    keycmd_changed ();
+}
+
+void
+uzbl_gui_keycmd_clear ()
+{
+    if (!uzbl.gui_->keycmd->len) {
+        return;
+    }
+
+    g_string_truncate (uzbl.gui_->keycmd, 0);
+    uzbl.gui_->keycmd_cursor = 0;
+
+    keycmd_changed ();
+}
+
+/* Scrollbar events */
+static gboolean
+scroll_vert_cb (GtkAdjustment *adjust, gpointer data);
+static gboolean
+scroll_horiz_cb (GtkAdjustment *adjust, gpointer data);
+
+void
+uzbl_gui_scroll_events_block (gboolean block)
+{
+    if (block) {
+        g_signal_handlers_block_by_func (uzbl.gui.bar_v, scroll_vert_cb, NULL);
+        g_signal_handlers_block_by_func (uzbl.gui.bar_h, scroll_horiz_cb, NULL);
+    } else {
+        g_signal_handlers_unblock_by_func (uzbl.gui.bar_v, scroll_vert_cb, NULL);
+        g_signal_handlers_unblock_by_func (uzbl.gui.bar_h, scroll_horiz_cb, NULL);
+    }
+}
+
 /* ===================== HELPER IMPLEMENTATIONS ===================== */
 
+static void
+append_keycmd_chunk (GString *markup, const gchar *chunk, gsize len)
+{
+    gsize i;
+
+    if (!len) {
+        return;
+    }
+
+    g_string_append (markup, "@[");
+    for (i = 0; i < len; ++i) {
+        if ((chunk[i] == '\\') || (chunk[i] == '@')) {
+            g_string_append_c (markup, '\\');
+        }
+        g_string_append_c (markup, chunk[i]);
+    }
+    g_string_append (markup, "]@");
+}
+
+void
+keycmd_changed ()
+{
+    GString *keycmd = uzbl.gui_->keycmd;
+    GString *markup = g_string_new ("");
+
+    /* Same markup the keycmd plugin used to send: the character under the
+     * cursor (or a space past the end) gets @cursor_style. */
+    if (keycmd->len) {
+        const gchar *cursor = g_utf8_offset_to_pointer (keycmd->str, uzbl.gui_->keycmd_cursor);
+        const gchar *after = *cursor ? g_utf8_next_char (cursor) : cursor;
+        const gchar *end = keycmd->str + keycmd->len;
+
+        append_keycmd_chunk (markup, keycmd->str, cursor - keycmd->str);
+        g_string_append (markup, "<span @cursor_style>");
+        if (*cursor) {
+            append_keycmd_chunk (markup, cursor, after - cursor);
+        } else {
+            append_keycmd_chunk (markup, " ", 1);
+        }
+        g_string_append (markup, "</span>");
+        append_keycmd_chunk (markup, after, end - after);
+    }
+
+    /* The old "set keycmd" command expanded its value before storing it and
+     * status_format is not expanded recursively, so expand it here. */
+    gchar *expanded = uzbl_variables_expand (markup->str);
+    uzbl_variables_set_quiet ("keycmd", expanded);
+    g_free (expanded);
+    g_string_free (markup, TRUE);
+
+    /* Only the left part of the status bar shows the keycmd. */
+    if (uzbl_variables_get_int ("show_status")) {
+        gchar *status_format = uzbl_variables_get_string ("status_format");
+        gchar *parsed = uzbl_variables_expand (status_format);
+        uzbl_status_bar_update_left (uzbl.gui.status_bar, parsed);
+        g_free (status_format);
+        g_free (parsed);
+    } else {
+        uzbl_gui_update_title ();
+    }
+}
+
 static gboolean
 key_press_cb (GtkWidget *widget, GdkEventKey *event, gpointer data);
 static gboolean
@@ -244,11 +435,6 @@ populate_popup_cb (WebKitWebView *view, GtkMenu *menu, gpointer data);
 static gboolean
 run_file_chooser_cb (WebKitWebView *view, WebKitFileChooserRequest *request, gpointer data);
 #endif
-/* Scrollbar events */
-static gboolean
-scroll_vert_cb (GtkAdjustment *adjust, gpointer data);
-static gboolean
-scroll_horiz_cb (GtkAdjustment *adjust, gpointer data);
 
 void
 web_view_init ()
@@ -383,6 +569,10 @@ static guint
 key_to_modifier (guint keyval);
 static gchar *
 get_modifier_mask (guint state);
+static void
+native_bind_forwarded ();
+static gboolean
+native_bind_run (guint state, const gchar *key);
 
 static void
 uzbl_input_commit_cb (GtkIMContext *context, const gchar *str, gpointer data)
@@ -391,6 +581,10 @@ uzbl_input_commit_cb (GtkIMContext *context, const gchar *str, gpointer data)
 
     UzblGui *gui = (UzblGui *)data;
 
+    if (native_bind_run (gui->current_key_state, str)) {
+        return;
+    }
+
     gchar *modifiers = get_modifier_mask (gui->current_key_state);
     uzbl_events_send (KEY_PRESS, NULL,
         TYPE_STR, modifiers,
@@ -801,7 +995,7 @@ download_cb (WebKitWebView *view, WebKitDownload *download, gpointer data)
     UZBL_UNUSED (view);
     UZBL_UNUSED (data);
 
-    handle_download (download, NULL);
+    uzbl_downloads_add (download, NULL, TRUE);
 
     return TRUE;
 }
@@ -1139,6 +1333,9 @@ get_modifier_mask (guint state)
     return g_string_free (modifiers, FALSE);
 }
 
+static gboolean
+native_bind_handled (GdkEventKey *event, guint state, const gchar *key);
+
 void
 send_keypress_event (GdkEventKey *event)
 {
@@ -1172,6 +1369,9 @@ send_keypress_event (GdkEventKey *event)
     } else if (event->is_modifier && mod) {
         gchar *newmods = get_modifier_mask (mod);
 
+        if (event->type == GDK_KEY_PRESS) {
+            native_bind_forwarded ();
+        }
         uzbl_events_send ((event->type == GDK_KEY_PRESS) ? MOD_PRESS : MOD_RELEASE, NULL,
             TYPE_STR, modifiers,
             TYPE_NAME, newmods,
@@ -1184,16 +1384,20 @@ send_keypress_event (GdkEventKey *event)
          * combining chars right. */
         ulen = g_unichar_to_utf8 (ukval, ucs);
         ucs[ulen] = 0;
-        uzbl_events_send ((event->type == GDK_KEY_PRESS) ? KEY_PRESS : KEY_RELEASE, NULL,
-            TYPE_STR, modifiers,
-            TYPE_STR, ucs,
-            NULL);
+        if (!native_bind_handled (event, uzbl.gui_->current_key_state, ucs)) {
+            uzbl_events_send ((event->type == GDK_KEY_PRESS) ? KEY_PRESS : KEY_RELEASE, NULL,
+                TYPE_STR, modifiers,
+                TYPE_STR, ucs,
+                NULL);
+        }
     } else if ((keyname = gdk_keyval_name (event->keyval))) {
         /* Send keysym for non-printable chars. */
-        uzbl_events_send ((event->type == GDK_KEY_PRESS) ? KEY_PRESS : KEY_RELEASE, NULL,
-            TYPE_STR, modifiers,
-            TYPE_NAME, keyname,
-            NULL);
+        if (!native_bind_handled (event, uzbl.gui_->current_key_state, keyname)) {
+            uzbl_events_send ((event->type == GDK_KEY_PRESS) ? KEY_PRESS : KEY_RELEASE, NULL,
+                TYPE_STR, modifiers,
+                TYPE_NAME, keyname,
+                NULL);
+        }
     }
     /* Put back the state to its initial value to not disturb further processing
      * of the event */
@@ -1202,6 +1406,199 @@ send_keypress_event (GdkEventKey *event)
     g_free (modifiers);
 }
 
+static const struct {
+    const gchar *name;
+    guint mask;
+} native_bind_modifiers[] = {
+    { "Shift",      GDK_SHIFT_MASK   },
+    { "ScrollLock", GDK_LOCK_MASK    },
+    { "Ctrl",       GDK_CONTROL_MASK },
+    { "Mod1",       GDK_MOD1_MASK    },
+    { "Mod3",       GDK_MOD3_MASK    },
+    { "Mod4",       GDK_MOD4_MASK    },
+    { "Mod5",       GDK_MOD5_MASK    },
+    { NULL,         0                }
+};
+
+#define NATIVE_BIND_MASK (GDK_SHIFT_MASK | GDK_LOCK_MASK | GDK_CONTROL_MASK | \
+                          GDK_MOD1_MASK | GDK_MOD3_MASK | GDK_MOD4_MASK |     \
+                          GDK_MOD5_MASK)
+
+/* Keystrokes are written as in bind globs: modifiers in the order above
+ * followed by a single character or a <KeyName>, e.g. "<Ctrl>t" or
+ * "<Mod1><Page_Down>". */
+static gchar *
+native_bind_keystroke (guint mask, const gchar *key)
+{
+    GString *keystroke = g_string_new ("");
+    guint i;
+
+    for (i = 0; native_bind_modifiers[i].name; ++i) {
+        if (mask & native_bind_modifiers[i].mask) {
+            g_string_append_printf (keystroke, "<%s>", native_bind_modifiers[i].name);
+        }
+    }
+
+    if (g_utf8_strlen (key, -1) == 1) {
+        g_string_append (keystroke, key);
+    } else {
+        g_string_append_printf (keystroke, "<%s>", key);
+    }
+
+    return g_string_free (keystroke, FALSE);
+}
+
+gchar *
+native_bind_lookup_key (const gchar *mode, const gchar *keystroke)
+{
+    const gchar *key = keystroke;
+    guint mask = 0;
+
+    while (*key == '<') {
+        const gchar *end = strchr (key, '>');
+        gsize len = end ? (gsize)(end - key - 1) : 0;
+        guint i;
+
+        for (i = 0; native_bind_modifiers[i].name; ++i) {
+            const gchar *name = native_bind_modifiers[i].name;
+
+            if (strlen (name) == len && !strncmp (key + 1, name, len)) {
+                break;
+            }
+        }
+
+        if (!end || !native_bind_modifiers[i].name) {
+            break;
+        }
+
+        mask |= native_bind_modifiers[i].mask;
+        key = end + 1;
+    }
+
+    gsize key_len = strlen (key);
+
+    if (!key_len) {
+        return NULL;
+    }
+
+    if (key_len > 2 && key[0] == '<' && key[key_len - 1] == '>') {
+        return g_strdup_printf ("%s\n%x\n%.*s", mode, mask, (int)(key_len - 2), key + 1);
+    }
+
+    return g_strdup_printf ("%s\n%x\n%s", mode, mask, key);
+}
+
+void
+native_bind_forwarded ()
+{
+    /* The event manager answers each key press with "bind sync" once it has
+     * handled it. Until then the mode and keycmd variables may be stale, so
+     * native binds wait for it to catch up. Without a table nothing waits, so
+     * the event manager need not answer. */
+    if (g_hash_table_size (uzbl.gui_->binds)) {
+        ++uzbl.gui_->binds_pending;
+    }
+}
+
+gboolean
+native_bind_handled (GdkEventKey *event, guint state, const gchar *key)
+{
+    UzblGui *gui = uzbl.gui_;
+
+    if (event->type != GDK_KEY_PRESS) {
+        /* Swallow the release of a natively handled key as well. */
+        if (gui->native_keyval && (gui->native_keyval == event->keyval)) {
+            gui->native_keyval = 0;
+            return TRUE;
+        }
+
+        return FALSE;
+    }
+
+    gui->native_keyval = 0;
+
+    if (native_bind_run (state, key)) {
+        gui->native_keyval = event->keyval;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+gboolean
+native_bind_run (guint state, const gchar *key)
+{
+    UzblGui *gui = uzbl.gui_;
+
+    if (!g_hash_table_size (gui->binds) || gui->binds_pending) {
+        native_bind_forwarded ();
+        return FALSE;
+    }
+
+    guint mask = state & NATIVE_BIND_MASK;
+    gchar *mode = uzbl_variables_get_string ("mode");
+    gboolean in_keycmd = FALSE;
+    gpointer command = NULL;
+    gboolean found = FALSE;
+
+    if (!mode || !*mode) {
+        g_free (mode);
+        mode = g_strdup ("global");
+    }
+
+    /* Unmodified characters may continue the keycmd, which only the event
+     * manager knows how to match, and are not matched at all while
+     * keycmd_events is off. */
+    if (!mask && (g_utf8_strlen (key, -1) == 1)) {
+        gchar *keycmd_events = uzbl_variables_get_string ("keycmd_events");
+
+        in_keycmd = gui->keycmd->len ||
+                    (keycmd_events && *keycmd_events && g_strcmp0 (keycmd_events, "1"));
+
+        g_free (keycmd_events);
+    }
+
+    if (!in_keycmd && g_strcmp0 (mode, "stack")) {
+        gchar *lookup = g_strdup_printf ("%s\n%x\n%s", mode, mask, key);
+        found = g_hash_table_lookup_extended (gui->binds, lookup, NULL, &command);
+        g_free (lookup);
+
+        if (!found && g_strcmp0 (mode, "global")) {
+            g_free (mode);
+            mode = g_strdup ("global");
+
+            lookup = g_strdup_printf ("%s\n%x\n%s", mode, mask, key);
+            found = g_hash_table_lookup_extended (gui->binds, lookup, NULL, &command);
+            g_free (lookup);
+        }
+    }
+
+    if (!command) {
+        g_free (mode);
+        native_bind_forwarded ();
+        return FALSE;
+    }
+
+    /* The command may replace the bind table. */
+    gchar *run = g_strdup (command);
+    gchar *keystroke = native_bind_keystroke (mask, key);
+
+    uzbl_debug ("Native bind %s %s: %s\n", mode, keystroke, run);
+
+    uzbl_events_send (BIND_EXECUTED, NULL,
+        TYPE_STR, mode,
+        TYPE_STR, keystroke,
+        NULL);
+
+    uzbl_commands_run (run, NULL);
+
+    g_free (keystroke);
+    g_free (run);
+    g_free (mode);
+
+    return TRUE;
+}
+
 gint
 get_click_context ()
 {
@@ -1248,6 +1645,9 @@ send_button_event (guint buttonval, guint state, gint mode)
 
     details = g_strdup_printf ("%sButton%d", reps, buttonval);
 
+    if (mode == GDK_BUTTON_PRESS) {
+        native_bind_forwarded ();
+    }
     uzbl_events_send ((mode == GDK_BUTTON_PRESS) ? KEY_PRESS : KEY_RELEASE, NULL,
         TYPE_STR, modifiers,
         TYPE_FORMATTEDSTR, details,
@@ -1284,6 +1684,19 @@ send_hover_event (const gchar *uri, const gchar *title)
     uzbl_gui_update_title ();
 }
 
+typedef struct {
+    WebKitWebPolicyDecision *decision;
+    gchar *handler;
+    gchar *key;
+    gchar *uri;
+} UzblPolicyDecision;
+
+static void
+apply_policy (WebKitWebPolicyDecision *decision, const gchar *result);
+static gboolean
+cached_policy (WebKitWebPolicyDecision *decision, const gchar *handler, const gchar *key, const gchar *uri);
+static UzblPolicyDecision *
+policy_decision_new (WebKitWebPolicyDecision *decision, const gchar *handler, gchar *key, const gchar *uri);
 static void
 decide_navigation (GString *result, gpointer data);
 
@@ -1311,15 +1724,28 @@ navigation_decision (WebKitWebPolicyDecision *decision, const gchar *uri, const
     const UzblCommand *scheme_command = uzbl_commands_parse (handler, args);
 
     if (scheme_command) {
+        gchar *modifier_mask = get_modifier_mask (modifiers);
+        gchar *key = g_strdup_printf ("%s\n%s\n%s\n%d\n%s\n%d",
+            src_frame ? src_frame : "", dest_frame ? dest_frame : "", type,
+            button, modifier_mask, is_gesture);
+
+        if (cached_policy (decision, handler, key, uri)) {
+            g_free (key);
+            g_free (modifier_mask);
+            uzbl_commands_args_free (args);
+            g_free (handler);
+            return TRUE;
+        }
+
         uzbl_commands_args_append (args, g_strdup (uri));
         uzbl_commands_args_append (args, g_strdup (src_frame ? src_frame : ""));
         uzbl_commands_args_append (args, g_strdup (dest_frame ? dest_frame : ""));
         uzbl_commands_args_append (args, g_strdup (type));
         uzbl_commands_args_append (args, g_strdup_printf ("%d", button));
-        uzbl_commands_args_append (args, get_modifier_mask (modifiers));
+        uzbl_commands_args_append (args, modifier_mask);
         uzbl_commands_args_append (args, g_strdup (is_gesture ? "true" : "false"));
-        g_object_ref (decision);
-        uzbl_io_schedule_command (scheme_command, args, decide_navigation, decision);
+        uzbl_io_schedule_command (scheme_command, args, decide_navigation,
+            policy_decision_new (decision, handler, key, uri));
     } else {
         make_policy (decision, use);
         uzbl_commands_args_free (args);
@@ -1338,6 +1764,18 @@ request_decision (const gchar *uri, gpointer data)
 {
     uzbl_debug ("Request starting -> %s\n", uri);
 
+    /* Requests decided by the filter lists are only counted. */
+    GString *filtered = g_string_new ("");
+    if (uzbl_request_filter_decide (uri, filtered)) {
+        UzblRequestDecision *decision = (UzblRequestDecision *)data;
+
+        rewrite_request (filtered, (gpointer)decision->request);
+        g_string_free (filtered, TRUE);
+
+        return TRUE;
+    }
+    g_string_free (filtered, TRUE);
+
     uzbl_events_send (REQUEST_STARTING, NULL,
         TYPE_STR, uri,
         NULL);
@@ -1355,13 +1793,26 @@ request_decision (const gchar *uri, gpointer data)
 
         UzblRequestDecision *decision = (UzblRequestDecision *)data;
 
-        uzbl_commands_args_append (args, g_strdup (decision->frame));
-        uzbl_commands_args_append (args, g_strdup (decision->redirect ? "true" : "false"));
+        gchar *key = g_strdup_printf ("%s\n%d", decision->frame, decision->redirect);
+        gchar *cached = uzbl_decision_cache_lookup (handler, key, uri);
+        GString *res;
 
-        GString *res = g_string_new ("");
+        if (cached) {
+            res = g_string_new (cached);
+            g_free (cached);
+            uzbl_commands_args_free (args);
+        } else {
+            uzbl_commands_args_append (args, g_strdup (decision->frame));
+            uzbl_commands_args_append (args, g_strdup (decision->redirect ? "true" : "false"));
 
-        uzbl_commands_run_parsed (request_command, args, res);
-        uzbl_commands_args_free (args);
+            res = g_string_new ("");
+
+            uzbl_commands_run_parsed (request_command, args, res);
+            uzbl_commands_args_free (args);
+
+            uzbl_decision_cache_store (handler, key, uri, res);
+        }
+        g_free (key);
 
         rewrite_request (res, (gpointer)decision->request);
         g_string_free (res, TRUE);
@@ -1406,6 +1857,10 @@ send_load_status (WebKitLoadStatus status, const gchar *uri)
             TYPE_STR, uri ? uri : "",
             NULL);
     }
+
+    if (event == LOAD_COMMIT) {
+        uzbl_site_settings_apply (uri);
+    }
 }
 
 gboolean
@@ -1439,11 +1894,20 @@ mime_decision (WebKitWebPolicyDecision *decision, const gchar *mime_type, const
     GArray *args = uzbl_commands_args_new ();
     const UzblCommand *mime_command = uzbl_commands_parse (handler, args);
 
+    gchar *key = NULL;
+
     if (mime_command) {
+        key = g_strdup_printf ("%s\n%s", mime_type, disposition ? disposition : "");
+    }
+
+    if (mime_command && cached_policy (decision, handler, key, NULL)) {
+        g_free (key);
+        uzbl_commands_args_free (args);
+    } else if (mime_command) {
         uzbl_commands_args_append (args, g_strdup (mime_type));
         uzbl_commands_args_append (args, g_strdup (disposition ? disposition : ""));
-        g_object_ref (decision);
-        uzbl_io_schedule_command (mime_command, args, decide_navigation, decision);
+        uzbl_io_schedule_command (mime_command, args, decide_navigation,
+            policy_decision_new (decision, handler, key, NULL));
     } else {
         gboolean can_show = webkit_web_view_can_show_mime_type (uzbl.gui.web_view, mime_type);
 
@@ -1493,30 +1957,6 @@ dom_blur_cb (WebKitDOMEventTarget *target, WebKitDOMEvent *event, gpointer data)
 }
 #endif
 
-static gboolean
-decide_destination_cb (WebKitDownload *download, const gchar *suggested_filename, gpointer data);
-static void
-download_finished_cb (WebKitDownload *download, gpointer data);
-static void
-download_size_cb (WebKitDownload *download, GParamSpec *param_spec, gpointer data);
-static void
-download_status_cb (WebKitDownload *download, GParamSpec *param_spec, gpointer data);
-static gboolean
-download_error_cb (WebKitDownload *download, gint error_code, gint error_detail, gchar *reason, gpointer data);
-
-void
-handle_download (WebKitDownload *download, const gchar *suggested_destination)
-{
-    g_object_connect (G_OBJECT (download),
-        "signal::notify::current-size", G_CALLBACK (download_size_cb),      NULL,
-        "signal::notify::status",       G_CALLBACK (download_status_cb),    NULL,
-        "signal::error",                G_CALLBACK (download_error_cb),     NULL,
-        NULL);
-
-    const gchar *download_suggestion = webkit_download_get_suggested_filename (download);
-    decide_destination_cb (download, download_suggestion, (gpointer)suggested_destination);
-}
-
 #define permission_requests(call)                                                    \
     call (WEBKIT_IS_GEOLOCATION_POLICY_DECISION, WEBKIT_GEOLOCATION_POLICY_DECISION, \
         webkit_geolocation_policy_allow, webkit_geolocation_policy_deny)
@@ -1702,163 +2142,75 @@ button_to_modifier (guint buttonval)
 }
 
 void
-decide_navigation (GString *result, gpointer data)
+apply_policy (WebKitWebPolicyDecision *decision, const gchar *result)
 {
-    WebKitWebPolicyDecision *decision = (WebKitWebPolicyDecision *)data;
-
-    if (!g_strcmp0 (result->str, "IGNORE") ||
-        !g_strcmp0 (result->str, "USED")) { /* XXX: Deprecated */
+    if (!g_strcmp0 (result, "IGNORE") ||
+        !g_strcmp0 (result, "USED")) { /* XXX: Deprecated */
         make_policy (decision, ignore);
-    } else if (!g_strcmp0 (result->str, "DOWNLOAD")) {
+    } else if (!g_strcmp0 (result, "DOWNLOAD")) {
         make_policy (decision, download);
-    } else if (!g_strcmp0 (result->str, "USE")) {
+    } else if (!g_strcmp0 (result, "USE")) {
         make_policy (decision, use);
     } else {
         make_policy (decision, use);
     }
-
-    g_object_unref (decision);
-}
-
-void
-rewrite_request (GString *result, gpointer data)
-{
-    WebKitNetworkRequest *request = (WebKitNetworkRequest *)data;
-
-    if (result->len > 0) {
-        uzbl_debug ("Request rewritten -> %s\n", result->str);
-
-        webkit_network_request_set_uri (request, result->str);
-    }
-
-    g_object_unref (request);
 }
 
-static void
-download_destination (GString *result, gpointer data);
-
 gboolean
-decide_destination_cb (WebKitDownload *download, const gchar *suggested_filename, gpointer data)
+cached_policy (WebKitWebPolicyDecision *decision, const gchar *handler, const gchar *key, const gchar *uri)
 {
-    /* Get the URI being downloaded. */
-    const gchar *uri = webkit_download_get_uri (download);
-    const gchar *user_destination = (const gchar *)data;
-
-    uzbl_debug ("Download requested -> %s\n", uri);
+    gchar *cached = uzbl_decision_cache_lookup (handler, key, uri);
 
-    gchar *handler = uzbl_variables_get_string ("download_handler");
-
-    GArray *args = uzbl_commands_args_new ();
-    const UzblCommand *download_command = uzbl_commands_parse (handler, args);
-    g_free (handler);
-    if (!download_command) {
-        webkit_download_cancel (download);
-        uzbl_commands_args_free (args);
+    if (!cached) {
         return FALSE;
     }
 
-    /* Get the mimetype of the download. */
-    const gchar *content_type = NULL;
-    guint64 total_size = 0;
-    WebKitNetworkResponse *response = webkit_download_get_network_response (download);
-    /* Downloads can be initiated from the context menu, in that case there is
-     * no network response yet and trying to get one would crash. */
-    if (WEBKIT_IS_NETWORK_RESPONSE (response)) {
-        SoupMessage        *message = webkit_network_response_get_message (response);
-        SoupMessageHeaders *headers = NULL;
-        g_object_get (G_OBJECT (message),
-            "response-headers", &headers,
-            NULL);
-        /* Some versions of libsoup don't have "response-headers" here. */
-        if (headers) {
-            content_type = soup_message_headers_get_one (headers, "Content-Type");
-        }
-    }
-
-    /* Get the filesize of the download, as given by the server. It may be
-     * inaccurate, but there's nothing we can do about that. */
-    total_size = webkit_download_get_total_size (download);
+    apply_policy (decision, cached);
+    g_free (cached);
 
-    if (!content_type) {
-        content_type = "application/octet-stream";
-    }
-
-    uzbl_commands_args_append (args, g_strdup (uri));
-    uzbl_commands_args_append (args, g_strdup (suggested_filename));
-    uzbl_commands_args_append (args, g_strdup (content_type));
-    gchar *total_size_s = g_strdup_printf ("%" G_GUINT64_FORMAT, total_size);
-    uzbl_commands_args_append (args, total_size_s);
-    uzbl_commands_args_append (args, g_strdup (user_destination ? user_destination : ""));
-
-    GString *result = g_string_new ("");
-    uzbl_commands_run_parsed (download_command, args, result);
-    download_destination (result, download);
-    g_string_free (result, TRUE);
-
-    return FALSE;
+    return TRUE;
 }
 
-void
-download_finished_cb (WebKitDownload *download, gpointer data)
+UzblPolicyDecision *
+policy_decision_new (WebKitWebPolicyDecision *decision, const gchar *handler, gchar *key, const gchar *uri)
 {
-    UZBL_UNUSED (data);
+    UzblPolicyDecision *policy = g_malloc (sizeof (UzblPolicyDecision));
 
-    const gchar *dest_uri = webkit_download_get_destination_uri (download);
-    const gchar *dest_path = dest_uri + strlen ("file://");
+    policy->decision = g_object_ref (decision);
+    policy->handler = g_strdup (handler);
+    policy->key = key;
+    policy->uri = g_strdup (uri);
 
-    uzbl_events_send (DOWNLOAD_COMPLETE, NULL,
-        TYPE_STR, dest_path,
-        NULL);
+    return policy;
 }
 
-static void
-download_update (WebKitDownload *download);
-static void
-send_download_error (const gchar *destination, WebKitDownloadError err, const gchar *message);
-
 void
-download_size_cb (WebKitDownload *download, GParamSpec *param_spec, gpointer data)
+decide_navigation (GString *result, gpointer data)
 {
-    UZBL_UNUSED (param_spec);
-    UZBL_UNUSED (data);
+    UzblPolicyDecision *policy = (UzblPolicyDecision *)data;
 
-    download_update (download);
+    uzbl_decision_cache_store (policy->handler, policy->key, policy->uri, result);
+    apply_policy (policy->decision, result->str);
+
+    g_object_unref (policy->decision);
+    g_free (policy->handler);
+    g_free (policy->key);
+    g_free (policy->uri);
+    g_free (policy);
 }
 
 void
-download_status_cb (WebKitDownload *download, GParamSpec *param_spec, gpointer data)
+rewrite_request (GString *result, gpointer data)
 {
-    UZBL_UNUSED (param_spec);
+    WebKitNetworkRequest *request = (WebKitNetworkRequest *)data;
 
-    WebKitDownloadStatus status = webkit_download_get_status (download);
+    if (result->len > 0) {
+        uzbl_debug ("Request rewritten -> %s\n", result->str);
 
-    switch (status) {
-    case WEBKIT_DOWNLOAD_STATUS_CREATED:
-    case WEBKIT_DOWNLOAD_STATUS_STARTED:
-    case WEBKIT_DOWNLOAD_STATUS_CANCELLED:
-    case WEBKIT_DOWNLOAD_STATUS_ERROR:
-        /* Handled elsewhere. */
-        break;
-    case WEBKIT_DOWNLOAD_STATUS_FINISHED:
-        download_finished_cb (download, data);
-        break;
-    default:
-        uzbl_debug ("Unknown download status: %d\n", status);
-        break;
+        webkit_network_request_set_uri (request, result->str);
     }
-}
-
-gboolean
-download_error_cb (WebKitDownload *download, gint error_code, gint error_detail, gchar *reason, gpointer data)
-{
-    UZBL_UNUSED (error_code);
-    UZBL_UNUSED (data);
-
-    const gchar *destination = webkit_download_get_destination_uri (download);
-
-    send_download_error (destination, error_detail, reason);
 
-    return TRUE;
+    g_object_unref (request);
 }
 
 void
@@ -1935,90 +2287,3 @@ run_menu_command (GtkMenuItem *menu_item, gpointer data)
         uzbl_commands_run (item->cmd, NULL);
     }
 }
-
-void
-download_destination (GString *result, gpointer data)
-{
-    WebKitDownload *download = (WebKitDownload *)data;
-
-    /* No response, cancel the download. */
-    if (!result->len) {
-        webkit_download_cancel (download);
-        return;
-    }
-
-    gboolean is_file_uri = g_str_has_prefix (result->str, "file:///");
-
-    gchar *destination_uri;
-    /* Convert relative path to absolute path. */
-    if (!is_file_uri) {
-        if (*result->str == '/') {
-            destination_uri = g_strconcat ("file://", result->str, NULL);
-        } else {
-            gchar *cwd = g_get_current_dir ();
-            destination_uri = g_strconcat ("file://", cwd, "/", result->str, NULL);
-            g_free (cwd);
-        }
-    } else {
-        destination_uri = g_strdup (result->str);
-    }
-
-
-    int len = strlen (destination_uri);
-    if (destination_uri[len - 1] == '\n') {
-        destination_uri[len - 1] = '\0';
-    }
-
-    uzbl_events_send (DOWNLOAD_STARTED, NULL,
-        TYPE_STR, destination_uri + strlen ("file://"),
-        NULL);
-
-    webkit_download_set_destination_uri (download, destination_uri);
-    g_free (destination_uri);
-}
-
-void
-download_update (WebKitDownload *download)
-{
-    gdouble progress;
-    const gchar *property = "progress";
-    g_object_get (download,
-        property, &progress,
-        NULL);
-
-    const gchar *dest_uri = webkit_download_get_destination_uri (download);
-    const gchar *dest_path = dest_uri + strlen ("file://");
-
-    uzbl_events_send (DOWNLOAD_PROGRESS, NULL,
-        TYPE_STR, dest_path,
-        TYPE_DOUBLE, progress,
-        NULL);
-}
-
-void
-send_download_error (const gchar *destination, WebKitDownloadError err, const gchar *message)
-{
-    const gchar *str;
-
-    switch (err) {
-    case WEBKIT_DOWNLOAD_ERROR_CANCELLED_BY_USER:
-        str = "cancelled";
-        break;
-    case WEBKIT_DOWNLOAD_ERROR_DESTINATION:
-        str = "destination";
-        break;
-    case WEBKIT_DOWNLOAD_ERROR_NETWORK:
-        str = "network";
-        break;
-    default:
-        str = "unknown";
-        break;
-    }
-
-    uzbl_events_send (DOWNLOAD_ERROR, NULL,
-        TYPE_STR, destination ? destination : "",
-        TYPE_STR, str,
-        TYPE_INT, err,
-        TYPE_STR, message,
-        NULL);
-}
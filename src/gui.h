@@ -6,7 +6,23 @@
 void
 uzbl_gui_update_title ();
 
-void /* TODO: This should not be public. */
-handle_download (WebKitDownload *download, const gchar *suggested_destination);
+void
+uzbl_gui_bind_add (const gchar *mode, const gchar *keystroke, const gchar *command);
+void
+uzbl_gui_bind_remove (const gchar *mode, const gchar *keystroke);
+void
+uzbl_gui_bind_clear ();
+void
+uzbl_gui_bind_sync ();
+
+void
+uzbl_gui_keycmd_splice (glong pos, glong count, glong cursor, const gchar *text);
+void
+uzbl_gui_keycmd_clear ();
+
+/* Stop sending SCROLL_VERT and SCROLL_HORIZ while uzbl moves the view by
+ * itself. Calls must be balanced. */
+void
+uzbl_gui_scroll_events_block (gboolean block);
 
 #endif
@@ -372,6 +372,13 @@ run_command (gpointer item, gpointer data)
 
     UzblCommandData *cmd = (UzblCommandData *)item;
 
+    /* Handlers which spawn a child get their result when it exits. */
+    if (cmd->callback && cmd->info &&
+        uzbl_commands_run_async (cmd->info, cmd->argv, cmd->callback, cmd->data)) {
+        free_cmd_req (cmd);
+        return;
+    }
+
     GString *result = NULL;
 
     if (cmd->callback) {
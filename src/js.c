@@ -1,14 +1,30 @@
 #include "js.h"
 #include "uzbl-core.h"
 
+#include <glib/gstdio.h>
+
 #include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    time_t       mtime;
+    goffset      size;
+    JSStringRef  source;
+    /* Only kept for files with argument slots. */
+    gchar       *text;
+} UzblJsScript;
 
 /* =========================== PUBLIC API =========================== */
 
+static void
+script_free (gpointer data);
+
 void
 uzbl_js_init ()
 {
     uzbl.state.jscontext = JSGlobalContextCreate (NULL);
+    uzbl.state.js_scripts = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, script_free);
 
     JSObjectRef global = JSContextGetGlobalObject (uzbl.state.jscontext);
     JSObjectRef uzbl_obj = JSObjectMake (uzbl.state.jscontext, NULL, NULL);
@@ -70,3 +86,111 @@ uzbl_js_extract_string (JSStringRef str)
 
     return gstr;
 }
+
+gboolean
+uzbl_js_string_to_ascii (JSStringRef str, gchar *buf, gsize size)
+{
+    size_t len = JSStringGetLength (str);
+
+    if (len >= size) {
+        return FALSE;
+    }
+
+    const JSChar *chars = JSStringGetCharactersPtr (str);
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        if (chars[i] >= 0x80) {
+            return FALSE;
+        }
+
+        buf[i] = (gchar)chars[i];
+    }
+
+    buf[len] = '\0';
+
+    return TRUE;
+}
+
+static gboolean
+has_argument_slots (const gchar *text);
+
+JSStringRef
+uzbl_js_script_file (const gchar *path, const gchar **text)
+{
+    GStatBuf st;
+
+    if (g_stat (path, &st)) {
+        g_hash_table_remove (uzbl.state.js_scripts, path);
+        return NULL;
+    }
+
+    UzblJsScript *script = g_hash_table_lookup (uzbl.state.js_scripts, path);
+
+    if (!script || (script->mtime != st.st_mtime) || (script->size != st.st_size)) {
+        gchar *contents = NULL;
+
+        if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+            g_hash_table_remove (uzbl.state.js_scripts, path);
+            return NULL;
+        }
+
+        uzbl_debug ("External JavaScript file loaded: %s\n", path);
+
+        script = g_malloc0 (sizeof (UzblJsScript));
+        script->mtime = st.st_mtime;
+        script->size = st.st_size;
+        script->source = JSStringCreateWithUTF8CString (contents);
+
+        if (has_argument_slots (contents)) {
+            script->text = contents;
+        } else {
+            g_free (contents);
+        }
+
+        g_hash_table_replace (uzbl.state.js_scripts, g_strdup (path), script);
+    }
+
+    if (text) {
+        *text = script->text;
+    }
+
+    return JSStringRetain (script->source);
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+void
+script_free (gpointer data)
+{
+    UzblJsScript *script = (UzblJsScript *)data;
+
+    JSStringRelease (script->source);
+    g_free (script->text);
+    g_free (script);
+}
+
+gboolean
+has_argument_slots (const gchar *text)
+{
+    const gchar *p = text;
+
+    /* Only %4 and above are argument slots; anything else (such as i%2) is
+     * plain JavaScript. */
+    while ((p = strchr (p, '%'))) {
+        ++p;
+
+        if (g_ascii_isdigit (*p)) {
+            gchar *end = NULL;
+            guint64 slot = g_ascii_strtoull (p, &end, 10);
+
+            if (3 < slot) {
+                return TRUE;
+            }
+
+            p = end;
+        }
+    }
+
+    return FALSE;
+}
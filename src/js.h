@@ -15,5 +15,16 @@ gchar *
 uzbl_js_to_string (JSContextRef ctx, JSValueRef obj);
 gchar *
 uzbl_js_extract_string (JSStringRef str);
+/* Copy str into buf without allocating if it is ASCII and shorter than size.
+ * Returns FALSE (leaving buf unspecified) otherwise. */
+gboolean
+uzbl_js_string_to_ascii (JSStringRef str, gchar *buf, gsize size);
+
+/* Return the source of the JavaScript file at path, which is only read again
+ * when its modification time or size changes. The result must be released.
+ * If the source contains %N argument slots, text is set to it (owned by the
+ * cache), otherwise to NULL. */
+JSStringRef
+uzbl_js_script_file (const gchar *path, const gchar **text);
 
 #endif
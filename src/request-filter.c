@@ -0,0 +1,651 @@
+#include "request-filter.h"
+
+#include "events.h"
+#include "setup.h"
+#include "type.h"
+#include "util.h"
+#include "uzbl-core.h"
+
+#include <string.h>
+
+/* Filter lists use a subset of the Adblock syntax, one rule per line:
+ *
+ *   ||example.com^          requests to the host and its subdomains
+ *   banner.gif              URIs containing the text
+ *   |http://ads.            URIs starting with the text
+ *   /ad[0-9]+\.png/         URIs matching the regular expression
+ *   *, ^, | (at the end)    any text, a separator, the end of the URI
+ *   @@<rule>                lets matching requests through
+ *   <rule> => <uri>         rewrites matching requests; <rule> must start
+ *                           with | or be a regular expression (which may
+ *                           use \1 and so on in <uri>)
+ *
+ * Comments (!), headers ([...]), element hiding rules (##) and rules with
+ * options ($...) are skipped. Matching ignores case. */
+
+enum {
+    FILTER_BLOCK     = 1 << 0,
+    FILTER_EXCEPTION = 1 << 1
+};
+
+/* An Aho-Corasick automaton over the text rules. Children are kept in
+ * sibling lists, except for the root which has a table. */
+typedef struct {
+    guint32 fail;
+    guint32 child;
+    guint32 sibling;
+    guint8  flags;
+    guchar  c;
+} UzblFilterNode;
+
+typedef struct {
+    GRegex *regex;
+    guint   flags;
+} UzblFilterRegex;
+
+typedef struct {
+    GRegex   *regex;
+    gchar    *replacement;
+    gboolean  literal;
+} UzblFilterRewrite;
+
+struct _UzblRequestFilter {
+    guint       rules;
+
+    /* Host rules by host name. */
+    GHashTable *hosts;
+    /* Text rules. */
+    GArray     *nodes;
+    guint32     root[256];
+    gboolean    compiled;
+    /* Everything else. */
+    GPtrArray  *regexes;
+    GPtrArray  *rewrites;
+
+    guint64     blocked;
+    guint64     rewritten;
+    guint64     allowed;
+    guint       stats_timeout;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+static void
+filter_regex_free (gpointer data);
+static void
+filter_rewrite_free (gpointer data);
+static void
+reset_nodes ();
+static void
+parse_rule (gchar *rule);
+static void
+compile_nodes ();
+static guint
+match_hosts (const gchar *uri);
+static guint
+match_text (const gchar *uri);
+static void
+count_request (guint64 *counter);
+
+void
+uzbl_request_filter_init ()
+{
+    uzbl.request_filter = g_malloc0 (sizeof (UzblRequestFilter));
+
+    uzbl.request_filter->hosts = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, NULL);
+    uzbl.request_filter->nodes = g_array_new (FALSE, FALSE, sizeof (UzblFilterNode));
+    uzbl.request_filter->regexes = g_ptr_array_new_with_free_func (filter_regex_free);
+    uzbl.request_filter->rewrites = g_ptr_array_new_with_free_func (filter_rewrite_free);
+
+    reset_nodes ();
+}
+
+void
+uzbl_request_filter_free ()
+{
+    UzblRequestFilter *filter = uzbl.request_filter;
+
+    if (filter->stats_timeout) {
+        g_source_remove (filter->stats_timeout);
+    }
+
+    g_hash_table_destroy (filter->hosts);
+    g_array_free (filter->nodes, TRUE);
+    g_ptr_array_free (filter->regexes, TRUE);
+    g_ptr_array_free (filter->rewrites, TRUE);
+
+    g_free (filter);
+    uzbl.request_filter = NULL;
+}
+
+gboolean
+uzbl_request_filter_add (const gchar *path)
+{
+    GError *err = NULL;
+    gchar *contents = NULL;
+
+    if (!g_file_get_contents (path, &contents, NULL, &err)) {
+        uzbl_debug ("Failed to read filter list %s: %s\n", path, err->message);
+        g_error_free (err);
+        return FALSE;
+    }
+
+    gchar **lines = g_strsplit (contents, "\n", -1);
+    gchar **line;
+
+    for (line = lines; *line; ++line) {
+        parse_rule (g_strstrip (*line));
+    }
+
+    g_strfreev (lines);
+    g_free (contents);
+
+    compile_nodes ();
+
+    return TRUE;
+}
+
+void
+uzbl_request_filter_clear ()
+{
+    UzblRequestFilter *filter = uzbl.request_filter;
+
+    filter->rules = 0;
+    g_hash_table_remove_all (filter->hosts);
+    g_ptr_array_set_size (filter->regexes, 0);
+    g_ptr_array_set_size (filter->rewrites, 0);
+    reset_nodes ();
+}
+
+gboolean
+uzbl_request_filter_decide (const gchar *uri, GString *result)
+{
+    UzblRequestFilter *filter = uzbl.request_filter;
+
+    if (!filter->rules || !uri) {
+        return FALSE;
+    }
+
+    guint flags = match_hosts (uri) | match_text (uri);
+    guint i;
+
+    for (i = 0; (i < filter->regexes->len) && !(flags & FILTER_EXCEPTION); ++i) {
+        UzblFilterRegex *rule = g_ptr_array_index (filter->regexes, i);
+
+        if (!(flags & rule->flags) && g_regex_match (rule->regex, uri, 0, NULL)) {
+            flags |= rule->flags;
+        }
+    }
+
+    if (flags & FILTER_EXCEPTION) {
+        count_request (&filter->allowed);
+        return TRUE;
+    }
+
+    if (flags & FILTER_BLOCK) {
+        g_string_assign (result, "about:blank");
+        count_request (&filter->blocked);
+        return TRUE;
+    }
+
+    for (i = 0; i < filter->rewrites->len; ++i) {
+        UzblFilterRewrite *rule = g_ptr_array_index (filter->rewrites, i);
+        gchar *rewritten = NULL;
+
+        if (!g_regex_match (rule->regex, uri, 0, NULL)) {
+            continue;
+        }
+
+        if (rule->literal) {
+            rewritten = g_regex_replace_literal (rule->regex, uri, -1, 0,
+                rule->replacement, 0, NULL);
+        } else {
+            rewritten = g_regex_replace (rule->regex, uri, -1, 0,
+                rule->replacement, 0, NULL);
+        }
+
+        if (rewritten) {
+            g_string_assign (result, rewritten);
+            g_free (rewritten);
+            count_request (&filter->rewritten);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+void
+uzbl_request_filter_stats (GString *result)
+{
+    UzblRequestFilter *filter = uzbl.request_filter;
+
+    g_string_append_printf (result, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+        filter->blocked, filter->rewritten, filter->allowed);
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+void
+filter_regex_free (gpointer data)
+{
+    UzblFilterRegex *rule = (UzblFilterRegex *)data;
+
+    g_regex_unref (rule->regex);
+    g_free (rule);
+}
+
+void
+filter_rewrite_free (gpointer data)
+{
+    UzblFilterRewrite *rule = (UzblFilterRewrite *)data;
+
+    g_regex_unref (rule->regex);
+    g_free (rule->replacement);
+    g_free (rule);
+}
+
+void
+reset_nodes ()
+{
+    UzblRequestFilter *filter = uzbl.request_filter;
+    UzblFilterNode root = { 0, 0, 0, 0, 0 };
+
+    g_array_set_size (filter->nodes, 0);
+    g_array_append_val (filter->nodes, root);
+    memset (filter->root, 0, sizeof (filter->root));
+    filter->compiled = TRUE;
+}
+
+#define NODE(index) (&g_array_index (filter->nodes, UzblFilterNode, (index)))
+
+static guint32
+find_child (guint32 node, guchar c)
+{
+    UzblRequestFilter *filter = uzbl.request_filter;
+
+    if (!node) {
+        return filter->root[c];
+    }
+
+    guint32 child = NODE (node)->child;
+    while (child && (NODE (child)->c != c)) {
+        child = NODE (child)->sibling;
+    }
+
+    return child;
+}
+
+static void
+add_text (const gchar *text, guint flags)
+{
+    UzblRequestFilter *filter = uzbl.request_filter;
+    guint32 node = 0;
+
+    for (; *text; ++text) {
+        guchar c = g_ascii_tolower (*text);
+        guint32 child = find_child (node, c);
+
+        if (!child) {
+            UzblFilterNode new_node = { 0, 0, 0, 0, c };
+
+            child = filter->nodes->len;
+            if (node) {
+                new_node.sibling = NODE (node)->child;
+                g_array_append_val (filter->nodes, new_node);
+                NODE (node)->child = child;
+            } else {
+                g_array_append_val (filter->nodes, new_node);
+                filter->root[c] = child;
+            }
+        }
+
+        node = child;
+    }
+
+    NODE (node)->flags |= flags;
+    filter->compiled = FALSE;
+}
+
+void
+compile_nodes ()
+{
+    UzblRequestFilter *filter = uzbl.request_filter;
+
+    if (filter->compiled) {
+        return;
+    }
+
+    /* Breadth first, so fail links point to finished nodes. */
+    guint32 *queue = g_new (guint32, filter->nodes->len);
+    guint head = 0;
+    guint tail = 0;
+    guint c;
+
+    for (c = 0; c < G_N_ELEMENTS (filter->root); ++c) {
+        if (filter->root[c]) {
+            NODE (filter->root[c])->fail = 0;
+            queue[tail++] = filter->root[c];
+        }
+    }
+
+    while (head < tail) {
+        guint32 node = queue[head++];
+        guint32 child;
+
+        for (child = NODE (node)->child; child; child = NODE (child)->sibling) {
+            guchar cc = NODE (child)->c;
+            guint32 fail = NODE (node)->fail;
+            guint32 target = find_child (fail, cc);
+
+            while (!target && fail) {
+                fail = NODE (fail)->fail;
+                target = find_child (fail, cc);
+            }
+
+            NODE (child)->fail = target;
+            /* A match here is also a match of every suffix rule. */
+            NODE (child)->flags |= NODE (target)->flags;
+
+            queue[tail++] = child;
+        }
+    }
+
+    g_free (queue);
+    filter->compiled = TRUE;
+}
+
+guint
+match_text (const gchar *uri)
+{
+    UzblRequestFilter *filter = uzbl.request_filter;
+    guint32 node = 0;
+    guint flags = 0;
+
+    if (filter->nodes->len < 2) {
+        return 0;
+    }
+
+    for (; *uri && !(flags & FILTER_EXCEPTION); ++uri) {
+        guchar c = g_ascii_tolower (*uri);
+        guint32 next = find_child (node, c);
+
+        while (!next && node) {
+            node = NODE (node)->fail;
+            next = find_child (node, c);
+        }
+
+        node = next;
+        flags |= NODE (node)->flags;
+    }
+
+    return flags;
+}
+
+#undef NODE
+
+guint
+match_hosts (const gchar *uri)
+{
+    UzblRequestFilter *filter = uzbl.request_filter;
+
+    if (!g_hash_table_size (filter->hosts)) {
+        return 0;
+    }
+
+    const gchar *start = strstr (uri, "://");
+    if (!start) {
+        return 0;
+    }
+    start += 3;
+
+    gsize len = strcspn (start, "/?#");
+    const gchar *at = memchr (start, '@', len);
+    if (at) {
+        len -= (at + 1) - start;
+        start = at + 1;
+    }
+
+    gchar *host = g_ascii_strdown (start, len);
+    gchar *port = strchr (host, ':');
+    if (port) {
+        *port = '\0';
+    }
+
+    /* Look up the host and then each parent domain. */
+    guint flags = 0;
+    const gchar *suffix = host;
+    while (suffix) {
+        flags |= GPOINTER_TO_UINT (g_hash_table_lookup (filter->hosts, suffix));
+
+        suffix = strchr (suffix, '.');
+        if (suffix) {
+            ++suffix;
+        }
+    }
+
+    g_free (host);
+
+    return flags;
+}
+
+static GRegex *
+compile_rule_regex (const gchar *pattern)
+{
+    GError *err = NULL;
+    GRegex *regex = g_regex_new (pattern, G_REGEX_CASELESS | G_REGEX_OPTIMIZE, 0, &err);
+
+    if (!regex) {
+        uzbl_debug ("Invalid filter rule %s: %s\n", pattern, err->message);
+        g_error_free (err);
+    }
+
+    return regex;
+}
+
+/* Turn a rule using the *, ^ and | wildcards into a regular expression. */
+static gchar *
+wildcards_to_regex (const gchar *rule)
+{
+    GString *regex = g_string_new ("");
+    gsize len = strlen (rule);
+    gsize i = 0;
+
+    if (g_str_has_prefix (rule, "||")) {
+        g_string_append (regex, "^[a-z][a-z0-9+.-]*://([^/?#]*\\.)?");
+        i = 2;
+    } else if (g_str_has_prefix (rule, "|")) {
+        g_string_append_c (regex, '^');
+        i = 1;
+    }
+
+    gboolean anchored_end = (len > i) && (rule[len - 1] == '|');
+    if (anchored_end) {
+        --len;
+    }
+
+    for (; i < len; ++i) {
+        switch (rule[i]) {
+        case '*':
+            g_string_append (regex, ".*");
+            break;
+        case '^':
+            g_string_append (regex, "([^a-z0-9_.%-]|$)");
+            break;
+        default: {
+            gchar *escaped = g_regex_escape_string (rule + i, 1);
+            g_string_append (regex, escaped);
+            g_free (escaped);
+            break;
+        }
+        }
+    }
+
+    if (anchored_end) {
+        g_string_append_c (regex, '$');
+    }
+
+    return g_string_free (regex, FALSE);
+}
+
+static void
+add_regex (const gchar *pattern, guint flags)
+{
+    GRegex *regex = compile_rule_regex (pattern);
+
+    if (regex) {
+        UzblFilterRegex *rule = g_malloc (sizeof (UzblFilterRegex));
+        rule->regex = regex;
+        rule->flags = flags;
+        g_ptr_array_add (uzbl.request_filter->regexes, rule);
+    }
+}
+
+static void
+add_rewrite (const gchar *pattern, const gchar *replacement)
+{
+    gboolean literal = (*pattern == '|');
+    gchar *regex_str = NULL;
+    gsize len = strlen (pattern);
+
+    if (literal) {
+        regex_str = wildcards_to_regex (pattern);
+    } else if ((len > 2) && (*pattern == '/') && (pattern[len - 1] == '/')) {
+        regex_str = g_strndup (pattern + 1, len - 2);
+    } else {
+        uzbl_debug ("Rewrite rules must start with | or be a regular expression: %s\n", pattern);
+        return;
+    }
+
+    GRegex *regex = compile_rule_regex (regex_str);
+    g_free (regex_str);
+
+    if (regex) {
+        UzblFilterRewrite *rule = g_malloc (sizeof (UzblFilterRewrite));
+        rule->regex = regex;
+        rule->replacement = g_strdup (replacement);
+        rule->literal = literal;
+        g_ptr_array_add (uzbl.request_filter->rewrites, rule);
+    }
+}
+
+void
+parse_rule (gchar *rule)
+{
+    UzblRequestFilter *filter = uzbl.request_filter;
+    static const gchar *host_chars =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.-";
+    guint flags = FILTER_BLOCK;
+    gsize len;
+
+    if (!*rule || (*rule == '!') || (*rule == '[') ||
+        strstr (rule, "##") || strstr (rule, "#@#")) {
+        return;
+    }
+
+    gchar *arrow = strstr (rule, " => ");
+    if (arrow) {
+        *arrow = '\0';
+        add_rewrite (g_strstrip (rule), g_strstrip (arrow + 4));
+        ++filter->rules;
+        return;
+    }
+
+    if (g_str_has_prefix (rule, "@@")) {
+        flags = FILTER_EXCEPTION;
+        rule += 2;
+    }
+
+    len = strlen (rule);
+    if ((len > 2) && (*rule == '/') && (rule[len - 1] == '/')) {
+        rule[len - 1] = '\0';
+        add_regex (rule + 1, flags);
+        ++filter->rules;
+        return;
+    }
+
+    if (strchr (rule, '$')) {
+        /* Options are not supported; ignoring them would block too much. */
+        return;
+    }
+
+    if (g_str_has_prefix (rule, "||")) {
+        gchar *host = g_strdup (rule + 2);
+        gsize host_len = strlen (host);
+
+        if (host_len && (host[host_len - 1] == '^')) {
+            host[--host_len] = '\0';
+        }
+
+        if (host_len && !host[strspn (host, host_chars)]) {
+            gchar *lower = g_ascii_strdown (host, -1);
+            guint old = GPOINTER_TO_UINT (g_hash_table_lookup (filter->hosts, lower));
+
+            g_hash_table_insert (filter->hosts, lower, GUINT_TO_POINTER (old | flags));
+            g_free (host);
+            ++filter->rules;
+            return;
+        }
+
+        g_free (host);
+    }
+
+    /* Leading and trailing wildcards do not change what text matches. */
+    while (*rule == '*') {
+        ++rule;
+    }
+    len = strlen (rule);
+    while (len && (rule[len - 1] == '*')) {
+        rule[--len] = '\0';
+    }
+
+    if (!*rule) {
+        return;
+    }
+
+    if (!strpbrk (rule, "*^|")) {
+        add_text (rule, flags);
+    } else {
+        gchar *regex = wildcards_to_regex (rule);
+        add_regex (regex, flags);
+        g_free (regex);
+    }
+
+    ++filter->rules;
+}
+
+static gboolean
+send_stats (gpointer data);
+
+void
+count_request (guint64 *counter)
+{
+    UzblRequestFilter *filter = uzbl.request_filter;
+
+    ++*counter;
+
+    /* Rather than an event for each request, send the totals at most once a
+     * second. */
+    if (!filter->stats_timeout) {
+        filter->stats_timeout = g_timeout_add_seconds (1, send_stats, NULL);
+    }
+}
+
+gboolean
+send_stats (gpointer data)
+{
+    UZBL_UNUSED (data);
+
+    UzblRequestFilter *filter = uzbl.request_filter;
+
+    filter->stats_timeout = 0;
+
+    uzbl_events_send (REQUEST_FILTERED, NULL,
+        TYPE_ULL, (unsigned long long)filter->blocked,
+        TYPE_ULL, (unsigned long long)filter->rewritten,
+        TYPE_ULL, (unsigned long long)filter->allowed,
+        NULL);
+
+    return FALSE;
+}
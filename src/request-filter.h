@@ -0,0 +1,23 @@
+#ifndef UZBL_REQUEST_FILTER_H
+#define UZBL_REQUEST_FILTER_H
+
+#include <glib.h>
+
+/* Add the block, exception and rewrite rules of the filter list at path. */
+gboolean
+uzbl_request_filter_add (const gchar *path);
+/* Remove all rules. */
+void
+uzbl_request_filter_clear ();
+
+/* Decide a request from the rules. Returns FALSE if no rule matched uri,
+ * otherwise result is set like a request_handler result: empty to let the
+ * request through, about:blank to block it or the rewritten URI. */
+gboolean
+uzbl_request_filter_decide (const gchar *uri, GString *result);
+
+/* Append the number of blocked, rewritten and allowed requests to result. */
+void
+uzbl_request_filter_stats (GString *result);
+
+#endif
@@ -3,10 +3,35 @@
 #include "commands.h"
 #include "util.h"
 
+#include <gio/gunixinputstream.h>
 #include <libsoup/soup-uri.h>
 
+#include <signal.h>
+#include <stdlib.h>
 #include <string.h>
 
+/* Handler output starts with the content type, optionally followed by header
+ * lines declaring how long the response may be cached:
+ *
+ *   text/html
+ *   Cache-Control: max-age=3600
+ *   ETag: "v12"
+ *   <body>
+ *
+ * Once a cached response with an ETag expires, the handler is run with the
+ * ETag as an extra argument and may output "304" as the content type to keep
+ * using the cached body. Should the body have been evicted meanwhile, the
+ * handler is run once more without the ETag. */
+typedef struct {
+    gchar  *uri;
+    gchar  *scheme;
+    gchar  *content_type;
+    gchar  *etag;
+    GBytes *body;
+    gint64  expires;
+    GList   link;
+} UzblSchemeCacheEntry;
+
 /* =========================== PUBLIC API =========================== */
 
 static void
@@ -27,6 +52,55 @@ uzbl_scheme_request_add_handler (const gchar *scheme, const gchar *command)
         scheme_dup, g_strdup (command));
     g_array_append_val (uzbl_scheme_request_class->schemes, scheme_dup);
     request_class->schemes = (const char **)uzbl_scheme_request_class->schemes->data;
+
+    /* Responses of the old handler are stale. */
+    uzbl_scheme_request_clear_cache (scheme);
+}
+
+static void
+cache_remove (UzblSchemeRequestClass *cls, UzblSchemeCacheEntry *entry);
+static void
+cache_evict (UzblSchemeRequestClass *cls);
+
+void
+uzbl_scheme_request_set_cache_size (gsize size)
+{
+    UzblSchemeRequestClass *cls = g_type_class_ref (UZBL_TYPE_SCHEME_REQUEST);
+
+    cls->cache_budget = size;
+    cache_evict (cls);
+
+    g_type_class_unref (cls);
+}
+
+void
+uzbl_scheme_request_clear_cache (const gchar *scheme)
+{
+    UzblSchemeRequestClass *cls = g_type_class_ref (UZBL_TYPE_SCHEME_REQUEST);
+    GList *link = cls->cache_lru.head;
+
+    while (link) {
+        UzblSchemeCacheEntry *entry = (UzblSchemeCacheEntry *)link->data;
+        link = link->next;
+
+        if (!scheme || !g_strcmp0 (entry->scheme, scheme)) {
+            cache_remove (cls, entry);
+        }
+    }
+
+    g_type_class_unref (cls);
+}
+
+void
+uzbl_scheme_request_cache_stats (GString *result)
+{
+    UzblSchemeRequestClass *cls = g_type_class_ref (UZBL_TYPE_SCHEME_REQUEST);
+
+    g_string_append_printf (result, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %u %" G_GSIZE_FORMAT,
+        cls->cache_hits, cls->cache_misses, cls->cache_evictions,
+        g_queue_get_length (&cls->cache_lru), cls->cache_bytes);
+
+    g_type_class_unref (cls);
 }
 
 /* ===================== HELPER IMPLEMENTATIONS ===================== */
@@ -38,6 +112,10 @@ static gboolean
 uzbl_scheme_request_check_uri (SoupRequest *request, SoupURI *uri, GError **error);
 static GInputStream *
 uzbl_scheme_request_send (SoupRequest *request, GCancellable *cancellable, GError **error);
+static void
+uzbl_scheme_request_send_async (SoupRequest *request, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer data);
+static GInputStream *
+uzbl_scheme_request_send_finish (SoupRequest *request, GAsyncResult *result, GError **error);
 static goffset
 uzbl_scheme_request_get_content_length (SoupRequest *request);
 static const char *
@@ -47,6 +125,14 @@ struct _UzblSchemeRequestPrivate
 {
     gssize content_length;
     gchar *content_type;
+    /* The handler writing to the stream, if any. */
+    GPid   pid;
+
+    /* Cache headers of the response. */
+    gint64 max_age;
+    gchar *etag;
+    /* The ETag of the stale cached response, if any. */
+    gchar *revalidate;
 };
 
 void
@@ -55,8 +141,15 @@ uzbl_scheme_request_init (UzblSchemeRequest *request)
     request->priv = G_TYPE_INSTANCE_GET_PRIVATE (request, UZBL_TYPE_SCHEME_REQUEST, UzblSchemeRequestPrivate);
     request->priv->content_length = 0;
     request->priv->content_type = NULL;
+    request->priv->pid = 0;
+    request->priv->max_age = -1;
+    request->priv->etag = NULL;
+    request->priv->revalidate = NULL;
 }
 
+static void
+cache_entry_free (gpointer data);
+
 void
 uzbl_scheme_request_class_init (UzblSchemeRequestClass *uzbl_scheme_request_class)
 {
@@ -66,11 +159,22 @@ uzbl_scheme_request_class_init (UzblSchemeRequestClass *uzbl_scheme_request_clas
     uzbl_scheme_request_class->schemes = g_array_new (TRUE, TRUE, sizeof (gchar *));
     uzbl_scheme_request_class->handlers = g_hash_table_new (g_str_hash, g_str_equal);
 
+    uzbl_scheme_request_class->cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+        NULL, cache_entry_free);
+    g_queue_init (&uzbl_scheme_request_class->cache_lru);
+    uzbl_scheme_request_class->cache_bytes = 0;
+    uzbl_scheme_request_class->cache_budget = 0;
+    uzbl_scheme_request_class->cache_hits = 0;
+    uzbl_scheme_request_class->cache_misses = 0;
+    uzbl_scheme_request_class->cache_evictions = 0;
+
     gobject_class->finalize = uzbl_scheme_request_finalize;
 
     scheme_request_class->schemes = (const char **)uzbl_scheme_request_class->schemes->data;
     scheme_request_class->check_uri = uzbl_scheme_request_check_uri;
     scheme_request_class->send = uzbl_scheme_request_send;
+    scheme_request_class->send_async = uzbl_scheme_request_send_async;
+    scheme_request_class->send_finish = uzbl_scheme_request_send_finish;
     scheme_request_class->get_content_length = uzbl_scheme_request_get_content_length;
     scheme_request_class->get_content_type = uzbl_scheme_request_get_content_type;
 
@@ -80,6 +184,12 @@ uzbl_scheme_request_class_init (UzblSchemeRequestClass *uzbl_scheme_request_clas
 void
 uzbl_scheme_request_finalize (GObject *obj)
 {
+    UzblSchemeRequest *uzbl_request = UZBL_SCHEME_REQUEST (obj);
+
+    g_free (uzbl_request->priv->content_type);
+    g_free (uzbl_request->priv->etag);
+    g_free (uzbl_request->priv->revalidate);
+
     G_OBJECT_CLASS (uzbl_scheme_request_parent_class)->finalize (obj);
 }
 
@@ -93,54 +203,653 @@ uzbl_scheme_request_check_uri (SoupRequest *request, SoupURI *uri, GError **erro
     return TRUE;
 }
 
+static GInputStream *
+cached_stream (UzblSchemeRequest *uzbl_request);
+static GInputStream *
+handler_stream (UzblSchemeRequest *uzbl_request, gboolean *streaming, GError **error);
+static gboolean
+scan_headers (UzblSchemeRequest *uzbl_request, GBufferedInputStream *stream, gboolean eof);
+static GInputStream *
+handler_response (UzblSchemeRequest *uzbl_request, GCancellable *cancellable, GError **error);
+
 GInputStream *
 uzbl_scheme_request_send (SoupRequest *request, GCancellable *cancellable, GError **error)
 {
-    UZBL_UNUSED (cancellable);
-    UZBL_UNUSED (error);
+    UzblSchemeRequest *uzbl_request = UZBL_SCHEME_REQUEST (request);
 
+    GInputStream *stream = cached_stream (uzbl_request);
+
+    if (stream) {
+        return stream;
+    }
+
+    return handler_response (uzbl_request, cancellable, error);
+}
+
+static void
+start_handler (GTask *task);
+
+void
+uzbl_scheme_request_send_async (SoupRequest *request, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer data)
+{
+    UzblSchemeRequest *uzbl_request = UZBL_SCHEME_REQUEST (request);
+    GTask *task = g_task_new (request, cancellable, callback, data);
+
+    GInputStream *stream = cached_stream (uzbl_request);
+
+    if (stream) {
+        g_task_return_pointer (task, stream, g_object_unref);
+        g_object_unref (task);
+        return;
+    }
+
+    start_handler (task);
+}
+
+GInputStream *
+uzbl_scheme_request_send_finish (SoupRequest *request, GAsyncResult *result, GError **error)
+{
+    UZBL_UNUSED (request);
+
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+goffset
+uzbl_scheme_request_get_content_length (SoupRequest *request)
+{
     UzblSchemeRequest *uzbl_request = UZBL_SCHEME_REQUEST (request);
+
+    return uzbl_request->priv->content_length;
+}
+
+const char *
+uzbl_scheme_request_get_content_type (SoupRequest *request)
+{
+    UzblSchemeRequest *uzbl_request = UZBL_SCHEME_REQUEST (request);
+
+    return uzbl_request->priv->content_type ? uzbl_request->priv->content_type : "text/html";
+}
+
+static gboolean
+not_modified (UzblSchemeRequest *uzbl_request);
+static gboolean
+lost_revalidation (UzblSchemeRequest *uzbl_request);
+static gboolean
+wants_cache (UzblSchemeRequest *uzbl_request);
+static GInputStream *
+finish_response (UzblSchemeRequest *uzbl_request, GBytes *body);
+static void
+stop_handler (UzblSchemeRequest *uzbl_request);
+
+GInputStream *
+handler_response (UzblSchemeRequest *uzbl_request, GCancellable *cancellable, GError **error)
+{
+    gboolean streaming = FALSE;
+
+    GInputStream *stream = handler_stream (uzbl_request, &streaming, error);
+
+    if (!streaming) {
+        return stream;
+    }
+
+    GBufferedInputStream *buffered = G_BUFFERED_INPUT_STREAM (stream);
+    GError *err = NULL;
+
+    uzbl_request->priv->content_type = g_data_input_stream_read_line (G_DATA_INPUT_STREAM (stream),
+        NULL, cancellable, &err);
+
+    gboolean eof = FALSE;
+    while (!err && !scan_headers (uzbl_request, buffered, eof)) {
+        eof = !g_buffered_input_stream_fill (buffered, -1, cancellable, &err);
+    }
+
+    if (err) {
+        stop_handler (uzbl_request);
+        g_object_unref (stream);
+        g_propagate_error (error, err);
+        return NULL;
+    }
+
+    if (not_modified (uzbl_request)) {
+        stop_handler (uzbl_request);
+        g_object_unref (stream);
+
+        if (lost_revalidation (uzbl_request)) {
+            return handler_response (uzbl_request, cancellable, error);
+        }
+
+        return finish_response (uzbl_request, NULL);
+    }
+
+    if (!wants_cache (uzbl_request)) {
+        return stream;
+    }
+
+    /* Cached responses are kept whole. */
+    GOutputStream *body = g_memory_output_stream_new_resizable ();
+
+    g_output_stream_splice (body, stream,
+        G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+        cancellable, &err);
+    g_object_unref (stream);
+
+    if (err) {
+        stop_handler (uzbl_request);
+        g_object_unref (body);
+        g_propagate_error (error, err);
+        return NULL;
+    }
+
+    GBytes *bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (body));
+    g_object_unref (body);
+
+    return finish_response (uzbl_request, bytes);
+}
+
+static void
+read_content_type (GObject *source, GAsyncResult *res, gpointer data);
+
+void
+start_handler (GTask *task)
+{
+    UzblSchemeRequest *uzbl_request = UZBL_SCHEME_REQUEST (g_task_get_source_object (task));
+    gboolean streaming = FALSE;
+    GError *err = NULL;
+
+    GInputStream *stream = handler_stream (uzbl_request, &streaming, &err);
+
+    if (streaming) {
+        /* Replaces the stream of a handler which is being run again. */
+        g_task_set_task_data (task, stream, g_object_unref);
+        g_data_input_stream_read_line_async (G_DATA_INPUT_STREAM (stream),
+            G_PRIORITY_DEFAULT, g_task_get_cancellable (task), read_content_type, task);
+        return;
+    }
+
+    if (stream) {
+        g_task_return_pointer (task, stream, g_object_unref);
+    } else {
+        g_task_return_error (task, err);
+    }
+
+    g_object_unref (task);
+}
+
+void
+cache_remove (UzblSchemeRequestClass *cls, UzblSchemeCacheEntry *entry)
+{
+    g_queue_unlink (&cls->cache_lru, &entry->link);
+    cls->cache_bytes -= g_bytes_get_size (entry->body);
+    g_hash_table_remove (cls->cache, entry->uri);
+}
+
+void
+cache_evict (UzblSchemeRequestClass *cls)
+{
+    while (cls->cache_bytes > cls->cache_budget) {
+        cache_remove (cls, (UzblSchemeCacheEntry *)g_queue_peek_tail (&cls->cache_lru));
+        ++cls->cache_evictions;
+    }
+}
+
+void
+cache_entry_free (gpointer data)
+{
+    UzblSchemeCacheEntry *entry = (UzblSchemeCacheEntry *)data;
+
+    g_free (entry->uri);
+    g_free (entry->scheme);
+    g_free (entry->content_type);
+    g_free (entry->etag);
+    g_bytes_unref (entry->body);
+    g_free (entry);
+}
+
+static gchar *
+request_uri (UzblSchemeRequest *uzbl_request);
+static GInputStream *
+entry_stream (UzblSchemeRequest *uzbl_request, UzblSchemeCacheEntry *entry);
+
+GInputStream *
+cached_stream (UzblSchemeRequest *uzbl_request)
+{
+    UzblSchemeRequestClass *cls = UZBL_SCHEME_REQUEST_GET_CLASS (uzbl_request);
+
+    if (!cls->cache_budget) {
+        return NULL;
+    }
+
+    gchar *uri = request_uri (uzbl_request);
+    UzblSchemeCacheEntry *entry = g_hash_table_lookup (cls->cache, uri);
+    g_free (uri);
+
+    if (entry && (g_get_monotonic_time () < entry->expires)) {
+        ++cls->cache_hits;
+
+        return entry_stream (uzbl_request, entry);
+    }
+
+    ++cls->cache_misses;
+
+    if (entry && entry->etag) {
+        uzbl_request->priv->revalidate = g_strdup (entry->etag);
+    } else if (entry) {
+        cache_remove (cls, entry);
+    }
+
+    return NULL;
+}
+
+static void
+reap_handler (GPid pid, gint status, gpointer data);
+static gboolean
+parse_header (UzblSchemeRequest *uzbl_request, const gchar *line, gsize len);
+
+GInputStream *
+handler_stream (UzblSchemeRequest *uzbl_request, gboolean *streaming, GError **error)
+{
+    SoupRequest *request = SOUP_REQUEST (uzbl_request);
     UzblSchemeRequestClass *cls = UZBL_SCHEME_REQUEST_GET_CLASS (uzbl_request);
 
     SoupURI *uri = soup_request_get_uri (request);
     const char *command = g_hash_table_lookup (cls->handlers, uri->scheme);
 
-    GString *result = g_string_new ("");
     GArray *args = uzbl_commands_args_new ();
     const UzblCommand *cmd = uzbl_commands_parse (command, args);
+    GArray *child_args = NULL;
 
     if (cmd) {
         uzbl_commands_args_append (args, soup_uri_to_string (uri, TRUE));
-        uzbl_commands_run_parsed (cmd, args, result);
+        if (uzbl_request->priv->revalidate) {
+            uzbl_commands_args_append (args, g_strdup (uzbl_request->priv->revalidate));
+        }
+        child_args = uzbl_commands_spawn_argv (cmd, args);
     }
 
+    /* Spawned handlers are read while they write the page. */
+    if (child_args) {
+        gint out;
+        gboolean spawned = g_spawn_async_with_pipes (NULL, (gchar **)child_args->data, NULL,
+            G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL,
+            &uzbl_request->priv->pid, NULL, &out, NULL, error);
+
+        uzbl_commands_args_free (child_args);
+        uzbl_commands_args_free (args);
+
+        if (!spawned) {
+            return NULL;
+        }
+
+        /* The request may be gone by the time the handler exits. */
+        gpointer *weak = g_new0 (gpointer, 1);
+        *weak = uzbl_request;
+        g_object_add_weak_pointer (G_OBJECT (uzbl_request), weak);
+
+        g_child_watch_add (uzbl_request->priv->pid, reap_handler, weak);
+
+        GInputStream *pipe = g_unix_input_stream_new (out, TRUE);
+        GInputStream *stream = G_INPUT_STREAM (g_data_input_stream_new (pipe));
+        g_object_unref (pipe);
+
+        uzbl_request->priv->content_length = -1;
+        *streaming = TRUE;
+
+        return stream;
+    }
+
+    GString *result = g_string_new ("");
+
+    uzbl_commands_run_parsed (cmd, args, result);
     uzbl_commands_args_free (args);
 
     gchar *end = strchr (result->str, '\n');
     size_t line_len = end ? (size_t)(end - result->str) : result->len;
 
-    uzbl_request->priv->content_length = result->len - line_len - 1;
     uzbl_request->priv->content_type = g_strndup (result->str, line_len);
-    GInputStream *stream = g_memory_input_stream_new_from_data (
-        g_strdup (end + 1),
-        uzbl_request->priv->content_length, g_free);
-    g_string_free (result, TRUE);
+
+    gsize offset = end ? line_len + 1 : line_len;
+    while ((end = strchr (result->str + offset, '\n')) &&
+           parse_header (uzbl_request, result->str + offset, end - (result->str + offset))) {
+        offset = end - result->str + 1;
+    }
+
+    if (lost_revalidation (uzbl_request)) {
+        g_string_free (result, TRUE);
+        return handler_stream (uzbl_request, streaming, error);
+    }
+
+    g_string_erase (result, 0, offset);
+
+    return finish_response (uzbl_request, g_string_free_to_bytes (result));
+}
+
+static gboolean
+could_be_header (const gchar *data, gsize len);
+
+gboolean
+scan_headers (UzblSchemeRequest *uzbl_request, GBufferedInputStream *stream, gboolean eof)
+{
+    for (;;) {
+        gsize avail;
+        const gchar *data = g_buffered_input_stream_peek_buffer (stream, &avail);
+        const gchar *end = memchr (data, '\n', avail);
+
+        if (!end) {
+            /* Wait for the rest of a line which may be a header. */
+            return eof || !could_be_header (data, avail) ||
+                (avail >= g_buffered_input_stream_get_buffer_size (stream));
+        }
+
+        if (!parse_header (uzbl_request, data, end - data)) {
+            return TRUE;
+        }
+
+        g_input_stream_skip (G_INPUT_STREAM (stream), end - data + 1, NULL, NULL);
+    }
+}
+
+gboolean
+not_modified (UzblSchemeRequest *uzbl_request)
+{
+    return uzbl_request->priv->revalidate &&
+        !g_strcmp0 (uzbl_request->priv->content_type, "304");
+}
+
+gboolean
+lost_revalidation (UzblSchemeRequest *uzbl_request)
+{
+    UzblSchemeRequestClass *cls = UZBL_SCHEME_REQUEST_GET_CLASS (uzbl_request);
+    UzblSchemeRequestPrivate *priv = uzbl_request->priv;
+
+    if (!not_modified (uzbl_request)) {
+        return FALSE;
+    }
+
+    gchar *uri = request_uri (uzbl_request);
+    gboolean cached = g_hash_table_contains (cls->cache, uri);
+    g_free (uri);
+
+    if (cached) {
+        return FALSE;
+    }
+
+    /* The cached response was dropped while the handler ran, so there is
+     * nothing to keep using. Forget the 304 and ask for the full response
+     * instead. */
+    g_free (priv->revalidate);
+    priv->revalidate = NULL;
+    g_free (priv->content_type);
+    priv->content_type = NULL;
+    g_free (priv->etag);
+    priv->etag = NULL;
+    priv->max_age = -1;
+    priv->content_length = 0;
+
+    return TRUE;
+}
+
+gboolean
+wants_cache (UzblSchemeRequest *uzbl_request)
+{
+    UzblSchemeRequestClass *cls = UZBL_SCHEME_REQUEST_GET_CLASS (uzbl_request);
+
+    return cls->cache_budget && (0 < uzbl_request->priv->max_age);
+}
+
+GInputStream *
+finish_response (UzblSchemeRequest *uzbl_request, GBytes *body)
+{
+    UzblSchemeRequestClass *cls = UZBL_SCHEME_REQUEST_GET_CLASS (uzbl_request);
+    UzblSchemeRequestPrivate *priv = uzbl_request->priv;
+    gchar *uri = request_uri (uzbl_request);
+    UzblSchemeCacheEntry *entry = g_hash_table_lookup (cls->cache, uri);
+
+    if (not_modified (uzbl_request) && entry) {
+        if (0 < priv->max_age) {
+            entry->expires = g_get_monotonic_time () + priv->max_age * G_USEC_PER_SEC;
+        }
+
+        if (body) {
+            g_bytes_unref (body);
+        }
+        g_free (uri);
+
+        return entry_stream (uzbl_request, entry);
+    }
+
+    if (!body) {
+        body = g_bytes_new (NULL, 0);
+    }
+
+    if (entry) {
+        cache_remove (cls, entry);
+    }
+
+    if (wants_cache (uzbl_request)) {
+        entry = g_malloc0 (sizeof (UzblSchemeCacheEntry));
+        entry->uri = uri;
+        entry->scheme = g_strdup (soup_request_get_uri (SOUP_REQUEST (uzbl_request))->scheme);
+        entry->content_type = g_strdup (priv->content_type);
+        entry->etag = g_strdup (priv->etag);
+        entry->body = g_bytes_ref (body);
+        entry->expires = g_get_monotonic_time () + priv->max_age * G_USEC_PER_SEC;
+        entry->link.data = entry;
+
+        g_hash_table_insert (cls->cache, entry->uri, entry);
+        g_queue_push_head_link (&cls->cache_lru, &entry->link);
+        cls->cache_bytes += g_bytes_get_size (body);
+
+        cache_evict (cls);
+    } else {
+        g_free (uri);
+    }
+
+    priv->content_length = g_bytes_get_size (body);
+    GInputStream *stream = g_memory_input_stream_new_from_bytes (body);
+    g_bytes_unref (body);
 
     return stream;
 }
 
-goffset
-uzbl_scheme_request_get_content_length (SoupRequest *request)
+void
+stop_handler (UzblSchemeRequest *uzbl_request)
 {
-    UzblSchemeRequest *uzbl_request = UZBL_SCHEME_REQUEST (request);
+    if (uzbl_request->priv->pid) {
+        kill (uzbl_request->priv->pid, SIGTERM);
+    }
+}
 
-    return uzbl_request->priv->content_length;
+static void
+read_headers (GTask *task, gboolean eof);
+static void
+fail_task (GTask *task, GError *err);
+
+void
+read_content_type (GObject *source, GAsyncResult *res, gpointer data)
+{
+    GTask *task = G_TASK (data);
+    UzblSchemeRequest *uzbl_request = UZBL_SCHEME_REQUEST (g_task_get_source_object (task));
+    GError *err = NULL;
+
+    uzbl_request->priv->content_type = g_data_input_stream_read_line_finish (G_DATA_INPUT_STREAM (source),
+        res, NULL, &err);
+
+    if (err) {
+        fail_task (task, err);
+        return;
+    }
+
+    read_headers (task, FALSE);
 }
 
-const char *
-uzbl_scheme_request_get_content_type (SoupRequest *request)
+static void
+headers_filled (GObject *source, GAsyncResult *res, gpointer data);
+static void
+body_read (GObject *source, GAsyncResult *res, gpointer data);
+
+void
+read_headers (GTask *task, gboolean eof)
 {
-    UzblSchemeRequest *uzbl_request = UZBL_SCHEME_REQUEST (request);
+    UzblSchemeRequest *uzbl_request = UZBL_SCHEME_REQUEST (g_task_get_source_object (task));
+    GInputStream *stream = G_INPUT_STREAM (g_task_get_task_data (task));
+    GCancellable *cancellable = g_task_get_cancellable (task);
+
+    if (!scan_headers (uzbl_request, G_BUFFERED_INPUT_STREAM (stream), eof)) {
+        g_buffered_input_stream_fill_async (G_BUFFERED_INPUT_STREAM (stream), -1,
+            G_PRIORITY_DEFAULT, cancellable, headers_filled, task);
+        return;
+    }
 
-    return uzbl_request->priv->content_type ? uzbl_request->priv->content_type : "text/html";
+    if (not_modified (uzbl_request)) {
+        stop_handler (uzbl_request);
+
+        if (lost_revalidation (uzbl_request)) {
+            start_handler (task);
+            return;
+        }
+
+        g_task_return_pointer (task, finish_response (uzbl_request, NULL), g_object_unref);
+        g_object_unref (task);
+        return;
+    }
+
+    if (!wants_cache (uzbl_request)) {
+        g_task_return_pointer (task, g_object_ref (stream), g_object_unref);
+        g_object_unref (task);
+        return;
+    }
+
+    /* Cached responses are kept whole. */
+    g_output_stream_splice_async (g_memory_output_stream_new_resizable (), stream,
+        G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+        G_PRIORITY_DEFAULT, cancellable, body_read, task);
+}
+
+void
+fail_task (GTask *task, GError *err)
+{
+    UzblSchemeRequest *uzbl_request = UZBL_SCHEME_REQUEST (g_task_get_source_object (task));
+
+    stop_handler (uzbl_request);
+    g_task_return_error (task, err);
+    g_object_unref (task);
+}
+
+gchar *
+request_uri (UzblSchemeRequest *uzbl_request)
+{
+    return soup_uri_to_string (soup_request_get_uri (SOUP_REQUEST (uzbl_request)), FALSE);
+}
+
+GInputStream *
+entry_stream (UzblSchemeRequest *uzbl_request, UzblSchemeCacheEntry *entry)
+{
+    UzblSchemeRequestClass *cls = UZBL_SCHEME_REQUEST_GET_CLASS (uzbl_request);
+
+    g_queue_unlink (&cls->cache_lru, &entry->link);
+    g_queue_push_head_link (&cls->cache_lru, &entry->link);
+
+    g_free (uzbl_request->priv->content_type);
+    uzbl_request->priv->content_type = g_strdup (entry->content_type);
+    uzbl_request->priv->content_length = g_bytes_get_size (entry->body);
+
+    return g_memory_input_stream_new_from_bytes (entry->body);
+}
+
+void
+reap_handler (GPid pid, gint status, gpointer data)
+{
+    UZBL_UNUSED (status);
+
+    gpointer *weak = (gpointer *)data;
+    UzblSchemeRequest *uzbl_request = *weak;
+
+    /* Once reaped, the pid may be reused and must not be signalled. A
+     * handler which was run again has a newer pid which is kept. */
+    if (uzbl_request) {
+        if (uzbl_request->priv->pid == pid) {
+            uzbl_request->priv->pid = 0;
+        }
+
+        g_object_remove_weak_pointer (G_OBJECT (uzbl_request), weak);
+    }
+
+    g_free (weak);
+    g_spawn_close_pid (pid);
+}
+
+static const gchar *cache_control_header = "Cache-Control:";
+static const gchar *etag_header = "ETag:";
+
+gboolean
+parse_header (UzblSchemeRequest *uzbl_request, const gchar *line, gsize len)
+{
+    gsize cache_control_len = strlen (cache_control_header);
+    gsize etag_len = strlen (etag_header);
+
+    if ((cache_control_len <= len) && !g_ascii_strncasecmp (line, cache_control_header, cache_control_len)) {
+        gchar *value = g_strndup (line + cache_control_len, len - cache_control_len);
+        gchar *max_age = strstr (value, "max-age=");
+
+        if (max_age) {
+            uzbl_request->priv->max_age = strtoll (max_age + strlen ("max-age="), NULL, 10);
+        }
+
+        g_free (value);
+        return TRUE;
+    }
+
+    if ((etag_len <= len) && !g_ascii_strncasecmp (line, etag_header, etag_len)) {
+        g_free (uzbl_request->priv->etag);
+        uzbl_request->priv->etag = g_strstrip (g_strndup (line + etag_len, len - etag_len));
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+void
+headers_filled (GObject *source, GAsyncResult *res, gpointer data)
+{
+    GTask *task = G_TASK (data);
+    GError *err = NULL;
+
+    gssize filled = g_buffered_input_stream_fill_finish (G_BUFFERED_INPUT_STREAM (source), res, &err);
+
+    if (err) {
+        fail_task (task, err);
+        return;
+    }
+
+    read_headers (task, !filled);
+}
+
+void
+body_read (GObject *source, GAsyncResult *res, gpointer data)
+{
+    GTask *task = G_TASK (data);
+    UzblSchemeRequest *uzbl_request = UZBL_SCHEME_REQUEST (g_task_get_source_object (task));
+    GOutputStream *body = G_OUTPUT_STREAM (source);
+    GError *err = NULL;
+
+    g_output_stream_splice_finish (body, res, &err);
+
+    if (err) {
+        g_object_unref (body);
+        fail_task (task, err);
+        return;
+    }
+
+    GBytes *bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (body));
+    g_object_unref (body);
+
+    g_task_return_pointer (task, finish_response (uzbl_request, bytes), g_object_unref);
+    g_object_unref (task);
+}
+
+gboolean
+could_be_header (const gchar *data, gsize len)
+{
+    return !g_ascii_strncasecmp (data, cache_control_header, MIN (len, strlen (cache_control_header))) ||
+        !g_ascii_strncasecmp (data, etag_header, MIN (len, strlen (etag_header)));
 }
@@ -32,6 +32,15 @@ typedef struct {
     SoupRequestClass parent;
     GArray *schemes;
     GHashTable *handlers;
+
+    /* Cached responses by URI, most recently used first. */
+    GHashTable *cache;
+    GQueue cache_lru;
+    gsize cache_bytes;
+    gsize cache_budget;
+    guint64 cache_hits;
+    guint64 cache_misses;
+    guint64 cache_evictions;
 } UzblSchemeRequestClass;
 
 GType
@@ -40,4 +49,11 @@ uzbl_scheme_request_get_type ();
 void
 uzbl_scheme_request_add_handler (const gchar *scheme, const gchar *command);
 
+void
+uzbl_scheme_request_set_cache_size (gsize size);
+void
+uzbl_scheme_request_clear_cache (const gchar *scheme);
+void
+uzbl_scheme_request_cache_stats (GString *result);
+
 #endif
@@ -18,3 +18,21 @@ uzbl_scheme_add_handler (const gchar *scheme, const gchar *command)
 {
     uzbl_scheme_request_add_handler (scheme, command);
 }
+
+void
+uzbl_scheme_set_cache_size (gsize size)
+{
+    uzbl_scheme_request_set_cache_size (size);
+}
+
+void
+uzbl_scheme_clear_cache (const gchar *scheme)
+{
+    uzbl_scheme_request_clear_cache (scheme);
+}
+
+void
+uzbl_scheme_cache_stats (GString *result)
+{
+    uzbl_scheme_request_cache_stats (result);
+}
@@ -6,4 +6,15 @@
 void
 uzbl_scheme_add_handler (const gchar *scheme, const gchar *command);
 
+/* Keep cacheable handler responses up to size bytes; 0 disables the cache. */
+void
+uzbl_scheme_set_cache_size (gsize size);
+/* Drop the cached responses of scheme, or of all schemes if it is NULL. */
+void
+uzbl_scheme_clear_cache (const gchar *scheme);
+/* Append the number of hits, misses, evictions, cached responses and cached
+ * bytes to result. */
+void
+uzbl_scheme_cache_stats (GString *result);
+
 #endif
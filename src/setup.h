@@ -9,6 +9,16 @@ uzbl_commands_free ();
 void
 uzbl_commands_send_builtin_event ();
 
+void
+uzbl_decision_cache_init ();
+void
+uzbl_decision_cache_free ();
+
+void
+uzbl_downloads_init ();
+void
+uzbl_downloads_free ();
+
 void
 uzbl_events_init ();
 void
@@ -41,6 +51,11 @@ uzbl_io_quit ();
 void
 uzbl_js_init ();
 
+void
+uzbl_request_filter_init ();
+void
+uzbl_request_filter_free ();
+
 void
 uzbl_requests_init ();
 void
@@ -52,6 +67,21 @@ uzbl_requests_set_reply (const gchar *reply);
 void
 uzbl_scheme_init ();
 
+void
+uzbl_site_settings_init ();
+void
+uzbl_site_settings_free ();
+
+void
+uzbl_snapshot_init ();
+void
+uzbl_snapshot_free ();
+
+void
+uzbl_spawn_pool_init ();
+void
+uzbl_spawn_pool_free ();
+
 void
 uzbl_variables_init ();
 void
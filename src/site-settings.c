@@ -0,0 +1,571 @@
+#include "site-settings.h"
+
+#include "commands.h"
+#include "setup.h"
+#include "util.h"
+#include "uzbl-core.h"
+
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+#include <string.h>
+
+/* The rules file has the format of the per-site-settings.py script:
+ *
+ *   <host>
+ *       <path>
+ *           <command>
+ *
+ * Hosts made only of host name characters match the host and its subdomains;
+ * others are regular expressions anchored at the start of the host. Paths
+ * without regular expression characters match paths starting with them.
+ * Repeated hosts or paths fall through to the next level, "@" ends the
+ * current host and "@@" ends the rules. */
+
+typedef struct {
+    gchar  *prefix;
+    GRegex *regex;
+} UzblSitePattern;
+
+typedef struct {
+    GPtrArray *patterns;
+    GPtrArray *commands;
+} UzblSitePaths;
+
+typedef struct {
+    GPtrArray *host_regexes;
+    GPtrArray *paths;
+} UzblSiteRule;
+
+/* Hosts are indexed by their labels, last label first. */
+typedef struct _UzblSiteNode UzblSiteNode;
+struct _UzblSiteNode {
+    GHashTable *children;
+    GArray     *rules;
+};
+
+struct _UzblSiteSettings {
+    gchar        *path;
+    gchar        *glob;
+    GFileMonitor *monitor;
+
+    GPtrArray    *rules;
+    UzblSiteNode *hosts;
+    /* Rules with at least one host regex. */
+    GArray       *regex_rules;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+static UzblSiteNode *
+site_node_new ();
+static void
+site_node_free (gpointer data);
+static void
+site_rule_free (gpointer data);
+static void
+clear_rules ();
+static gboolean
+read_rules ();
+static void
+rules_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file,
+        GFileMonitorEvent event, gpointer data);
+static void
+match_rules (const gchar *host, const gchar *path, GPtrArray *commands);
+
+void
+uzbl_site_settings_init ()
+{
+    uzbl.site_settings = g_malloc0 (sizeof (UzblSiteSettings));
+
+    uzbl.site_settings->rules = g_ptr_array_new_with_free_func (site_rule_free);
+    uzbl.site_settings->hosts = site_node_new ();
+    uzbl.site_settings->regex_rules = g_array_new (FALSE, FALSE, sizeof (guint));
+}
+
+void
+uzbl_site_settings_free ()
+{
+    uzbl_site_settings_load (NULL, NULL);
+
+    g_ptr_array_free (uzbl.site_settings->rules, TRUE);
+    site_node_free (uzbl.site_settings->hosts);
+    g_array_free (uzbl.site_settings->regex_rules, TRUE);
+
+    g_free (uzbl.site_settings);
+    uzbl.site_settings = NULL;
+}
+
+gboolean
+uzbl_site_settings_load (const gchar *path, const gchar *glob)
+{
+    UzblSiteSettings *settings = uzbl.site_settings;
+
+    if (settings->monitor) {
+        g_file_monitor_cancel (settings->monitor);
+        g_object_unref (settings->monitor);
+        settings->monitor = NULL;
+    }
+
+    g_free (settings->path);
+    g_free (settings->glob);
+    settings->path = NULL;
+    settings->glob = NULL;
+
+    clear_rules ();
+
+    if (!path || !*path) {
+        return TRUE;
+    }
+
+    settings->path = g_strdup (path);
+    settings->glob = g_strdup (glob ? glob : "*.pss");
+
+    /* Watch the path even if it does not exist (yet). */
+    GFile *file = g_file_new_for_path (path);
+    GError *err = NULL;
+
+    settings->monitor = g_file_monitor (file, G_FILE_MONITOR_NONE, NULL, &err);
+    if (settings->monitor) {
+        g_signal_connect (settings->monitor, "changed",
+            G_CALLBACK (rules_changed_cb), NULL);
+    } else {
+        uzbl_debug ("Failed to watch site settings %s: %s\n", path, err->message);
+        g_error_free (err);
+    }
+
+    g_object_unref (file);
+
+    return read_rules ();
+}
+
+void
+uzbl_site_settings_apply (const gchar *uri)
+{
+    if (!uri || !uzbl.site_settings->rules->len) {
+        return;
+    }
+
+    SoupURI *soup_uri = soup_uri_new (uri);
+    if (!soup_uri) {
+        return;
+    }
+
+    if (!soup_uri->host || !*soup_uri->host) {
+        soup_uri_free (soup_uri);
+        return;
+    }
+
+    GPtrArray *commands = g_ptr_array_new_with_free_func (g_free);
+    gchar *host = g_ascii_strdown (soup_uri->host, -1);
+
+    match_rules (host, soup_uri->path ? soup_uri->path : "", commands);
+
+    g_free (host);
+    soup_uri_free (soup_uri);
+
+    /* The rules are done with before running anything since commands may
+     * load other rules. */
+    guint i;
+    for (i = 0; i < commands->len; ++i) {
+        uzbl_commands_run (g_ptr_array_index (commands, i), NULL);
+    }
+
+    g_ptr_array_free (commands, TRUE);
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+UzblSiteNode *
+site_node_new ()
+{
+    return g_malloc0 (sizeof (UzblSiteNode));
+}
+
+void
+site_node_free (gpointer data)
+{
+    UzblSiteNode *node = (UzblSiteNode *)data;
+
+    if (node->children) {
+        g_hash_table_destroy (node->children);
+    }
+    if (node->rules) {
+        g_array_free (node->rules, TRUE);
+    }
+
+    g_free (node);
+}
+
+static void
+site_pattern_free (gpointer data)
+{
+    UzblSitePattern *pattern = (UzblSitePattern *)data;
+
+    g_free (pattern->prefix);
+    if (pattern->regex) {
+        g_regex_unref (pattern->regex);
+    }
+
+    g_free (pattern);
+}
+
+static void
+site_paths_free (gpointer data)
+{
+    UzblSitePaths *paths = (UzblSitePaths *)data;
+
+    g_ptr_array_free (paths->patterns, TRUE);
+    g_ptr_array_free (paths->commands, TRUE);
+
+    g_free (paths);
+}
+
+void
+site_rule_free (gpointer data)
+{
+    UzblSiteRule *rule = (UzblSiteRule *)data;
+
+    g_ptr_array_free (rule->host_regexes, TRUE);
+    g_ptr_array_free (rule->paths, TRUE);
+
+    g_free (rule);
+}
+
+void
+clear_rules ()
+{
+    UzblSiteSettings *settings = uzbl.site_settings;
+
+    g_ptr_array_set_size (settings->rules, 0);
+    g_array_set_size (settings->regex_rules, 0);
+
+    site_node_free (settings->hosts);
+    settings->hosts = site_node_new ();
+}
+
+static GRegex *
+compile_pattern (const gchar *pattern)
+{
+    GError *err = NULL;
+    GRegex *regex = g_regex_new (pattern, G_REGEX_ANCHORED | G_REGEX_OPTIMIZE, 0, &err);
+
+    if (!regex) {
+        uzbl_debug ("Invalid site settings pattern %s: %s\n", pattern, err->message);
+        g_error_free (err);
+    }
+
+    return regex;
+}
+
+static void
+add_host (guint index, UzblSiteRule *rule, const gchar *host)
+{
+    UzblSiteSettings *settings = uzbl.site_settings;
+    static const gchar *host_chars =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.-";
+
+    if (host[strspn (host, host_chars)]) {
+        GRegex *regex = compile_pattern (host);
+
+        if (regex) {
+            if (!rule->host_regexes->len) {
+                g_array_append_val (settings->regex_rules, index);
+            }
+            g_ptr_array_add (rule->host_regexes, regex);
+        }
+
+        return;
+    }
+
+    gchar *lower = g_ascii_strdown (host, -1);
+    gchar **labels = g_strsplit (lower, ".", -1);
+    guint n = g_strv_length (labels);
+    UzblSiteNode *node = settings->hosts;
+
+    while (n--) {
+        if (!*labels[n]) {
+            continue;
+        }
+
+        if (!node->children) {
+            node->children = g_hash_table_new_full (g_str_hash, g_str_equal,
+                g_free, site_node_free);
+        }
+
+        UzblSiteNode *child = g_hash_table_lookup (node->children, labels[n]);
+        if (!child) {
+            child = site_node_new ();
+            g_hash_table_insert (node->children, g_strdup (labels[n]), child);
+        }
+
+        node = child;
+    }
+
+    if (node != settings->hosts) {
+        if (!node->rules) {
+            node->rules = g_array_new (FALSE, FALSE, sizeof (guint));
+        }
+        g_array_append_val (node->rules, index);
+    }
+
+    g_strfreev (labels);
+    g_free (lower);
+}
+
+static void
+add_path (UzblSitePaths *paths, const gchar *path)
+{
+    UzblSitePattern *pattern = g_malloc0 (sizeof (UzblSitePattern));
+
+    if (strpbrk (path, "\\^$|?*+()[]{}")) {
+        pattern->regex = compile_pattern (path);
+    } else {
+        pattern->prefix = g_strdup (path);
+    }
+
+    g_ptr_array_add (paths->patterns, pattern);
+}
+
+static void
+parse_rules (gchar *contents)
+{
+    UzblSiteSettings *settings = uzbl.site_settings;
+    gchar **lines = g_strsplit (contents, "\n", -1);
+    gchar **line;
+
+    UzblSiteRule *rule = NULL;
+    UzblSitePaths *paths = NULL;
+    guint state = 0;
+    gsize cur_indent = 0;
+
+    for (line = lines; *line; ++line) {
+        gsize indent = strspn (*line, " \t");
+        gchar *raw = g_strstrip (*line);
+
+        if (!*raw) {
+            continue;
+        }
+
+        if (!strcmp (raw, "@@")) {
+            break;
+        }
+
+        if (!strcmp (raw, "@")) {
+            rule = NULL;
+            paths = NULL;
+            continue;
+        }
+
+        /* Like the script, a change in indentation moves one level. */
+        if (!indent) {
+            state = 0;
+        } else if (indent < cur_indent) {
+            state = state ? state - 1 : 0;
+        } else if (cur_indent < indent) {
+            ++state;
+        }
+        cur_indent = indent;
+
+        switch (state) {
+        case 0:
+            if (!rule || rule->paths->len) {
+                rule = g_malloc (sizeof (UzblSiteRule));
+                rule->host_regexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_regex_unref);
+                rule->paths = g_ptr_array_new_with_free_func (site_paths_free);
+                g_ptr_array_add (settings->rules, rule);
+            }
+            paths = NULL;
+
+            add_host (settings->rules->len - 1, rule, raw);
+            break;
+        case 1:
+            if (!rule) {
+                break;
+            }
+
+            if (!paths || paths->commands->len) {
+                paths = g_malloc (sizeof (UzblSitePaths));
+                paths->patterns = g_ptr_array_new_with_free_func (site_pattern_free);
+                paths->commands = g_ptr_array_new_with_free_func (g_free);
+                g_ptr_array_add (rule->paths, paths);
+            }
+
+            add_path (paths, raw);
+            break;
+        case 2:
+            if (paths) {
+                g_ptr_array_add (paths->commands, g_strdup (raw));
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    g_strfreev (lines);
+}
+
+static gint
+compare_names (gconstpointer a, gconstpointer b)
+{
+    return g_strcmp0 (*(const gchar **)a, *(const gchar **)b);
+}
+
+gboolean
+read_rules ()
+{
+    UzblSiteSettings *settings = uzbl.site_settings;
+    GError *err = NULL;
+    gchar *contents = NULL;
+
+    if (g_file_test (settings->path, G_FILE_TEST_IS_DIR)) {
+        GDir *dir = g_dir_open (settings->path, 0, &err);
+        if (!dir) {
+            uzbl_debug ("Failed to read site settings %s: %s\n", settings->path, err->message);
+            g_error_free (err);
+            return FALSE;
+        }
+
+        GPtrArray *names = g_ptr_array_new_with_free_func (g_free);
+        const gchar *name;
+        while ((name = g_dir_read_name (dir))) {
+            if (g_pattern_match_simple (settings->glob, name)) {
+                g_ptr_array_add (names, g_build_filename (settings->path, name, NULL));
+            }
+        }
+        g_dir_close (dir);
+
+        g_ptr_array_sort (names, compare_names);
+
+        GString *all = g_string_new ("");
+        guint i;
+        for (i = 0; i < names->len; ++i) {
+            gchar *part = NULL;
+            if (g_file_get_contents (g_ptr_array_index (names, i), &part, NULL, NULL)) {
+                g_string_append (all, part);
+                g_string_append_c (all, '\n');
+                g_free (part);
+            }
+        }
+        g_ptr_array_free (names, TRUE);
+
+        contents = g_string_free (all, FALSE);
+    } else if (!g_file_get_contents (settings->path, &contents, NULL, &err)) {
+        uzbl_debug ("Failed to read site settings %s: %s\n", settings->path, err->message);
+        g_error_free (err);
+        return FALSE;
+    }
+
+    parse_rules (contents);
+    g_free (contents);
+
+    return TRUE;
+}
+
+void
+rules_changed_cb (GFileMonitor *monitor, GFile *file, GFile *other_file,
+        GFileMonitorEvent event, gpointer data)
+{
+    UZBL_UNUSED (monitor);
+    UZBL_UNUSED (file);
+    UZBL_UNUSED (other_file);
+    UZBL_UNUSED (data);
+
+    switch (event) {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_DELETED:
+        clear_rules ();
+        read_rules ();
+        break;
+    default:
+        break;
+    }
+}
+
+static gboolean
+match_path (UzblSitePaths *paths, const gchar *path)
+{
+    guint i;
+
+    for (i = 0; i < paths->patterns->len; ++i) {
+        UzblSitePattern *pattern = g_ptr_array_index (paths->patterns, i);
+
+        if (pattern->prefix ? g_str_has_prefix (path, pattern->prefix)
+                            : g_regex_match (pattern->regex, path, 0, NULL)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static gint
+compare_rules (gconstpointer a, gconstpointer b)
+{
+    guint x = *(const guint *)a;
+    guint y = *(const guint *)b;
+
+    return (x > y) - (x < y);
+}
+
+void
+match_rules (const gchar *host, const gchar *path, GPtrArray *commands)
+{
+    UzblSiteSettings *settings = uzbl.site_settings;
+    GArray *matches = g_array_new (FALSE, FALSE, sizeof (guint));
+    guint i;
+    guint j;
+
+    /* Literal hosts: every node on the way down matches. */
+    gchar **labels = g_strsplit (host, ".", -1);
+    guint n = g_strv_length (labels);
+    UzblSiteNode *node = settings->hosts;
+
+    while (n-- && node) {
+        node = node->children ? g_hash_table_lookup (node->children, labels[n]) : NULL;
+        if (node && node->rules) {
+            g_array_append_vals (matches, node->rules->data, node->rules->len);
+        }
+    }
+
+    g_strfreev (labels);
+
+    for (i = 0; i < settings->regex_rules->len; ++i) {
+        guint index = g_array_index (settings->regex_rules, guint, i);
+        UzblSiteRule *rule = g_ptr_array_index (settings->rules, index);
+
+        for (j = 0; j < rule->host_regexes->len; ++j) {
+            if (g_regex_match (g_ptr_array_index (rule->host_regexes, j), host, 0, NULL)) {
+                g_array_append_val (matches, index);
+                break;
+            }
+        }
+    }
+
+    g_array_sort (matches, compare_rules);
+
+    for (i = 0; i < matches->len; ++i) {
+        guint index = g_array_index (matches, guint, i);
+
+        if (i && (index == g_array_index (matches, guint, i - 1))) {
+            continue;
+        }
+
+        UzblSiteRule *rule = g_ptr_array_index (settings->rules, index);
+
+        for (j = 0; j < rule->paths->len; ++j) {
+            UzblSitePaths *paths = g_ptr_array_index (rule->paths, j);
+
+            if (match_path (paths, path)) {
+                guint k;
+                for (k = 0; k < paths->commands->len; ++k) {
+                    g_ptr_array_add (commands, g_strdup (g_ptr_array_index (paths->commands, k)));
+                }
+            }
+        }
+    }
+
+    g_array_free (matches, TRUE);
+}
@@ -0,0 +1,17 @@
+#ifndef UZBL_SITE_SETTINGS_H
+#define UZBL_SITE_SETTINGS_H
+
+#include <glib.h>
+
+/* Load per-site settings rules from path, which is either a file or a
+ * directory whose files matching glob are read in sorted order. The rules are
+ * reloaded whenever path changes. A NULL path unloads the rules. */
+gboolean
+uzbl_site_settings_load (const gchar *path, const gchar *glob);
+
+/* Run the commands of the rules matching uri, in the order they appear in the
+ * rules. */
+void
+uzbl_site_settings_apply (const gchar *uri);
+
+#endif
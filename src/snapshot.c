@@ -0,0 +1,593 @@
+#include "snapshot.h"
+
+#ifdef HAVE_SNAPSHOT
+
+#include "events.h"
+#include "gui.h"
+#include "setup.h"
+#include "type.h"
+#include "util.h"
+#include "uzbl-core.h"
+#include "3p/async-queue-source/rb-async-queue-watch.h"
+
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <string.h>
+
+/* Rendering waits for the encoder once this many bands of a snapshot are
+ * queued, which bounds the memory used by a snapshot of any size. */
+#define SNAPSHOT_MAX_PENDING 2
+/* Milliseconds to wait for the encoder before rendering is tried again. */
+#define SNAPSHOT_RETRY_INTERVAL 10
+/* Size of the IDAT chunks of PNG files. */
+#define SNAPSHOT_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+    gchar              *path;
+    UzblSnapshotFormat  format;
+    GdkRectangle        region;
+
+    /* The top of the next band to render (main thread). */
+    gint                next_y;
+    /* Bands queued for the encoder. */
+    gint                pending;
+
+    /* Only used by the encoder until the job is reported. */
+    GOutputStream      *stream;
+    GConverter         *zlib;
+    guchar             *chunk;
+    gsize               chunk_len;
+    GError             *error;
+} UzblSnapshotJob;
+
+typedef struct {
+    /* NULL tells the encoder to quit. */
+    UzblSnapshotJob *job;
+    /* NULL once the whole region has been rendered. */
+    cairo_surface_t *surface;
+    /* Why rendering stopped early, if it did. */
+    const gchar     *failure;
+} UzblSnapshotBand;
+
+struct _UzblSnapshot {
+    /* Jobs waiting to be rendered; the first one is being rendered. */
+    GQueue       render;
+    guint        render_source;
+    /* The scroll position before rendering started. */
+    gdouble      saved_h;
+    gdouble      saved_v;
+
+    GThread     *encoder;
+    GAsyncQueue *bands;
+    /* Jobs the encoder is done with. */
+    GAsyncQueue *done;
+    guint        done_watch;
+    gint         quit;
+
+    /* Jobs which have not been reported yet. */
+    GList       *jobs;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+void
+uzbl_snapshot_init ()
+{
+    uzbl.snapshot = g_malloc0 (sizeof (UzblSnapshot));
+
+    g_queue_init (&uzbl.snapshot->render);
+}
+
+static void
+job_free (gpointer data);
+
+void
+uzbl_snapshot_free ()
+{
+    if (uzbl.snapshot->render_source) {
+        g_source_remove (uzbl.snapshot->render_source);
+    }
+    g_queue_clear (&uzbl.snapshot->render);
+
+    if (uzbl.snapshot->encoder) {
+        /* Drop the bands which have not been encoded yet. */
+        g_atomic_int_set (&uzbl.snapshot->quit, TRUE);
+        g_async_queue_push (uzbl.snapshot->bands, g_malloc0 (sizeof (UzblSnapshotBand)));
+        g_thread_join (uzbl.snapshot->encoder);
+
+        g_source_remove (uzbl.snapshot->done_watch);
+        g_async_queue_unref (uzbl.snapshot->bands);
+        g_async_queue_unref (uzbl.snapshot->done);
+    }
+
+    g_list_free_full (uzbl.snapshot->jobs, job_free);
+
+    g_free (uzbl.snapshot);
+    uzbl.snapshot = NULL;
+}
+
+static void
+start_encoder ();
+static void
+schedule_render (guint delay);
+
+void
+uzbl_snapshot_save (const gchar *path, UzblSnapshotFormat format, const GdkRectangle *region)
+{
+    UzblSnapshotJob *job = g_malloc0 (sizeof (UzblSnapshotJob));
+
+    job->path = g_strdup (path);
+    job->format = format;
+    job->region = *region;
+    job->next_y = region->y;
+
+    if (!uzbl.snapshot->encoder) {
+        start_encoder ();
+    }
+
+    uzbl.snapshot->jobs = g_list_prepend (uzbl.snapshot->jobs, job);
+    g_queue_push_tail (&uzbl.snapshot->render, job);
+
+    if (!uzbl.snapshot->render_source) {
+        uzbl.snapshot->saved_h = gtk_adjustment_get_value (uzbl.gui.bar_h);
+        uzbl.snapshot->saved_v = gtk_adjustment_get_value (uzbl.gui.bar_v);
+
+        schedule_render (0);
+    }
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+void
+job_free (gpointer data)
+{
+    UzblSnapshotJob *job = (UzblSnapshotJob *)data;
+
+    if (job->stream) {
+        g_output_stream_close (job->stream, NULL, NULL);
+        g_object_unref (job->stream);
+    }
+    if (job->zlib) {
+        g_object_unref (job->zlib);
+    }
+    if (job->error) {
+        g_error_free (job->error);
+    }
+
+    g_free (job->chunk);
+    g_free (job->path);
+    g_free (job);
+}
+
+static void
+init_crc_table ();
+static gpointer
+run_encoder (gpointer data);
+static void
+report_job (gpointer item, gpointer data);
+
+void
+start_encoder ()
+{
+    init_crc_table ();
+
+    uzbl.snapshot->bands = g_async_queue_new ();
+    uzbl.snapshot->done = g_async_queue_new ();
+
+    uzbl.snapshot->done_watch = uzbl_rb_async_queue_watch_new (uzbl.snapshot->done,
+        G_PRIORITY_DEFAULT, report_job,
+        NULL, NULL, NULL);
+
+    uzbl.snapshot->encoder = g_thread_new ("uzbl-snapshot", run_encoder, NULL);
+}
+
+static gboolean
+render_band (gpointer data);
+
+void
+schedule_render (guint delay)
+{
+    if (delay) {
+        uzbl.snapshot->render_source = g_timeout_add (delay, render_band, NULL);
+    } else {
+        uzbl.snapshot->render_source = g_idle_add (render_band, NULL);
+    }
+}
+
+static void
+push_band (UzblSnapshotJob *job, cairo_surface_t *surface, const gchar *failure);
+
+gboolean
+render_band (gpointer data)
+{
+    UZBL_UNUSED (data);
+
+    UzblSnapshotJob *job = (UzblSnapshotJob *)g_queue_peek_head (&uzbl.snapshot->render);
+
+    if (SNAPSHOT_MAX_PENDING <= g_atomic_int_get (&job->pending)) {
+        /* Let the encoder catch up. */
+        schedule_render (SNAPSHOT_RETRY_INTERVAL);
+        return FALSE;
+    }
+
+    GtkAdjustment *bar_h = uzbl.gui.bar_h;
+    GtkAdjustment *bar_v = uzbl.gui.bar_v;
+
+    /* Tiles are the size of the viewport and a band is a row of tiles. */
+    gint tile_width = MAX ((gint)gtk_adjustment_get_page_size (bar_h), 1);
+    gint tile_height = MAX ((gint)gtk_adjustment_get_page_size (bar_v), 1);
+    gint bottom = job->region.y + job->region.height;
+    gint height = MIN (tile_height, bottom - job->next_y);
+
+    cairo_surface_t *band = cairo_image_surface_create (CAIRO_FORMAT_RGB24, job->region.width, height);
+    const gchar *failure = NULL;
+
+    /* Scrolling to each tile is not the user's doing. */
+    uzbl_gui_scroll_events_block (TRUE);
+
+    if (cairo_surface_status (band) != CAIRO_STATUS_SUCCESS) {
+        failure = "Failed to allocate a band";
+    } else {
+        cairo_t *cr = cairo_create (band);
+
+        gint x;
+        for (x = 0; x < job->region.width; x += tile_width) {
+            gtk_adjustment_set_value (bar_h, job->region.x + x);
+            gtk_adjustment_set_value (bar_v, job->next_y);
+
+            cairo_surface_t *tile = webkit_web_view_get_snapshot (uzbl.gui.web_view);
+
+            if (!tile) {
+                failure = "Failed to render a tile";
+                break;
+            }
+
+            /* The view does not scroll past the end of the page, so tiles at
+             * the edges may start before the requested position. */
+            gdouble tile_x = gtk_adjustment_get_value (bar_h) - job->region.x;
+            gdouble tile_y = gtk_adjustment_get_value (bar_v) - job->next_y;
+
+            cairo_save (cr);
+            cairo_rectangle (cr, x, 0, tile_width, height);
+            cairo_clip (cr);
+            cairo_set_source_surface (cr, tile, tile_x, tile_y);
+            cairo_paint (cr);
+            cairo_restore (cr);
+
+            cairo_surface_destroy (tile);
+        }
+
+        cairo_destroy (cr);
+    }
+
+    if (failure) {
+        cairo_surface_destroy (band);
+    } else {
+        cairo_surface_flush (band);
+        push_band (job, band, NULL);
+        job->next_y += height;
+    }
+
+    if (failure || (bottom <= job->next_y)) {
+        push_band (job, NULL, failure);
+        g_queue_pop_head (&uzbl.snapshot->render);
+    }
+
+    gboolean done = g_queue_is_empty (&uzbl.snapshot->render);
+
+    if (done) {
+        gtk_adjustment_set_value (bar_h, uzbl.snapshot->saved_h);
+        gtk_adjustment_set_value (bar_v, uzbl.snapshot->saved_v);
+
+        uzbl.snapshot->render_source = 0;
+    }
+
+    uzbl_gui_scroll_events_block (FALSE);
+
+    return !done;
+}
+
+void
+push_band (UzblSnapshotJob *job, cairo_surface_t *surface, const gchar *failure)
+{
+    UzblSnapshotBand *band = g_malloc0 (sizeof (UzblSnapshotBand));
+
+    band->job = job;
+    band->surface = surface;
+    band->failure = failure;
+
+    if (surface) {
+        g_atomic_int_inc (&job->pending);
+    }
+
+    g_async_queue_push (uzbl.snapshot->bands, band);
+}
+
+static void
+encode_band (UzblSnapshotJob *job, cairo_surface_t *surface);
+static void
+finish_job (UzblSnapshotJob *job, const gchar *failure);
+
+gpointer
+run_encoder (gpointer data)
+{
+    UZBL_UNUSED (data);
+
+    while (TRUE) {
+        UzblSnapshotBand *band = (UzblSnapshotBand *)g_async_queue_pop (uzbl.snapshot->bands);
+        UzblSnapshotJob *job = band->job;
+
+        if (!job) {
+            g_free (band);
+            break;
+        }
+
+        if (band->surface) {
+            if (!job->error && !g_atomic_int_get (&uzbl.snapshot->quit)) {
+                encode_band (job, band->surface);
+            }
+
+            cairo_surface_destroy (band->surface);
+            g_atomic_int_add (&job->pending, -1);
+        } else if (!g_atomic_int_get (&uzbl.snapshot->quit)) {
+            finish_job (job, band->failure);
+            g_async_queue_push (uzbl.snapshot->done, job);
+        }
+
+        g_free (band);
+    }
+
+    return NULL;
+}
+
+void
+report_job (gpointer item, gpointer data)
+{
+    UZBL_UNUSED (data);
+
+    UzblSnapshotJob *job = (UzblSnapshotJob *)item;
+
+    if (job->error) {
+        uzbl_events_send (SNAPSHOT_ERROR, NULL,
+            TYPE_STR, job->path,
+            TYPE_STR, job->error->message,
+            NULL);
+    } else {
+        uzbl_events_send (SNAPSHOT_SAVED, NULL,
+            TYPE_STR, job->path,
+            TYPE_INT, job->region.width,
+            TYPE_INT, job->region.height,
+            NULL);
+    }
+
+    uzbl.snapshot->jobs = g_list_remove (uzbl.snapshot->jobs, job);
+    job_free (job);
+}
+
+/* PNG chunks carry the CRC-32 of their type and data. */
+static guint32 crc_table[256];
+
+void
+init_crc_table ()
+{
+    guint32 i;
+    for (i = 0; i < 256; ++i) {
+        guint32 c = i;
+
+        guint k;
+        for (k = 0; k < 8; ++k) {
+            c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+        }
+
+        crc_table[i] = c;
+    }
+}
+
+static gboolean
+open_stream (UzblSnapshotJob *job);
+static void
+write_data (UzblSnapshotJob *job, gconstpointer data, gsize size);
+static void
+deflate_data (UzblSnapshotJob *job, const guchar *data, gsize size, gboolean finish);
+
+void
+encode_band (UzblSnapshotJob *job, cairo_surface_t *surface)
+{
+    if (!job->stream && !open_stream (job)) {
+        return;
+    }
+
+    gboolean png = (job->format == UZBL_SNAPSHOT_PNG);
+    gint width = cairo_image_surface_get_width (surface);
+    gint height = cairo_image_surface_get_height (surface);
+    gint stride = cairo_image_surface_get_stride (surface);
+    const guchar *pixels = cairo_image_surface_get_data (surface);
+
+    /* PNG rows start with their filter type. */
+    gsize row_size = width * 3 + (png ? 1 : 0);
+    guchar *rows = g_malloc (row_size * height);
+
+    gint y;
+    for (y = 0; y < height; ++y) {
+        const guint32 *in = (const guint32 *)(pixels + y * stride);
+        guchar *row = rows + y * row_size;
+        guchar *out = row;
+
+        if (png) {
+            *out++ = 1; /* Sub: store the difference to the pixel to the left. */
+            ++row;
+        }
+
+        gint x;
+        for (x = 0; x < width; ++x) {
+            *out++ = (in[x] >> 16) & 0xff;
+            *out++ = (in[x] >> 8) & 0xff;
+            *out++ = in[x] & 0xff;
+        }
+
+        if (png) {
+            gsize i;
+            for (i = width * 3; 3 < i; --i) {
+                row[i - 1] -= row[i - 4];
+            }
+        }
+    }
+
+    if (png) {
+        deflate_data (job, rows, row_size * height, FALSE);
+    } else {
+        write_data (job, rows, row_size * height);
+    }
+
+    g_free (rows);
+}
+
+static void
+write_chunk (UzblSnapshotJob *job, const gchar *type, const guchar *data, gsize size);
+
+void
+finish_job (UzblSnapshotJob *job, const gchar *failure)
+{
+    if (failure && !job->error) {
+        g_set_error_literal (&job->error, G_IO_ERROR, G_IO_ERROR_FAILED, failure);
+    }
+
+    if (!job->stream) {
+        return;
+    }
+
+    if (!job->error && (job->format == UZBL_SNAPSHOT_PNG)) {
+        deflate_data (job, NULL, 0, TRUE);
+        write_chunk (job, "IEND", NULL, 0);
+    }
+
+    g_output_stream_close (job->stream, NULL, job->error ? NULL : &job->error);
+    g_object_unref (job->stream);
+    job->stream = NULL;
+
+    /* Do not leave a truncated image behind. */
+    if (job->error) {
+        g_unlink (job->path);
+    }
+}
+
+gboolean
+open_stream (UzblSnapshotJob *job)
+{
+    GFile *file = g_file_new_for_path (job->path);
+    job->stream = G_OUTPUT_STREAM (g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &job->error));
+    g_object_unref (file);
+
+    if (!job->stream) {
+        return FALSE;
+    }
+
+    switch (job->format) {
+    case UZBL_SNAPSHOT_PNG:
+    {
+        static const guchar signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        guchar ihdr[13];
+        guint32 width = GUINT32_TO_BE ((guint32)job->region.width);
+        guint32 height = GUINT32_TO_BE ((guint32)job->region.height);
+
+        memcpy (ihdr, &width, 4);
+        memcpy (ihdr + 4, &height, 4);
+        ihdr[8] = 8;  /* Bit depth. */
+        ihdr[9] = 2;  /* Truecolor. */
+        ihdr[10] = 0; /* Deflate. */
+        ihdr[11] = 0; /* Adaptive filtering. */
+        ihdr[12] = 0; /* No interlacing. */
+
+        write_data (job, signature, sizeof (signature));
+        write_chunk (job, "IHDR", ihdr, sizeof (ihdr));
+
+        job->zlib = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB, -1));
+        job->chunk = g_malloc (SNAPSHOT_CHUNK_SIZE);
+        break;
+    }
+    case UZBL_SNAPSHOT_PPM:
+    {
+        gchar *header = g_strdup_printf ("P6\n%d %d\n255\n", job->region.width, job->region.height);
+        write_data (job, header, strlen (header));
+        g_free (header);
+        break;
+    }
+    case UZBL_SNAPSHOT_RAW:
+        break;
+    }
+
+    return !job->error;
+}
+
+void
+write_data (UzblSnapshotJob *job, gconstpointer data, gsize size)
+{
+    if (job->error || !size) {
+        return;
+    }
+
+    g_output_stream_write_all (job->stream, data, size, NULL, NULL, &job->error);
+}
+
+static guint32
+update_crc (guint32 crc, const guchar *data, gsize size);
+
+void
+write_chunk (UzblSnapshotJob *job, const gchar *type, const guchar *data, gsize size)
+{
+    guchar header[8];
+    guint32 length = GUINT32_TO_BE ((guint32)size);
+
+    memcpy (header, &length, 4);
+    memcpy (header + 4, type, 4);
+
+    guint32 crc = update_crc (0xffffffff, header + 4, 4);
+    crc = GUINT32_TO_BE (update_crc (crc, data, size) ^ 0xffffffff);
+
+    write_data (job, header, sizeof (header));
+    write_data (job, data, size);
+    write_data (job, &crc, 4);
+}
+
+guint32
+update_crc (guint32 crc, const guchar *data, gsize size)
+{
+    gsize i;
+    for (i = 0; i < size; ++i) {
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+/* Compress data into IDAT chunks. With finish, the zlib stream is ended and
+ * the last chunk is written. */
+void
+deflate_data (UzblSnapshotJob *job, const guchar *data, gsize size, gboolean finish)
+{
+    GConverterFlags flags = finish ? G_CONVERTER_INPUT_AT_END : G_CONVERTER_NO_FLAGS;
+    GConverterResult res = G_CONVERTER_CONVERTED;
+
+    while (!job->error && (size || (finish && (res != G_CONVERTER_FINISHED)))) {
+        gsize read = 0;
+        gsize written = 0;
+
+        res = g_converter_convert (job->zlib,
+            data, size,
+            job->chunk + job->chunk_len, SNAPSHOT_CHUNK_SIZE - job->chunk_len,
+            flags, &read, &written, &job->error);
+
+        data += read;
+        size -= read;
+        job->chunk_len += written;
+
+        if ((job->chunk_len == SNAPSHOT_CHUNK_SIZE) ||
+            ((res == G_CONVERTER_FINISHED) && job->chunk_len)) {
+            write_chunk (job, "IDAT", job->chunk, job->chunk_len);
+            job->chunk_len = 0;
+        }
+    }
+}
+
+#endif
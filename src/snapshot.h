@@ -0,0 +1,28 @@
+#ifndef UZBL_SNAPSHOT_H
+#define UZBL_SNAPSHOT_H
+
+#include "webkit.h"
+
+#if WEBKIT_CHECK_VERSION (1, 11, 92)
+#define HAVE_SNAPSHOT
+#endif
+
+#ifdef HAVE_SNAPSHOT
+typedef enum {
+    UZBL_SNAPSHOT_PNG,
+    /* Binary PPM (P6). */
+    UZBL_SNAPSHOT_PPM,
+    /* Packed 8-bit RGB without any header. */
+    UZBL_SNAPSHOT_RAW
+} UzblSnapshotFormat;
+
+/* Save the given rectangle of the page (in document coordinates) to path.
+ * The page is rendered a band of viewport sized tiles at a time from the main
+ * loop and each band is encoded on a worker thread, so only a few bands are
+ * held in memory at once. SNAPSHOT_SAVED or SNAPSHOT_ERROR is sent once the
+ * file has been written. */
+void
+uzbl_snapshot_save (const gchar *path, UzblSnapshotFormat format, const GdkRectangle *region);
+#endif
+
+#endif
@@ -0,0 +1,638 @@
+#include "spawn-pool.h"
+
+#include "setup.h"
+#include "util.h"
+#include "uzbl-core.h"
+#include "variables.h"
+
+#include <glib-unix.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Workers are the shell from shell_cmd reading a script from stdin. Each
+ * request runs in a subshell with the environment of uzbl-core at the time
+ * and is followed by a line with the worker's marker and the exit status:
+ *
+ *   ( export UZBL_URI='...'; eval '<script>'
+ *   ) </dev/null; printf '\n%s %d\n' <marker> "$?"
+ */
+typedef struct {
+    GPid      pid;
+    gint      fd;
+    gchar    *shell;
+    gchar    *name;
+    gchar    *marker;
+    /* The environment the worker was started with. */
+    gchar   **env;
+    GString  *output;
+} UzblSpawnWorker;
+
+typedef struct {
+    UzblSpawnWorker   *worker;
+    GPid               pid;
+    gint               fd;
+    guint              watch;
+    guint              timeout;
+    GString           *output;
+    UzblSpawnCallback  callback;
+    gpointer           data;
+} UzblSpawnJob;
+
+struct _UzblSpawnPool {
+    /* Idle workers, most recently used first. */
+    GQueue idle;
+    guint  size;
+    guint  timeout;
+    /* Children which have not been reaped yet. */
+    GHashTable *children;
+};
+
+typedef enum {
+    UZBL_WORKER_BUSY,
+    UZBL_WORKER_DONE,
+    UZBL_WORKER_FAILED
+} UzblWorkerState;
+
+/* =========================== PUBLIC API =========================== */
+
+static UzblSpawnWorker *
+worker_acquire ();
+static void
+worker_release (UzblSpawnWorker *worker);
+static void
+worker_free (UzblSpawnWorker *worker);
+static gboolean
+worker_submit (UzblSpawnWorker *worker, const gchar *script);
+static UzblWorkerState
+worker_read (UzblSpawnWorker *worker);
+static gboolean
+job_spawn (UzblSpawnJob *job, GArray *argv);
+static gboolean
+job_ready (gint fd, GIOCondition condition, gpointer data);
+static gboolean
+job_timeout (gpointer data);
+
+void
+uzbl_spawn_pool_init ()
+{
+    uzbl.spawn_pool = g_malloc0 (sizeof (UzblSpawnPool));
+
+    g_queue_init (&uzbl.spawn_pool->idle);
+    uzbl.spawn_pool->children = g_hash_table_new (g_direct_hash, g_direct_equal);
+}
+
+void
+uzbl_spawn_pool_free ()
+{
+    uzbl_spawn_pool_set_size (0);
+
+    g_hash_table_destroy (uzbl.spawn_pool->children);
+    g_free (uzbl.spawn_pool);
+    uzbl.spawn_pool = NULL;
+}
+
+gboolean
+uzbl_spawn_pool_run (const gchar *script, GString *output)
+{
+    UzblSpawnPool *pool = uzbl.spawn_pool;
+
+    if (!pool->size) {
+        return FALSE;
+    }
+
+    UzblSpawnWorker *worker = worker_acquire ();
+
+    if (!worker) {
+        return FALSE;
+    }
+
+    if (!worker_submit (worker, script)) {
+        worker_free (worker);
+        return FALSE;
+    }
+
+    gint64 deadline = 0;
+    if (pool->timeout) {
+        deadline = g_get_monotonic_time () + pool->timeout * G_GINT64_CONSTANT (1000);
+    }
+
+    UzblWorkerState state = UZBL_WORKER_BUSY;
+
+    while (state == UZBL_WORKER_BUSY) {
+        int wait = -1;
+
+        if (deadline) {
+            gint64 left = deadline - g_get_monotonic_time ();
+            if (left <= 0) {
+                break;
+            }
+            wait = (left + 999) / 1000;
+        }
+
+        struct pollfd pfd = { worker->fd, POLLIN, 0 };
+        int ready = poll (&pfd, 1, wait);
+
+        if (ready < 0 && errno != EINTR) {
+            state = UZBL_WORKER_FAILED;
+        } else if (ready > 0) {
+            state = worker_read (worker);
+        }
+    }
+
+    g_string_append (output, worker->output->str);
+
+    if (state == UZBL_WORKER_DONE) {
+        worker_release (worker);
+    } else {
+        uzbl_debug ("Spawn pool worker %s: %s\n",
+            (state == UZBL_WORKER_BUSY) ? "timed out" : "failed", script);
+        worker_free (worker);
+    }
+
+    return TRUE;
+}
+
+void
+uzbl_spawn_pool_run_async (const gchar *script, GArray *argv, UzblSpawnCallback callback, gpointer data)
+{
+    UzblSpawnPool *pool = uzbl.spawn_pool;
+    UzblSpawnJob *job = g_malloc0 (sizeof (UzblSpawnJob));
+
+    job->fd = -1;
+    job->output = g_string_new ("");
+    job->callback = callback;
+    job->data = data;
+
+    if (script && pool->size) {
+        job->worker = worker_acquire ();
+
+        if (job->worker && !worker_submit (job->worker, script)) {
+            worker_free (job->worker);
+            job->worker = NULL;
+        }
+    }
+
+    if (job->worker) {
+        job->fd = job->worker->fd;
+    } else if (!job_spawn (job, argv)) {
+        callback (job->output, data);
+
+        g_string_free (job->output, TRUE);
+        g_free (job);
+        return;
+    }
+
+    job->watch = g_unix_fd_add (job->fd, G_IO_IN | G_IO_HUP | G_IO_ERR, job_ready, job);
+    if (pool->timeout) {
+        job->timeout = g_timeout_add (pool->timeout, job_timeout, job);
+    }
+}
+
+void
+uzbl_spawn_pool_set_size (guint size)
+{
+    UzblSpawnPool *pool = uzbl.spawn_pool;
+
+    pool->size = size;
+
+    while (g_queue_get_length (&pool->idle) > size) {
+        worker_free ((UzblSpawnWorker *)g_queue_pop_tail (&pool->idle));
+    }
+}
+
+void
+uzbl_spawn_pool_set_timeout (guint timeout)
+{
+    uzbl.spawn_pool->timeout = timeout;
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+static gchar *
+shell_program ();
+static UzblSpawnWorker *
+worker_new (gchar *shell);
+static gboolean
+send_all (gint fd, const gchar *data, gsize len);
+static void
+append_environment (UzblSpawnWorker *worker, GString *request);
+static void
+job_finish (UzblSpawnJob *job, gboolean success);
+static void
+kill_group (GPid pid);
+
+UzblSpawnWorker *
+worker_acquire ()
+{
+    UzblSpawnPool *pool = uzbl.spawn_pool;
+    UzblSpawnWorker *worker;
+    gchar *shell = shell_program ();
+
+    if (!shell) {
+        return NULL;
+    }
+
+    while ((worker = (UzblSpawnWorker *)g_queue_pop_head (&pool->idle))) {
+        if (!g_strcmp0 (worker->shell, shell)) {
+            g_free (shell);
+            return worker;
+        }
+
+        /* shell_cmd changed since the worker was started. */
+        worker_free (worker);
+    }
+
+    return worker_new (shell);
+}
+
+void
+worker_release (UzblSpawnWorker *worker)
+{
+    UzblSpawnPool *pool = uzbl.spawn_pool;
+
+    if (g_queue_get_length (&pool->idle) < pool->size) {
+        g_queue_push_head (&pool->idle, worker);
+    } else {
+        worker_free (worker);
+    }
+}
+
+void
+worker_free (UzblSpawnWorker *worker)
+{
+    kill_group (worker->pid);
+    close (worker->fd);
+
+    g_free (worker->shell);
+    g_free (worker->name);
+    g_free (worker->marker);
+    g_strfreev (worker->env);
+    g_string_free (worker->output, TRUE);
+    g_free (worker);
+}
+
+gboolean
+worker_submit (UzblSpawnWorker *worker, const gchar *script)
+{
+    GString *request = g_string_new ("( ");
+
+    append_environment (worker, request);
+
+    gchar *quoted = g_shell_quote (script);
+    g_string_append_printf (request, "eval %s\n) </dev/null; printf '\\n%%s %%d\\n' %s \"$?\"\n",
+        quoted, worker->name);
+    g_free (quoted);
+
+    g_string_truncate (worker->output, 0);
+
+    gboolean sent = send_all (worker->fd, request->str, request->len);
+
+    g_string_free (request, TRUE);
+
+    return sent;
+}
+
+UzblWorkerState
+worker_read (UzblSpawnWorker *worker)
+{
+    gchar buf[4096];
+    ssize_t len = recv (worker->fd, buf, sizeof (buf), 0);
+
+    if (len < 0) {
+        return (errno == EINTR || errno == EAGAIN) ? UZBL_WORKER_BUSY : UZBL_WORKER_FAILED;
+    }
+    if (!len) {
+        return UZBL_WORKER_FAILED;
+    }
+
+    g_string_append_len (worker->output, buf, len);
+
+    GString *output = worker->output;
+
+    if (output->str[output->len - 1] != '\n') {
+        return UZBL_WORKER_BUSY;
+    }
+
+    gchar *marker = g_strrstr (output->str, worker->marker);
+    if (!marker) {
+        return UZBL_WORKER_BUSY;
+    }
+
+    const gchar *status = marker + strlen (worker->marker);
+    if (strspn (status, "0123456789") + 1 != strlen (status)) {
+        return UZBL_WORKER_BUSY;
+    }
+
+    g_string_truncate (output, marker - output->str);
+
+    return UZBL_WORKER_DONE;
+}
+
+static void
+child_setup (gpointer data);
+static void
+reap_child (GPid pid, gint status, gpointer data);
+
+gboolean
+job_spawn (UzblSpawnJob *job, GArray *argv)
+{
+    GError *err = NULL;
+
+    if (!g_spawn_async_with_pipes (NULL, (gchar **)argv->data, NULL,
+            G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD, child_setup, NULL,
+            &job->pid, NULL, &job->fd, NULL, &err)) {
+        uzbl_debug ("Failed to spawn %s: %s\n", argv_idx (argv, 0), err->message);
+        g_error_free (err);
+        return FALSE;
+    }
+
+    g_hash_table_add (uzbl.spawn_pool->children, GINT_TO_POINTER (job->pid));
+    g_child_watch_add (job->pid, reap_child, NULL);
+
+    return TRUE;
+}
+
+gboolean
+job_ready (gint fd, GIOCondition condition, gpointer data)
+{
+    UZBL_UNUSED (condition);
+
+    UzblSpawnJob *job = (UzblSpawnJob *)data;
+    gboolean success = TRUE;
+
+    if (job->worker) {
+        UzblWorkerState state = worker_read (job->worker);
+
+        if (state == UZBL_WORKER_BUSY) {
+            return G_SOURCE_CONTINUE;
+        }
+
+        success = (state == UZBL_WORKER_DONE);
+    } else {
+        gchar buf[4096];
+        ssize_t len = read (fd, buf, sizeof (buf));
+
+        if (len < 0 && errno == EINTR) {
+            return G_SOURCE_CONTINUE;
+        }
+        if (len > 0) {
+            g_string_append_len (job->output, buf, len);
+            return G_SOURCE_CONTINUE;
+        }
+    }
+
+    job->watch = 0;
+    job_finish (job, success);
+
+    return G_SOURCE_REMOVE;
+}
+
+gboolean
+job_timeout (gpointer data)
+{
+    UzblSpawnJob *job = (UzblSpawnJob *)data;
+
+    uzbl_debug ("Spawned child timed out\n");
+
+    job->timeout = 0;
+    job_finish (job, FALSE);
+
+    return G_SOURCE_REMOVE;
+}
+
+gchar *
+shell_program ()
+{
+    gchar *shell_cmd = uzbl_variables_get_string ("shell_cmd");
+    gchar **shell_argv = NULL;
+    gchar *shell = NULL;
+
+    if (g_shell_parse_argv (shell_cmd, NULL, &shell_argv, NULL)) {
+        shell = g_strdup (shell_argv[0]);
+        g_strfreev (shell_argv);
+    } else {
+        uzbl_debug ("spawn pool: shell_cmd is not set!\n");
+    }
+
+    g_free (shell_cmd);
+
+    return shell;
+}
+
+static void
+worker_setup (gpointer data);
+
+UzblSpawnWorker *
+worker_new (gchar *shell)
+{
+    GError *err = NULL;
+    GPid pid;
+    int fds[2];
+
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds)) {
+        uzbl_debug ("Failed to create spawn pool socket: %s\n", g_strerror (errno));
+        g_free (shell);
+        return NULL;
+    }
+
+    gchar *argv[] = { shell, (gchar *)"-s", NULL };
+    gboolean spawned = g_spawn_async (NULL, argv, NULL,
+        G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD, worker_setup, &fds[1],
+        &pid, &err);
+
+    close (fds[1]);
+
+    if (!spawned) {
+        uzbl_debug ("Failed to start spawn pool worker %s: %s\n", shell, err->message);
+        g_error_free (err);
+        close (fds[0]);
+        g_free (shell);
+        return NULL;
+    }
+
+    fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+    g_hash_table_add (uzbl.spawn_pool->children, GINT_TO_POINTER (pid));
+    g_child_watch_add (pid, reap_child, NULL);
+
+    UzblSpawnWorker *worker = g_malloc0 (sizeof (UzblSpawnWorker));
+
+    worker->pid = pid;
+    worker->fd = fds[0];
+    worker->shell = shell;
+    worker->name = g_strdup_printf ("uzbl-spawn-pool-%08x%08x", g_random_int (), g_random_int ());
+    worker->marker = g_strdup_printf ("\n%s ", worker->name);
+    worker->env = g_get_environ ();
+    worker->output = g_string_new ("");
+
+    return worker;
+}
+
+gboolean
+send_all (gint fd, const gchar *data, gsize len)
+{
+    while (len) {
+        ssize_t sent = send (fd, data, len, MSG_NOSIGNAL);
+
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return FALSE;
+        }
+
+        data += sent;
+        len -= sent;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+valid_name (const gchar *name);
+
+void
+append_environment (UzblSpawnWorker *worker, GString *request)
+{
+    gchar **env = g_get_environ ();
+    gchar **entry;
+
+    for (entry = env; *entry; ++entry) {
+        const gchar *value = strchr (*entry, '=');
+        if (!value) {
+            continue;
+        }
+
+        gchar *name = g_strndup (*entry, value - *entry);
+        ++value;
+
+        if (valid_name (name) && g_strcmp0 (g_environ_getenv (worker->env, name), value)) {
+            gchar *quoted = g_shell_quote (value);
+            g_string_append_printf (request, "export %s=%s; ", name, quoted);
+            g_free (quoted);
+        }
+
+        g_free (name);
+    }
+
+    for (entry = worker->env; *entry; ++entry) {
+        const gchar *value = strchr (*entry, '=');
+        if (!value) {
+            continue;
+        }
+
+        gchar *name = g_strndup (*entry, value - *entry);
+
+        if (valid_name (name) && !g_environ_getenv (env, name)) {
+            g_string_append_printf (request, "unset %s; ", name);
+        }
+
+        g_free (name);
+    }
+
+    g_strfreev (env);
+}
+
+void
+job_finish (UzblSpawnJob *job, gboolean success)
+{
+    if (job->watch) {
+        g_source_remove (job->watch);
+    }
+    if (job->timeout) {
+        g_source_remove (job->timeout);
+    }
+
+    if (job->worker) {
+        g_string_append (job->output, job->worker->output->str);
+
+        if (success) {
+            worker_release (job->worker);
+        } else {
+            worker_free (job->worker);
+        }
+    } else {
+        if (!success) {
+            kill_group (job->pid);
+        }
+
+        close (job->fd);
+    }
+
+    job->callback (job->output, job->data);
+
+    g_string_free (job->output, TRUE);
+    g_free (job);
+}
+
+void
+kill_group (GPid pid)
+{
+    /* The group outlives a reaped child for as long as anything it started
+     * is still running, so its id can not be reused until then. */
+    if (kill (-pid, SIGKILL) &&
+        g_hash_table_contains (uzbl.spawn_pool->children, GINT_TO_POINTER (pid))) {
+        /* Only an unreaped pid is sure to still be the child's. */
+        kill (pid, SIGKILL);
+    }
+}
+
+void
+child_setup (gpointer data)
+{
+    UZBL_UNUSED (data);
+
+    /* Lets kill_group take down whatever the child started. */
+    setpgid (0, 0);
+}
+
+void
+reap_child (GPid pid, gint status, gpointer data)
+{
+    UZBL_UNUSED (status);
+    UZBL_UNUSED (data);
+
+    if (uzbl.spawn_pool) {
+        g_hash_table_remove (uzbl.spawn_pool->children, GINT_TO_POINTER (pid));
+    }
+
+    g_spawn_close_pid (pid);
+}
+
+void
+worker_setup (gpointer data)
+{
+    int fd = *(int *)data;
+
+    dup2 (fd, STDIN_FILENO);
+    dup2 (fd, STDOUT_FILENO);
+
+    setpgid (0, 0);
+}
+
+gboolean
+valid_name (const gchar *name)
+{
+    if (!g_ascii_isalpha (*name) && *name != '_') {
+        return FALSE;
+    }
+
+    for (++name; *name; ++name) {
+        if (!g_ascii_isalnum (*name) && *name != '_') {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
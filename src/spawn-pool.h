@@ -0,0 +1,28 @@
+#ifndef UZBL_SPAWN_POOL_H
+#define UZBL_SPAWN_POOL_H
+
+#include <glib.h>
+
+typedef void (*UzblSpawnCallback)(GString *output, gpointer data);
+
+/* Run a shell script on a long-lived worker shell instead of forking a new
+ * one and append its output to output. Returns FALSE if the pool is disabled
+ * or no worker could be started; the script has not been run then. */
+gboolean
+uzbl_spawn_pool_run (const gchar *script, GString *output);
+
+/* Run a child without blocking and pass its output to callback once it is
+ * done. If script is not NULL and the pool is enabled, it is run on a worker
+ * shell, otherwise argv is spawned. */
+void
+uzbl_spawn_pool_run_async (const gchar *script, GArray *argv, UzblSpawnCallback callback, gpointer data);
+
+/* Keep at most size idle workers; 0 disables the pool. */
+void
+uzbl_spawn_pool_set_size (guint size);
+/* Give up on children running longer than timeout milliseconds; 0 waits
+ * forever. */
+void
+uzbl_spawn_pool_set_timeout (guint timeout);
+
+#endif
@@ -35,6 +35,7 @@
 #include "gui.h"
 #include "io.h"
 #include "setup.h"
+#include "snapshot.h"
 #include "soup.h"
 #include "type.h"
 #include "util.h"
@@ -175,6 +176,14 @@ uzbl_init (int *argc, char ***argv)
     uzbl_commands_init ();
     uzbl_events_init ();
     uzbl_requests_init ();
+    uzbl_request_filter_init ();
+    uzbl_decision_cache_init ();
+    uzbl_spawn_pool_init ();
+    uzbl_downloads_init ();
+    uzbl_site_settings_init ();
+#ifdef HAVE_SNAPSHOT
+    uzbl_snapshot_init ();
+#endif
 
     uzbl_scheme_init ();
 
@@ -289,8 +298,16 @@ uzbl_free ()
         TYPE_INT, getpid (),
         NULL);
 
+#ifdef HAVE_SNAPSHOT
+    uzbl_snapshot_free ();
+#endif
     uzbl_inspector_free ();
     uzbl_gui_free ();
+    uzbl_site_settings_free ();
+    uzbl_downloads_free ();
+    uzbl_spawn_pool_free ();
+    uzbl_decision_cache_free ();
+    uzbl_request_filter_free ();
     uzbl_requests_free ();
     uzbl_commands_free ();
     uzbl_variables_free ();
@@ -434,6 +451,11 @@ clean_up ()
         JSGlobalContextRelease (uzbl.state.jscontext);
     }
 
+    if (uzbl.state.js_scripts) {
+        g_hash_table_destroy (uzbl.state.js_scripts);
+        uzbl.state.js_scripts = NULL;
+    }
+
     if (uzbl.net.soup_cookie_jar) {
         g_object_unref (uzbl.net.soup_cookie_jar);
         uzbl.net.soup_cookie_jar = NULL;
@@ -43,6 +43,8 @@ typedef struct {
     gchar          *last_result;
     gboolean        plug_mode;
     JSGlobalContextRef jscontext;
+    /* JavaScript files by path. */
+    GHashTable     *js_scripts;
 
     gboolean        started;
     gboolean        gtk_started;
@@ -62,6 +64,12 @@ typedef struct {
 struct _UzblCommands;
 typedef struct _UzblCommands UzblCommands;
 
+struct _UzblDecisionCache;
+typedef struct _UzblDecisionCache UzblDecisionCache;
+
+struct _UzblDownloads;
+typedef struct _UzblDownloads UzblDownloads;
+
 struct _UzblGui;
 typedef struct _UzblGui UzblGui;
 
@@ -71,9 +79,21 @@ typedef struct _UzblInspector UzblInspector;
 struct _UzblIO;
 typedef struct _UzblIO UzblIO;
 
+struct _UzblRequestFilter;
+typedef struct _UzblRequestFilter UzblRequestFilter;
+
 struct _UzblRequests;
 typedef struct _UzblRequests UzblRequests;
 
+struct _UzblSiteSettings;
+typedef struct _UzblSiteSettings UzblSiteSettings;
+
+struct _UzblSnapshot;
+typedef struct _UzblSnapshot UzblSnapshot;
+
+struct _UzblSpawnPool;
+typedef struct _UzblSpawnPool UzblSpawnPool;
+
 struct _UzblVariables;
 typedef struct _UzblVariables UzblVariables;
 
@@ -84,10 +104,16 @@ typedef struct {
     UzblNetwork       net;
 
     UzblCommands     *commands;
+    UzblDecisionCache *decision_cache;
+    UzblDownloads    *downloads;
     UzblGui          *gui_;
     UzblInspector    *inspector;
     UzblIO           *io;
+    UzblRequestFilter *request_filter;
     UzblRequests     *requests;
+    UzblSiteSettings *site_settings;
+    UzblSnapshot     *snapshot;
+    UzblSpawnPool    *spawn_pool;
     UzblVariables    *variables;
 } UzblCore;
 
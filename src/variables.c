@@ -1,15 +1,19 @@
 #include "variables.h"
 
 #include "commands.h"
+#include "decision-cache.h"
+#include "downloads.h"
 #include "events.h"
 #include "gui.h"
 #include "io.h"
 #include "js.h"
+#include "scheme.h"
 #include "sync.h"
 #include "type.h"
 #include "util.h"
 #include "comm.h"
 #include "soup.h"
+#include "spawn-pool.h"
 #include "uzbl-core.h"
 
 #include <JavaScriptCore/JavaScript.h>
@@ -52,6 +56,11 @@ typedef struct {
 
     UzblFunction get;
     UzblFunction set;
+
+    /* The last string value handed to JavaScript. It is reused for as long as
+     * the stored value matches js_text. */
+    gchar      *js_text;
+    JSStringRef js_string;
 } UzblVariable;
 
 struct _UzblVariablesPrivate;
@@ -130,9 +139,26 @@ static gboolean
 set_variable_double (UzblVariable *var, gdouble d);
 static void
 send_variable_event (const gchar *name, const UzblVariable *var);
+static gboolean
+set_variable (const gchar *name, gchar *val, gboolean notify);
+static void
+variable_js_invalidate (UzblVariable *var);
 
 gboolean
 uzbl_variables_set (const gchar *name, gchar *val)
+{
+    return set_variable (name, val, TRUE);
+}
+
+gboolean
+uzbl_variables_set_quiet (const gchar *name, gchar *val)
+{
+    /* Neither sends VARIABLE_SET nor redraws the title and status bar. */
+    return set_variable (name, val, FALSE);
+}
+
+gboolean
+set_variable (const gchar *name, gchar *val, gboolean notify)
 {
     if (!val) {
         return FALSE;
@@ -149,6 +175,7 @@ uzbl_variables_set (const gchar *name, gchar *val)
         switch (var->type) {
         case TYPE_STR:
             sendev = set_variable_string (var, val);
+            variable_js_invalidate (var);
             break;
         case TYPE_INT:
         {
@@ -186,6 +213,8 @@ uzbl_variables_set (const gchar *name, gchar *val)
         var->set       = NULL;
         var->writeable = TRUE;
         var->builtin   = FALSE;
+        var->js_text   = NULL;
+        var->js_string = NULL;
 
         var->value.s = g_malloc (sizeof (gchar *));
 
@@ -196,7 +225,7 @@ uzbl_variables_set (const gchar *name, gchar *val)
         *(var->value.s) = g_strdup (val);
     }
 
-    if (sendev) {
+    if (sendev && notify) {
         send_variable_event (name, var);
     }
 
@@ -427,9 +456,15 @@ variable_free (UzblVariable *variable)
         }
     }
 
+    variable_js_invalidate (variable);
+
     g_free (variable);
 }
 
+static UzblVariable *
+js_variable (JSStringRef name);
+static JSStringRef
+variable_js_string (UzblVariable *var);
 static bool
 js_has_variable (JSContextRef ctx, JSObjectRef object, JSStringRef propertyName);
 static JSValueRef
@@ -893,13 +928,20 @@ dump_variable_event (gpointer key, gpointer value, gpointer data)
     send_variable_event (name, var);
 }
 
-bool
-js_has_variable (JSContextRef ctx, JSObjectRef object, JSStringRef propertyName)
+/* Names of variables are short and ASCII, so they are converted on the stack
+ * rather than through a malloc'ed UTF-8 copy. */
+#define JS_NAME_MAX 128
+
+UzblVariable *
+js_variable (JSStringRef name)
 {
-    UZBL_UNUSED (ctx);
-    UZBL_UNUSED (object);
+    gchar buf[JS_NAME_MAX];
+
+    if (uzbl_js_string_to_ascii (name, buf, sizeof (buf))) {
+        return get_variable (buf);
+    }
 
-    gchar *var = uzbl_js_extract_string (propertyName);
+    gchar *var = uzbl_js_extract_string (name);
     UzblVariable *uzbl_var = get_variable (var);
 
     g_free (var);
@@ -907,16 +949,53 @@ js_has_variable (JSContextRef ctx, JSObjectRef object, JSStringRef propertyName)
     return uzbl_var;
 }
 
+JSStringRef
+variable_js_string (UzblVariable *var)
+{
+    const gchar *val = (var->value.s && *var->value.s) ? *var->value.s : "";
+
+    /* Builtin storage may be written without going through set_variable
+     * (e.g., the title or the last result), so check the contents as well. */
+    if (var->js_string && !strcmp (var->js_text, val)) {
+        return var->js_string;
+    }
+
+    variable_js_invalidate (var);
+
+    var->js_text = g_strdup (val);
+    var->js_string = JSStringCreateWithUTF8CString (val);
+
+    return var->js_string;
+}
+
+void
+variable_js_invalidate (UzblVariable *var)
+{
+    if (var->js_string) {
+        JSStringRelease (var->js_string);
+        var->js_string = NULL;
+    }
+
+    g_free (var->js_text);
+    var->js_text = NULL;
+}
+
+bool
+js_has_variable (JSContextRef ctx, JSObjectRef object, JSStringRef propertyName)
+{
+    UZBL_UNUSED (ctx);
+    UZBL_UNUSED (object);
+
+    return js_variable (propertyName);
+}
+
 JSValueRef
 js_get_variable (JSContextRef ctx, JSObjectRef object, JSStringRef propertyName, JSValueRef* exception)
 {
     UZBL_UNUSED (object);
     UZBL_UNUSED (exception);
 
-    gchar *var = uzbl_js_extract_string (propertyName);
-    UzblVariable *uzbl_var = get_variable (var);
-
-    g_free (var);
+    UzblVariable *uzbl_var = js_variable (propertyName);
 
     if (!uzbl_var) {
         return JSValueMakeUndefined (ctx);
@@ -927,6 +1006,11 @@ js_get_variable (JSContextRef ctx, JSObjectRef object, JSStringRef propertyName,
     switch (uzbl_var->type) {
     case TYPE_STR:
     {
+        if (!uzbl_var->get) {
+            js_value = JSValueMakeString (ctx, variable_js_string (uzbl_var));
+            break;
+        }
+
         gchar *val = get_variable_string (uzbl_var);
         JSStringRef js_str = JSStringCreateWithUTF8CString (val);
         g_free (val);
@@ -971,10 +1055,15 @@ js_set_variable (JSContextRef ctx, JSObjectRef object, JSStringRef propertyName,
     UZBL_UNUSED (object);
     UZBL_UNUSED (exception);
 
-    gchar *var = uzbl_js_extract_string (propertyName);
+    gchar buf[JS_NAME_MAX];
+    gchar *var = NULL;
     gchar *val = uzbl_js_to_string (ctx, value);
 
-    gboolean was_set = uzbl_variables_set (var, val);
+    if (!uzbl_js_string_to_ascii (propertyName, buf, sizeof (buf))) {
+        var = uzbl_js_extract_string (propertyName);
+    }
+
+    gboolean was_set = uzbl_variables_set (var ? var : buf, val);
 
     g_free (var);
     g_free (val);
@@ -1108,6 +1197,13 @@ DECLARE_SETTER (gchar *, socket_dir);
 
 /* Handler variables */
 DECLARE_SETTER (int, enable_builtin_auth);
+DECLARE_SETTER (int, decision_cache_size);
+DECLARE_SETTER (int, spawn_pool_size);
+DECLARE_SETTER (int, spawn_timeout);
+DECLARE_SETTER (int, download_max_active);
+DECLARE_SETTER (int, download_progress_interval);
+DECLARE_SETTER (int, download_progress_step);
+DECLARE_SETTER (int, scheme_cache_size);
 
 /* Window variables */
 DECLARE_SETTER (gchar *, icon);
@@ -1143,6 +1239,7 @@ DECLARE_GETSET (int, enable_universal_file_access);
 DECLARE_GETSET (int, enable_cross_file_access);
 DECLARE_GETSET (int, enable_hyperlink_auditing);
 DECLARE_GETSET (gchar *, cookie_policy);
+DECLARE_SETTER (gchar *, cookie_jar_file);
 #if WEBKIT_CHECK_VERSION (1, 3, 13)
 DECLARE_GETSET (int, enable_dns_prefetch);
 #endif
@@ -1330,9 +1427,17 @@ struct _UzblVariablesPrivate {
     gchar *http_debug;
     SoupLogger *soup_logger;
     gboolean enable_builtin_auth;
+    int decision_cache_size;
+    int spawn_pool_size;
+    int spawn_timeout;
+    int download_max_active;
+    int download_progress_interval;
+    int download_progress_step;
+    int scheme_cache_size;
 
     /* Security variables */
     gboolean permissive;
+    gchar *cookie_jar_file;
     gboolean maintain_history;
 
     /* Page variables */
@@ -1364,6 +1469,13 @@ uzbl_variables_private_new (GHashTable *table)
 
         /* Handler variables */
         { "enable_builtin_auth",          UZBL_V_INT (priv->enable_builtin_auth,               set_enable_builtin_auth)},
+        { "decision_cache_size",          UZBL_V_INT (priv->decision_cache_size,               set_decision_cache_size)},
+        { "spawn_pool_size",              UZBL_V_INT (priv->spawn_pool_size,                   set_spawn_pool_size)},
+        { "spawn_timeout",                UZBL_V_INT (priv->spawn_timeout,                     set_spawn_timeout)},
+        { "download_max_active",          UZBL_V_INT (priv->download_max_active,               set_download_max_active)},
+        { "download_progress_interval",   UZBL_V_INT (priv->download_progress_interval,        set_download_progress_interval)},
+        { "download_progress_step",       UZBL_V_INT (priv->download_progress_step,            set_download_progress_step)},
+        { "scheme_cache_size",            UZBL_V_INT (priv->scheme_cache_size,                 set_scheme_cache_size)},
 
         /* Window variables */
         { "icon",                         UZBL_V_STRING (priv->icon,                           set_icon)},
@@ -1404,6 +1516,7 @@ uzbl_variables_private_new (GHashTable *table)
         { "enable_cross_file_access",     UZBL_V_FUNC (enable_cross_file_access,               INT)},
         { "enable_hyperlink_auditing",    UZBL_V_FUNC (enable_hyperlink_auditing,              INT)},
         { "cookie_policy",                UZBL_V_FUNC (cookie_policy,                          STR)},
+        { "cookie_jar_file",              UZBL_V_STRING (priv->cookie_jar_file,                set_cookie_jar_file)},
 #if WEBKIT_CHECK_VERSION (1, 3, 13)
         { "enable_dns_prefetch",          UZBL_V_FUNC (enable_dns_prefetch,                    INT)},
 #endif
@@ -1760,6 +1873,90 @@ IMPLEMENT_SETTER (int, enable_builtin_auth)
     return TRUE;
 }
 
+IMPLEMENT_SETTER (int, decision_cache_size)
+{
+    if (decision_cache_size < 0) {
+        return FALSE;
+    }
+
+    uzbl.variables->priv->decision_cache_size = decision_cache_size;
+    uzbl_decision_cache_set_size (decision_cache_size);
+
+    return TRUE;
+}
+
+IMPLEMENT_SETTER (int, spawn_pool_size)
+{
+    if (spawn_pool_size < 0) {
+        return FALSE;
+    }
+
+    uzbl.variables->priv->spawn_pool_size = spawn_pool_size;
+    uzbl_spawn_pool_set_size (spawn_pool_size);
+
+    return TRUE;
+}
+
+IMPLEMENT_SETTER (int, spawn_timeout)
+{
+    if (spawn_timeout < 0) {
+        return FALSE;
+    }
+
+    uzbl.variables->priv->spawn_timeout = spawn_timeout;
+    uzbl_spawn_pool_set_timeout (spawn_timeout);
+
+    return TRUE;
+}
+
+IMPLEMENT_SETTER (int, download_max_active)
+{
+    if (download_max_active < 0) {
+        return FALSE;
+    }
+
+    uzbl.variables->priv->download_max_active = download_max_active;
+    uzbl_downloads_set_max_active (download_max_active);
+
+    return TRUE;
+}
+
+IMPLEMENT_SETTER (int, download_progress_interval)
+{
+    if (download_progress_interval < 0) {
+        return FALSE;
+    }
+
+    uzbl.variables->priv->download_progress_interval = download_progress_interval;
+    uzbl_downloads_set_progress_interval (download_progress_interval);
+
+    return TRUE;
+}
+
+IMPLEMENT_SETTER (int, download_progress_step)
+{
+    if ((download_progress_step < 0) || (100 < download_progress_step)) {
+        return FALSE;
+    }
+
+    uzbl.variables->priv->download_progress_step = download_progress_step;
+    uzbl_downloads_set_progress_step (download_progress_step);
+
+    return TRUE;
+}
+
+IMPLEMENT_SETTER (int, scheme_cache_size)
+{
+    if (scheme_cache_size < 0) {
+        return FALSE;
+    }
+
+    uzbl.variables->priv->scheme_cache_size = scheme_cache_size;
+    uzbl_scheme_set_cache_size (scheme_cache_size);
+
+    return TRUE;
+}
+
 /* Window variables */
 IMPLEMENT_SETTER (gchar *, icon)
 {
@@ -2078,6 +2275,11 @@ IMPLEMENT_SETTER (int, enable_private)
             SOUP_SESSION_FEATURE (uzbl.net.soup_cookie_jar));
         g_object_unref (G_OBJECT (uzbl.net.soup_cookie_jar));
         uzbl.net.soup_cookie_jar = uzbl_cookie_jar_new ();
+        /* Private browsing never touches the cookie database. */
+        if (!enable_private) {
+            uzbl_cookie_jar_set_store (uzbl.net.soup_cookie_jar,
+                uzbl.variables->priv->cookie_jar_file);
+        }
         soup_session_add_feature (uzbl.net.soup_session,
             SOUP_SESSION_FEATURE (uzbl.net.soup_cookie_jar));
     }
@@ -2117,6 +2319,20 @@ CHOICE_GETSET (SoupCookieJarAcceptPolicy, cookie_policy,
 
 #undef cookie_policy_choices
 
+IMPLEMENT_SETTER (gchar *, cookie_jar_file)
+{
+    if (!get_enable_private ()) {
+        if (!uzbl_cookie_jar_set_store (uzbl.net.soup_cookie_jar, cookie_jar_file)) {
+            return FALSE;
+        }
+    }
+
+    g_free (uzbl.variables->priv->cookie_jar_file);
+    uzbl.variables->priv->cookie_jar_file = g_strdup (cookie_jar_file);
+
+    return TRUE;
+}
+
 #if WEBKIT_CHECK_VERSION (1, 3, 13)
 GOBJECT_GETSET2 (int, enable_dns_prefetch,
                  gboolean, webkit_settings (), "enable-dns-prefetching")
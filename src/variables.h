@@ -9,6 +9,8 @@ uzbl_variables_is_valid (const gchar *name);
 gboolean
 uzbl_variables_set (const gchar *name, gchar *val);
 gboolean
+uzbl_variables_set_quiet (const gchar *name, gchar *val);
+gboolean
 uzbl_variables_toggle (const gchar *name, GArray *values);
 
 gchar *
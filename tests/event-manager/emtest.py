@@ -14,6 +14,8 @@ def __init__(self,
         self.instance_plugins = instance_plugins
         self.instance_mock_plugins = instance_mock_plugins
         self.plugin_config = plugin_config or {}
+        self.deferred = []
+        self.timers = []
 
         for plugin in global_plugins:
             self.plugins[plugin] = plugin(self)
@@ -32,5 +34,21 @@ def add(self):
         self.uzbls[Mock()] = u
         return u
 
+    def defer(self, callback, delay=None):
+        if delay is None:
+            self.deferred.append(callback)
+        else:
+            self.timers.append(callback)
+
+    def run_deferred(self):
+        deferred, self.deferred = self.deferred, []
+        for callback in deferred:
+            callback()
+
+    def run_timers(self):
+        timers, self.timers = self.timers, []
+        for callback in timers:
+            callback()
+
     def get_plugin_config(self, section):
         return self.plugin_config.get(section, {})
@@ -8,8 +8,9 @@
 import mock
 import unittest
 from emtest import EventManagerMock
-from uzbl.plugins.bind import Bind, BindPlugin
+from uzbl.plugins.bind import Bind, BindPlugin, BindTrie
 from uzbl.plugins.config import Config
+from uzbl.plugins.keycmd import KeyCmd, Keylet
 
 
 def justafunction():
@@ -23,11 +24,53 @@ def test_unique_id(self):
         self.assertNotEqual(a.bid, b.bid)
 
 
+class BindTrieTest(unittest.TestCase):
+    def lookup(self, trie, cmd, mod_cmd=False, modstate=(), on_exec=False):
+        names = trie.lookup(mod_cmd, set(modstate), on_exec, cmd)
+        return sorted(names)
+
+    def test_exact_and_prefix(self):
+        trie = BindTrie()
+        for glob in ('gg', 'g', 'o_', 'fl*', 'f*', 'ZZ'):
+            trie.add(glob, Bind(glob, 'spam'))
+
+        self.assertEqual(self.lookup(trie, 'gg'), ['gg'])
+        self.assertEqual(self.lookup(trie, 'flink'), ['f*', 'fl*'])
+        self.assertEqual(self.lookup(trie, 'f'), ['f*'])
+        self.assertEqual(self.lookup(trie, 'ouzbl', on_exec=True), ['o_'])
+        self.assertEqual(self.lookup(trie, 'ouzbl'), [])
+        self.assertEqual(self.lookup(trie, 'x'), [])
+
+    def test_modkeys(self):
+        trie = BindTrie()
+        trie.add('<Ctrl>t', Bind('<Ctrl>t', 'spam'))
+        trie.add('t', Bind('t', 'spam'))
+
+        self.assertEqual(self.lookup(trie, 't'), ['t'])
+        self.assertEqual(self.lookup(trie, 't', True, ['<Ctrl>']), ['<Ctrl>t'])
+        self.assertEqual(self.lookup(trie, 't', True, ['<Mod1>']), [])
+
+    def test_override(self):
+        trie = BindTrie()
+        trie.add('gg', Bind('gg', 'spam'))
+        trie.add('gg', None)
+        self.assertEqual(self.lookup(trie, 'gg'), [])
+        trie.add('gg*', Bind('gg*', 'spam'))
+        trie.add('gg*', Bind('gg*', 'egg'))
+        self.assertEqual(self.lookup(trie, 'gg'), ['gg*'])
+        self.assertEqual(trie.binds['gg*'].commands, ['egg'])
+
+
 class BindPluginTest(unittest.TestCase):
     def setUp(self):
-        self.event_manager = EventManagerMock((), (Config, BindPlugin))
+        self.event_manager = EventManagerMock((), (Config, KeyCmd, BindPlugin))
         self.uzbl = self.event_manager.add()
 
+    def press(self, keycmd, on_exec=False):
+        k = Keylet()
+        k.keycmd = keycmd
+        BindPlugin[self.uzbl].key_event(set(), k, on_exec=on_exec)
+
     def test_add_bind(self):
         b = BindPlugin[self.uzbl]
         modes = 'global'
@@ -62,3 +105,127 @@ def test_parse_nasty_bind(self):
         self.assertEqual(len(binds), 1)
         self.assertEqual(binds[0].glob, glob)
         self.assertEqual(binds[0].commands, [handler])
+
+    def test_key_event(self):
+        b = BindPlugin[self.uzbl]
+        called = []
+        for glob in ('gg', 'g*', 'o_'):
+            b.mode_bind('global', glob,
+                        lambda uzbl, *args, **kargs: called.append(args),
+                        glob)
+
+        self.press('gg')
+        self.assertEqual(called, [('gg',)])
+        self.press('gx')
+        self.assertEqual(called[-1], ('x', 'g*'))
+        self.press('ouzbl', on_exec=True)
+        self.assertEqual(called[-1], ('uzbl', 'o_'))
+        del called[:]
+        self.press('x')
+        self.assertEqual(called, [])
+
+    def test_candidates_match_get_binds(self):
+        b = BindPlugin[self.uzbl]
+        globs = ['a', 'ab', 'a*', 'b_', 'ba!', '<Ctrl>a', 'abc*', 'c']
+        for glob in globs:
+            b.mode_bind('global', glob, 'spam')
+        b.mode_bind('command', 'ab', 'egg')
+        b.mode_bind('command', 'd*', 'egg')
+        b.mode_bind('global,-command', 'c', None)
+
+        bindlet = b.bindlet
+        for mode in ('global', 'command', 'insert'):
+            for cmd in ('a', 'ab', 'abcd', 'ba', 'c', 'dd', ''):
+                for on_exec in (False, True):
+                    k = Keylet()
+                    k.keycmd = cmd
+                    expected = [
+                        bind for bind in bindlet.get_binds(mode)
+                        if not bind[0][2] and bind[0][0] == on_exec and
+                        (cmd.startswith(bind[0][3]) if bind[0][1]
+                         else cmd == bind[0][3])]
+                    got = bindlet.candidates(False, on_exec, set(), k, mode)
+                    self.assertEqual(got, expected, (mode, cmd, on_exec))
+
+
+class NativeBindTest(unittest.TestCase):
+    def setUp(self):
+        self.event_manager = EventManagerMock(
+            (), (Config, KeyCmd, BindPlugin),
+            plugin_config={'bind': {'native': '1'}})
+        self.uzbl = self.event_manager.add()
+        self.bind = BindPlugin[self.uzbl]
+
+    def sent(self):
+        commands = [c[0][0] for c in self.uzbl.send.call_args_list
+                    if c[0][0].startswith('bind ')]
+        self.uzbl.send.reset_mock()
+        return commands
+
+    def test_single_keystrokes(self):
+        self.bind.mode_bind('global', 'j', 'scroll vertical 20')
+        self.bind.mode_bind('global', '<Ctrl>t', 'event NEW_TAB @uri')
+        self.bind.mode_bind('global', '<Mod1><Page_Down>', 'uri %s')
+        self.assertEqual(self.sent(), [
+            "bind add 'global' 'j' 'scroll vertical 20'",
+            "bind add 'global' '<Ctrl>t' 'event NEW_TAB \\@uri'",
+            "bind add 'global' '<Mod1><Page_Down>' 'uri '"])
+        self.assertTrue(KeyCmd[self.uzbl].native_binds)
+
+    def test_not_native(self):
+        self.bind.mode_bind('global', 'gg', 'scroll vertical begin')
+        self.bind.mode_bind('global', 'o_', 'uri %s')
+        self.bind.mode_bind('global', 'x', justafunction)
+        self.assertEqual(self.sent(), [
+            "bind mask 'global' 'g'", "bind mask 'global' 'o'",
+            "bind mask 'global' 'x'"])
+
+    def test_conflicts(self):
+        self.bind.mode_bind('global', 'g', 'back')
+        self.bind.mode_bind('global', 'gg', 'scroll vertical begin')
+        self.assertEqual(self.sent(), ["bind add 'global' 'g' 'back'",
+                                       "bind mask 'global' 'g'"])
+
+        self.bind.mode_bind('global', 'gg', None)
+        self.assertEqual(self.sent(), ["bind add 'global' 'g' 'back'"])
+
+        self.bind.mode_bind('global', '*', 'search find %s')
+        self.assertEqual(self.sent(), ["bind mask 'global' 'g'"])
+
+    def test_modes(self):
+        self.bind.mode_bind('global', 'j', 'scroll vertical 20')
+        self.bind.mode_bind('command', 'j', 'back')
+        self.bind.mode_bind('global,-insert', 'j', 'scroll vertical 20')
+        self.assertEqual(self.sent(), [
+            "bind add 'global' 'j' 'scroll vertical 20'",
+            "bind add 'command' 'j' 'back'",
+            "bind add 'global' 'j' 'scroll vertical 20'",
+            "bind mask 'insert' 'j'"])
+
+    def test_modmap(self):
+        KeyCmd[self.uzbl].add_modmap('<ISO_Left_Tab>', '<Shift-Tab>')
+        self.bind.mode_bind('global', '<Shift-Tab>', 'back')
+        self.assertEqual(self.sent(), ["bind add 'global' '<ISO_Left_Tab>' 'back'",
+                                       "bind add 'global' '<Shift-Tab>' 'back'"])
+
+    def test_space(self):
+        KeyCmd[self.uzbl].add_modmap(' ', '<Leader>')
+        self.bind.mode_bind('global', '<Leader>', 'back')
+        self.assertEqual(self.sent(), ["bind add 'global' ' ' 'back'",
+                                       "bind add 'global' '<Leader>' 'back'"])
+
+    def test_executed(self):
+        self.bind.mode_bind('global', '<Ctrl>t', 'back')
+        self.uzbl.event.reset_mock()
+        self.bind.native_executed("global '<Ctrl>t'")
+        bind = self.bind.bindlet.get_binds()[0]
+        self.uzbl.event.assert_called_once_with('EXEC_BIND', bind, (), {})
+
+    def test_sync(self):
+        keycmd = KeyCmd[self.uzbl]
+        keycmd.native_sync('')
+        self.assertEqual(self.sent(), [])
+        self.bind.mode_bind('global', 'j', 'back')
+        self.sent()
+        keycmd.native_sync('')
+        self.assertEqual(self.sent(), ['bind sync'])
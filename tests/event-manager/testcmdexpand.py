@@ -0,0 +1,72 @@
+#!/usr/bin/env python
+# vi: set et ts=4:
+
+import unittest
+from uzbl.plugins.cmd_expand import CommandTemplate, cmd_expand, escape
+
+
+def reference_escape(str):
+    for (level, char) in [(3, '\\'), (2, "'"), (2, '"'), (1, '@')]:
+        str = str.replace(char, (level * '\\') + char)
+
+    return str
+
+
+def reference_cmd_expand(cmd, args):
+    '''The string replacing cmd_expand templates have to match.'''
+
+    args = list(map(str, args))
+
+    if '%s' in cmd:
+        cmd = cmd.replace('%s', ' '.join(args))
+
+    if '%r' in cmd:
+        cmd = cmd.replace('%r', "'%s'" % reference_escape(' '.join(args)))
+
+    idx_list = list(enumerate(args))
+    idx_list.reverse()
+    for (index, arg) in idx_list:
+        index += 1
+        if '%%%d' % index in cmd:
+            cmd = cmd.replace('%%%d' % index, str(arg))
+
+    return cmd
+
+
+COMMANDS = [
+    '', 'back', 'uri %s', 'set selected_uri %1', 'print %1 %2 %3',
+    "sh 'echo %r'", '%s%r%1', '%%s %%1 %', 'js alert(%1); %2 %10 %12',
+    '%0 %05 %1s %r1', 'print @keycmd %s \\@ok', '%123 %3%2%1',
+]
+
+# Arguments which, substituted in, don't form new slots with the text around
+# them: the reference would expand those again.
+ARGS = [
+    [], ['one'], ['a b', 'c'], list('abcdefghijklm'), [None, 2.5, 1],
+    ["it's", '"quoted"', 'back\\slash', '@var'], [u'大阪'],
+]
+
+
+class CmdExpandTest(unittest.TestCase):
+    def test_escape(self):
+        for arg in ARGS[5] + ['\\\'"@', '']:
+            self.assertEqual(escape(arg), reference_escape(arg))
+
+    def test_same_as_replace(self):
+        for cmd in COMMANDS:
+            template = CommandTemplate(cmd)
+            for args in ARGS:
+                expected = reference_cmd_expand(cmd, args)
+                self.assertEqual(template.expand(args), expected,
+                                 (cmd, args))
+                self.assertEqual(cmd_expand(cmd, args), expected)
+
+    def test_template_is_str(self):
+        template = CommandTemplate('uri %s')
+        self.assertEqual(template, 'uri %s')
+        self.assertIn(template, ['uri %s'])
+        self.assertEqual(CommandTemplate('back').expand(['x']), 'back')
+
+    def test_arguments_not_expanded(self):
+        # Text substituted into the command is not searched for slots again.
+        self.assertEqual(cmd_expand('print %s', ['%1']), 'print %1')
@@ -5,7 +5,7 @@
 from emtest import EventManagerMock
 from uzbl.plugins.config import Config
 from uzbl.plugins.keycmd import KeyCmd
-from uzbl.plugins.completion import CompletionPlugin
+from uzbl.plugins.completion import CompletionPlugin, Completions
 
 
 class DummyFormatter(object):
@@ -13,6 +13,35 @@ def format(self, partial, completions):
         return '[%s] %s' % (partial, ', '.join(sorted(completions)))
 
 
+class TestCompletions(unittest.TestCase):
+    def setUp(self):
+        self.completions = Completions()
+        self.completions.update(['spam', 'egg', 'bar', 'baz', 'ba'])
+
+    def test_prefix(self):
+        c = self.completions
+        self.assertEqual(c.prefix('b'), ['ba', 'bar', 'baz'])
+        self.assertEqual(c.prefix('baz'), ['baz'])
+        self.assertEqual(c.prefix('x'), [])
+        self.assertEqual(c.prefix(''), ['ba', 'bar', 'baz', 'egg', 'spam'])
+
+    def test_narrowing(self):
+        c = self.completions
+        self.assertEqual(c.prefix('b'), ['ba', 'bar', 'baz'])
+        self.assertEqual(c.prefix('bar'), ['bar'])
+        self.assertEqual(c.prefix('ba'), ['ba', 'bar', 'baz'])
+
+        # New words are seen by the next query
+        c.add('barn')
+        self.assertEqual(c.prefix('bar'), ['bar', 'barn'])
+
+    def test_common_prefix(self):
+        c = self.completions
+        self.assertEqual(c.common_prefix(c.prefix('b')), 'ba')
+        self.assertEqual(c.common_prefix(c.prefix('s')), 'spam')
+        self.assertEqual(c.common_prefix([]), '')
+
+
 class TestAdd(unittest.TestCase):
     def setUp(self):
         self.event_manager = EventManagerMock(
@@ -5,10 +5,11 @@
 if '' not in sys.path:
     sys.path.insert(0, '')
 
+import mock
 import unittest
 from emtest import EventManagerMock
 
-from uzbl.plugins.cookies import Cookies
+from uzbl.plugins.cookies import Cookies, CookieBroadcast, CookieMatcher
 from uzbl.plugins.config import Config
 
 cookies = (
@@ -26,7 +27,7 @@
 
 class CookieFilterTest(unittest.TestCase):
     def setUp(self):
-        self.event_manager = EventManagerMock((), (Cookies,),
+        self.event_manager = EventManagerMock((CookieBroadcast,), (Cookies,),
                                               plugin_config=config)
         self.uzbl = self.event_manager.add()
         self.other = self.event_manager.add()
@@ -34,9 +35,34 @@ def setUp(self):
     def test_add_cookie(self):
         c = Cookies[self.uzbl]
         c.add_cookie(cookies[0])
+        self.event_manager.run_deferred()
         self.other.send.assert_called_once_with(
             'cookie add ' + cookies[0])
 
+    def test_add_many_cookies(self):
+        c = Cookies[self.uzbl]
+        c.add_cookie(cookies[0])
+        c.add_cookie(cookies[1])
+        self.other.send.assert_not_called()
+        self.event_manager.run_deferred()
+        self.other.send.assert_called_once_with(
+            'cookie add_many ' + ' '.join(cookies))
+
+    def test_batch_keeps_order(self):
+        c = Cookies[self.uzbl]
+        c.add_cookie(cookies[0])
+        c.add_cookie(cookies[1])
+        c.delete_cookie(cookies[0])
+        c.delete_cookie(cookies[1])
+        c.add_cookie(cookies[0])
+        self.event_manager.run_deferred()
+        self.assertEqual(self.other.send.call_args_list, [
+            mock.call('cookie add_many ' + ' '.join(cookies)),
+            mock.call('cookie delete_many %s %s' % (
+                cookies[0].rsplit(' ', 2)[0], cookies[1].rsplit(' ', 2)[0])),
+            mock.call('cookie add ' + cookies[0]),
+        ])
+
     def test_whitelist_block(self):
         c = Cookies[self.uzbl]
         c.whitelist_cookie(r'domain "nyan\.cat$"')
@@ -48,6 +74,7 @@ def test_whitelist_accept(self):
         c = Cookies[self.uzbl]
         c.whitelist_cookie(r'domain "nyan\.cat$"')
         c.add_cookie(cookies[0])
+        self.event_manager.run_deferred()
         self.other.send.assert_called_once_with(
             'cookie add ' + cookies[0])
 
@@ -62,6 +89,7 @@ def test_blacklist_accept(self):
         c = Cookies[self.uzbl]
         c.blacklist_cookie(r'domain "twitter\.com$"')
         c.add_cookie(cookies[0])
+        self.event_manager.run_deferred()
         self.other.send.assert_called_once_with(
             'cookie add ' + cookies[0])
 
@@ -73,10 +101,54 @@ def test_filter_numeric(self):
             'cookie delete ' + cookies[1])
 
 
+class CookieMatcherTest(unittest.TestCase):
+    nyan = ('.nyan.cat', '/', '__utmb', '1', 'http', '')
+    twitter = ('.twitter.com', '/', 'guest_id', '2', 'https', '')
+
+    def test_empty(self):
+        m = CookieMatcher()
+        self.assertFalse(m)
+        self.assertFalse(m.match(self.nyan))
+
+    def test_merged_domains(self):
+        m = CookieMatcher()
+        m.add(r'domain "nyan\.cat$"')
+        m.add(r'domain "(^|\.)twitter\.com$"')
+        self.assertTrue(m.match(self.nyan))
+        self.assertTrue(m.match(self.twitter))
+        self.assertFalse(m.match(('example.com', '/', 'a', '', 'http', '')))
+
+    def test_multiple_components(self):
+        m = CookieMatcher()
+        m.add(r'domain "twitter\.com$" scheme "^http$"')
+        self.assertFalse(m.match(self.twitter))
+        m.add(r'domain "twitter\.com$" name "^guest"')
+        self.assertTrue(m.match(self.twitter))
+
+    def test_unmergeable(self):
+        m = CookieMatcher()
+        m.add(r'name "(?P<x>_)(?P=x)?utmb"')
+        m.add(r'name "(?P<x>guest)_id"')
+        m.add(r'domain "(?i)NYAN"')
+        self.assertTrue(m.match(self.nyan))
+        self.assertTrue(m.match(self.twitter))
+
+    def test_cache_invalidated(self):
+        m = CookieMatcher(cache_size=1)
+        m.add(r'domain "nyan\.cat$"')
+        self.assertFalse(m.match(self.twitter))
+        self.assertTrue(m.match(self.nyan))
+        self.assertFalse(m.match(self.twitter))
+        m.add(r'domain "twitter"')
+        self.assertTrue(m.match(self.twitter))
+        m.clear()
+        self.assertFalse(m.match(self.nyan))
+
+
 class PrivateCookieTest(unittest.TestCase):
     def setUp(self):
         self.event_manager = EventManagerMock(
-            (), (Cookies,),
+            (CookieBroadcast,), (Cookies,),
             (), ((Config, dict),),
             config
         )
@@ -89,6 +161,7 @@ def setUp(self):
     def test_does_not_send_from_private_uzbl(self):
         c = Cookies[self.priv]
         c.add_cookie(cookies[0])
+        self.event_manager.run_deferred()
 
         self.uzbl_a.send.assert_not_called()
         self.uzbl_b.send.assert_not_called()
@@ -96,6 +169,7 @@ def test_does_not_send_from_private_uzbl(self):
     def test_does_not_send_to_private_uzbl(self):
         c = Cookies[self.uzbl_a]
         c.add_cookie(cookies[0])
+        self.event_manager.run_deferred()
         self.priv.send.assert_not_called()
 
 
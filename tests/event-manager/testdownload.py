@@ -4,6 +4,7 @@
 
 import unittest
 from emtest import EventManagerMock
+from mock import call, patch
 
 from uzbl.plugins.config import Config
 from uzbl.plugins.downloads import Downloads
@@ -33,3 +34,124 @@ def test_clear_downloads(self):
         d.download_complete('foo')
         self.assertEqual(2, len(self.uzbl.send.call_args_list))
         self.assertEqual("set downloads ", self.uzbl.send.call_args_list[1][0][0])
+
+    def test_error_removes_download(self):
+        d = Downloads[self.uzbl]
+        d.download_started('/tmp/foo')
+        d.download_started('/tmp/bar')
+        d.download_error("file:///tmp/foo cancelled 0 'Cancelled while queued'")
+        self.assertEqual(list(d.active_downloads), ['/tmp/bar'])
+        self.assertEqual(list(d.fragments), ['/tmp/bar'])
+
+        d.download_error("file:///tmp/bar network 2 'Connection reset'")
+        self.assertEqual(d.fragments, {})
+        self.assertIn(call('set downloads '), self.uzbl.send.call_args_list)
+
+        # nothing is left to refresh, so the timer stops
+        self.event_manager.run_timers()
+        self.assertEqual(self.event_manager.timers, [])
+
+        # errors for unknown downloads are ignored
+        d.download_error("'' unknown 0 'No destination'")
+
+    def test_progress_is_deferred(self):
+        d = Downloads[self.uzbl]
+        d.download_started('foo')
+        d.download_started('bar')
+        self.uzbl.reset_mock()
+        d.last_update = None
+
+        d.download_progress('foo 0.5')
+        d.download_progress('foo 0.6')
+        self.uzbl.send.assert_not_called()
+
+        self.event_manager.run_deferred()
+        self.uzbl.send.assert_called_once_with(
+            'set downloads &#10;downloads: foo (60%) bar (0%)')
+
+    @patch('uzbl.plugins.downloads.time')
+    def test_progress_rate_limit(self, time):
+        time.time.return_value = 100.0
+        d = Downloads[self.uzbl]
+        d.download_started('foo')
+        self.uzbl.reset_mock()
+
+        time.time.return_value = 100.1
+        d.download_progress('foo 0.5')
+        self.event_manager.run_deferred()
+        self.uzbl.send.assert_not_called()
+
+        time.time.return_value = 101.0
+        d.download_progress('foo 0.6')
+        self.event_manager.run_deferred()
+        self.uzbl.send.assert_called_once_with(
+            'set downloads &#10;downloads: foo (60%)')
+
+    def test_unchanged_percentage_keeps_fragment(self):
+        d = Downloads[self.uzbl]
+        d.download_started('foo')
+        fragment = d.fragments['foo']
+        d.download_progress('foo 0.001')
+        self.assertIs(fragment, d.fragments['foo'])
+
+    @patch('uzbl.plugins.downloads.time')
+    def test_rate(self, time):
+        time.time.return_value = 100.0
+        d = Downloads[self.uzbl]
+        d.download_started('foo')
+        d.download_started('bar')
+        d.download_progress('foo 0.1 1000 10000')
+        d.download_progress('bar 0.1 3000 30000')
+
+        time.time.return_value = 102.0
+        d.download_progress('foo 0.2 2000 10000')
+        d.download_progress('bar 0.2 6000 30000')
+        self.uzbl.reset_mock()
+        self.event_manager.run_deferred()
+        self.assertIn(call('set downloads_rate 4000'),
+                      self.uzbl.send.call_args_list)
+
+        d.download_complete('foo')
+        d.download_complete('bar')
+        self.assertEqual(call('set downloads_rate 0'),
+                         self.uzbl.send.call_args)
+
+    @patch('uzbl.plugins.downloads.time')
+    def test_suppressed_progress_is_sent_later(self, time):
+        time.time.return_value = 100.0
+        d = Downloads[self.uzbl]
+        d.download_started('foo')
+        self.uzbl.reset_mock()
+
+        time.time.return_value = 100.1
+        d.download_progress('foo 0.5')
+        self.event_manager.run_deferred()
+        self.uzbl.send.assert_not_called()
+
+        time.time.return_value = 100.6
+        self.event_manager.run_timers()
+        self.uzbl.send.assert_called_once_with(
+            'set downloads &#10;downloads: foo (50%)')
+
+    @patch('uzbl.plugins.downloads.time')
+    def test_rate_drops_when_stalled(self, time):
+        time.time.return_value = 100.0
+        d = Downloads[self.uzbl]
+        d.download_started('foo')
+        d.download_progress('foo 0.1 1000 10000')
+
+        time.time.return_value = 101.0
+        d.download_progress('foo 0.2 2000 10000')
+        self.event_manager.run_deferred()
+        self.assertEqual(2000, d.rate)
+
+        self.uzbl.reset_mock()
+        time.time.return_value = 102.0
+        self.event_manager.run_timers()
+        self.assertIn(call('set downloads_rate 0'),
+                      self.uzbl.send.call_args_list)
+
+        d.download_complete('foo')
+        self.uzbl.reset_mock()
+        self.event_manager.run_timers()
+        self.uzbl.send.assert_not_called()
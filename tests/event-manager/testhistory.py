@@ -6,19 +6,118 @@
 if '' not in sys.path:
     sys.path.insert(0, '')
 
+import os
+import shutil
+import tempfile
 import unittest
 from emtest import EventManagerMock
 from six import next
 
-from uzbl.plugins.history import History, SharedHistory
+from uzbl.plugins.history import History, HistoryList, SharedHistory
 from uzbl.plugins.keycmd import Keylet, KeyCmd
 from uzbl.plugins.on_set import OnSetPlugin
 from uzbl.plugins.config import Config
 
 
+config = {
+    'history': {
+        'type': 'memory'
+    }
+}
+
+
+class HistoryListTest(unittest.TestCase):
+    def setUp(self):
+        self.lst = HistoryList()
+        for line in ('open uzbl.org', 'set zoom 1', 'open example.org',
+                     'js alert(1)', 'open uzbl.org/wiki'):
+            self.lst.append(line)
+
+    def test_find_prev(self):
+        self.assertEqual(self.lst.find_prev('uzbl', 4), 4)
+        self.assertEqual(self.lst.find_prev('uzbl', 3), 0)
+        self.assertEqual(self.lst.find_prev('open', 3), 2)
+        self.assertEqual(self.lst.find_prev('o', 1), 1)
+        self.assertIsNone(self.lst.find_prev('wiki', 3))
+        self.assertIsNone(self.lst.find_prev('nothing', 4))
+
+    def test_find_next(self):
+        self.assertEqual(self.lst.find_next('uzbl', 1), 4)
+        self.assertEqual(self.lst.find_next('.org', 0), 0)
+        self.assertEqual(self.lst.find_next('z', 1), 1)
+        self.assertIsNone(self.lst.find_next('zoom', 2))
+
+    def test_candidates_intersect(self):
+        # 'ope' and 'pen' are common, only line 2 has 'exa'
+        self.assertEqual(self.lst.candidates('open exa'), [2])
+        self.assertIsNone(self.lst.candidates('op'))
+
+    def test_matches_scan(self):
+        for key in ('open', 'pen ', 'org', 'g/w', 'xyz', 'js alert(1)'):
+            for start in range(len(self.lst)):
+                scan = [i for i in range(start + 1) if key in self.lst[i]]
+                self.assertEqual(self.lst.find_prev(key, start),
+                                 scan[-1] if scan else None)
+
+
+class PersistentHistoryTest(unittest.TestCase):
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.path = os.path.join(self.tmpdir, 'uzbl', 'history')
+        self.config = {'history': {'type': 'text', 'path': self.path,
+                                   'max_lines': '2'}}
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def test_save_and_load(self):
+        event_manager = EventManagerMock((SharedHistory,), (),
+                                         plugin_config=self.config)
+        s = SharedHistory[event_manager.add()]
+        s.addline('', 'open uzbl.org')
+        s.addline('git', 'spam\negg')
+
+        event_manager = EventManagerMock((SharedHistory,), (),
+                                         plugin_config=self.config)
+        s = SharedHistory[event_manager.add()]
+        self.assertEqual(s.get_line_number(''), 1)
+        self.assertEqual(s.getline('', 0), 'open uzbl.org')
+        self.assertEqual(s.getline('git', 0), 'spam\negg')
+        self.assertEqual(s.find_prev('git', 'egg', 0), 0)
+
+    def test_trim(self):
+        event_manager = EventManagerMock((SharedHistory,), (),
+                                         plugin_config=self.config)
+        s = SharedHistory[event_manager.add()]
+        for i in range(5):
+            s.addline('', 'line %d' % i)
+        with open(self.path) as f:
+            self.assertEqual(len(f.readlines()), 2)
+
+        event_manager = EventManagerMock((SharedHistory,), (),
+                                         plugin_config=self.config)
+        s = SharedHistory[event_manager.add()]
+        self.assertEqual(s.getline('', 0), 'line 3')
+        self.assertEqual(s.getline('', 1), 'line 4')
+
+    def test_memory_by_default(self):
+        event_manager = EventManagerMock((SharedHistory,), ())
+        s = SharedHistory[event_manager.add()]
+        self.assertIsNone(s.path)
+
+    def test_lazy_load(self):
+        event_manager = EventManagerMock((SharedHistory,), (),
+                                         plugin_config=self.config)
+        s = SharedHistory[event_manager.add()]
+        self.assertIsNone(s._history)
+        self.assertEqual(s.get_line_number(''), 0)
+        self.assertIsNotNone(s._history)
+
+
 class SharedHistoryTest(unittest.TestCase):
     def setUp(self):
-        self.event_manager = EventManagerMock((SharedHistory,), ())
+        self.event_manager = EventManagerMock((SharedHistory,), (),
+                                              plugin_config=config)
         self.uzbl = self.event_manager.add()
         self.other = self.event_manager.add()
 
@@ -55,7 +154,8 @@ class HistoryTest(unittest.TestCase):
     def setUp(self):
         self.event_manager = EventManagerMock(
             (SharedHistory,),
-            (OnSetPlugin, KeyCmd, Config, History)
+            (OnSetPlugin, KeyCmd, Config, History),
+            plugin_config=config
         )
         self.uzbl = self.event_manager.add()
         self.other = self.event_manager.add()
@@ -113,6 +213,14 @@ def test_exec(self):
         s = SharedHistory[self.uzbl]
         self.assertEqual(s.getline('', -1), 'foo')
 
+    def test_exec_private(self):
+        Config[self.uzbl].data['enable_private'] = 1
+        keylet = Keylet()
+        keylet.set_keycmd('secret')
+        History[self.uzbl].keycmd_exec(set(), keylet)
+        s = SharedHistory[self.uzbl]
+        self.assertEqual(s.getline('', -1), 'foo')
+
     def test_exec_from_history(self):
         h = History[self.uzbl]
         self.assertEqual('foo', h.prev())
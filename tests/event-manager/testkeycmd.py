@@ -1,15 +1,29 @@
 #!/usr/bin/env python
 
-import re
 import mock
 import unittest
 from emtest import EventManagerMock
+from uzbl.arguments import splitquoted
 from uzbl.plugins.keycmd import KeyCmd
 from uzbl.plugins.config import Config
 
 
-def getkeycmd(s):
-    return re.match(r'@\[([^\]]*)\]@', s).group(1)
+def getkeycmd(uzbl):
+    '''Replay the keycmd commands sent to uzbl-core, returning the keycmd
+    and cursor position it ends up with.'''
+
+    keycmd, cursor = '', 0
+    for call in uzbl.send.call_args_list:
+        args = splitquoted(call[0][0])
+        if args[0] != 'keycmd':
+            continue
+        if args[1] == 'clear':
+            keycmd, cursor = '', 0
+            continue
+        pos, count, cursor = int(args[2]), int(args[3]), int(args[4])
+        text = args[5] if len(args) > 5 else ''
+        keycmd = keycmd[:pos] + text + keycmd[pos + count:]
+    return keycmd, cursor
 
 
 class KeyCmdTest(unittest.TestCase):
@@ -24,8 +38,7 @@ def test_press_key(self):
         c, k = Config[self.uzbl], KeyCmd[self.uzbl]
         k.key_press(('', 'a'))
         self.assertEqual(c.get('modcmd', ''), '')
-        keycmd = getkeycmd(c['keycmd'])
-        self.assertEqual(keycmd, 'a')
+        self.assertEqual(getkeycmd(self.uzbl), ('a', 1))
 
     def test_press_keys(self):
         c, k = Config[self.uzbl], KeyCmd[self.uzbl]
@@ -33,8 +46,7 @@ def test_press_keys(self):
         for char in string:
             k.key_press(('', char))
         self.assertEqual(c.get('modcmd', ''), '')
-        keycmd = getkeycmd(c['keycmd'])
-        self.assertEqual(keycmd, string)
+        self.assertEqual(getkeycmd(self.uzbl), (string, len(string)))
 
     def test_press_unicode_keys(self):
         c, k = Config[self.uzbl], KeyCmd[self.uzbl]
@@ -42,5 +54,44 @@ def test_press_unicode_keys(self):
         for char in string:
             k.key_press(('', char))
         self.assertEqual(c.get('modcmd', ''), '')
-        keycmd = getkeycmd(c['keycmd'])
-        self.assertEqual(keycmd, string)
+        self.assertEqual(getkeycmd(self.uzbl), (string, len(string)))
+
+    def test_quoting(self):
+        k = KeyCmd[self.uzbl]
+        string = "it's @a\\b c"
+        for char in string:
+            k.key_press(('', 'space' if char == ' ' else char))
+        self.assertEqual(getkeycmd(self.uzbl), (string, len(string)))
+
+    def test_deltas(self):
+        k = KeyCmd[self.uzbl]
+        for char in 'uzbl':
+            k.key_press(('', char))
+        self.uzbl.send.reset_mock()
+        k.core_keycmd = ('', 0)
+
+        k.set_cursor_pos('2')
+        k.keycmd_backspace()
+        k.key_press(('', 'x'))
+        self.assertEqual(self.uzbl.send.call_args_list, [
+            mock.call("keycmd splice 0 0 2 'uzbl'"),
+            mock.call('keycmd splice 1 1 1'),
+            mock.call("keycmd splice 1 0 2 'x'"),
+        ])
+
+        k.clear_keycmd()
+        self.uzbl.send.assert_called_with('keycmd clear')
+        self.assertEqual(getkeycmd(self.uzbl), ('', 0))
+
+    def test_variable_set(self):
+        c, k = Config[self.uzbl], KeyCmd[self.uzbl]
+        c['cursor_style'] = 'underline="single"'
+        k.key_press(('', '&'))
+        event, args = self.uzbl.event.call_args[0]
+        self.assertEqual(event, 'VARIABLE_SET')
+        self.assertEqual(splitquoted(args),
+                         ('keycmd', 'str', '&amp;<span underline="single"> </span>'))
+
+        k.clear_keycmd()
+        self.assertIn(mock.call('VARIABLE_SET', 'keycmd str'),
+                      self.uzbl.event.call_args_list)
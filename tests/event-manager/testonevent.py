@@ -54,3 +54,14 @@ def test_parse_pattern(self):
         self.assertIn(event, oe.events)
         commands = oe.events[event]
         self.assertIn((command, [pattern]), commands)
+
+    def test_glob_pattern(self):
+        oe = OnEventPlugin[self.uzbl]
+        event, pattern, command = 'FOO', ['B?R', 'e*'], 'test %2'
+
+        oe.on_event(event, pattern, command)
+        oe.event_handler('BAZ else', on_event=event)
+        oe.event_handler('BAR', on_event=event)
+        self.assertFalse(self.uzbl.send.called)
+        oe.event_handler('BAR else', on_event=event)
+        self.uzbl.send.assert_called_once_with('test else')
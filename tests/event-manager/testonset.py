@@ -0,0 +1,45 @@
+#!/usr/bin/env python
+# vi: set et ts=4:
+
+import unittest
+from emtest import EventManagerMock
+from uzbl.plugins.on_set import OnSetPlugin
+
+
+class OnSetTest(unittest.TestCase):
+    def setUp(self):
+        self.event_manager = EventManagerMock(
+            (), (OnSetPlugin,),
+        )
+        self.uzbl = self.event_manager.add()
+
+    def test_literal(self):
+        o = OnSetPlugin[self.uzbl]
+        o.parse_on_set('uri print %1 is %2')
+        o.check_for_handlers('uri', 'http://uzbl.org/')
+        o.check_for_handlers('uris', 'http://uzbl.org/')
+        self.uzbl.send.assert_called_once_with('print uri is http://uzbl.org/')
+        self.assertIn('uri', o.literal)
+        self.assertEqual(o.wildcards, [])
+
+    def test_wildcard(self):
+        o = OnSetPlugin[self.uzbl]
+        o.parse_on_set('status_* print %1')
+        o.check_for_handlers('status_format', '')
+        o.check_for_handlers('status.format', '')
+        self.uzbl.send.assert_called_once_with('print status_format')
+
+    def test_dots(self):
+        o = OnSetPlugin[self.uzbl]
+        o.parse_on_set('a.* print %1')
+        o.check_for_handlers('axb', '')
+        self.assertFalse(self.uzbl.send.called)
+        o.check_for_handlers('a.b', '')
+        self.uzbl.send.assert_called_once_with('print a.b')
+
+    def test_callable(self):
+        o, calls = OnSetPlugin[self.uzbl], []
+        o.on_set('mode', lambda uzbl, key, arg: calls.append((key, arg)))
+        o.on_set('mo*', lambda key, arg: calls.append(arg), False)
+        o.check_for_handlers('mode', 'insert')
+        self.assertEqual(calls, [('mode', 'insert'), 'insert'])
@@ -0,0 +1,154 @@
+#!/usr/bin/env python
+
+
+import sys
+if '' not in sys.path:
+    sys.path.insert(0, '')
+
+import json
+import os
+import shutil
+import tempfile
+import unittest
+from emtest import EventManagerMock
+
+from uzbl.plugins.config import Config
+from uzbl.plugins.url_history import UrlHistory, UrlHistoryStore, uri_key
+
+config = {
+    'url_history': {
+        'path': ':memory:'
+    }
+}
+
+DAY = 86400
+
+
+class UrlHistoryStoreTest(unittest.TestCase):
+    def setUp(self):
+        self.store = UrlHistoryStore(':memory:', 30 * DAY)
+
+    def tearDown(self):
+        self.store.close()
+
+    def test_uri_key(self):
+        self.assertEqual(uri_key('https://www.Uzbl.org/wiki'), 'uzbl.org/wiki')
+        self.assertEqual(uri_key('file:///tmp/a'), '/tmp/a')
+        self.assertEqual(uri_key('uzbl.org'), 'uzbl.org')
+
+    def test_prefix(self):
+        self.store.visit('http://www.uzbl.org/', 'Uzbl', now=0)
+        self.store.visit('https://uzbl.org/wiki', 'Wiki', now=0)
+        self.store.visit('https://example.org/', 'Example', now=0)
+        uris = [uri for uri, _ in self.store.prefix('uzbl')]
+        self.assertEqual(sorted(uris),
+                         ['http://www.uzbl.org/', 'https://uzbl.org/wiki'])
+        self.assertEqual(self.store.prefix('https://www.uzbl.org/w'),
+                         [('https://uzbl.org/wiki', 'Wiki')])
+        self.assertEqual(self.store.prefix('nothing'), [])
+
+    def test_frecency(self):
+        for i in range(3):
+            self.store.visit('http://often.org/', now=i)
+        self.store.visit('http://once.org/', now=3)
+        self.assertEqual(self.store.prefix('o')[0][0], 'http://often.org/')
+
+        # a single visit now beats three visits a year ago
+        self.store.visit('http://once.org/', now=365 * DAY)
+        self.assertEqual(self.store.prefix('o')[0][0], 'http://once.org/')
+
+    def test_fuzzy(self):
+        self.store.visit('http://uzbl.org/wiki/keybindings', now=0)
+        self.store.visit('http://example.org/', 'Some wiki', now=0)
+        self.store.visit('http://example.org/100%', now=0)
+        uris = sorted(uri for uri, _ in self.store.fuzzy('wk'))
+        self.assertEqual(uris, ['http://example.org/',
+                                'http://uzbl.org/wiki/keybindings'])
+        self.assertEqual(self.store.fuzzy('0%'),
+                         [('http://example.org/100%', '')])
+        self.assertEqual(self.store.fuzzy('zz'), [])
+
+
+class UrlHistoryTest(unittest.TestCase):
+    def setUp(self):
+        self.event_manager = EventManagerMock(
+            (UrlHistory,), (Config,), plugin_config=config)
+        self.uzbl = self.event_manager.add()
+        self.history = UrlHistory[self.uzbl]
+
+    def load(self, uri, title=None):
+        self.history.load_commit(self.uzbl, "'%s'" % uri)
+        if title is not None:
+            self.history.title_changed(self.uzbl, "'%s'" % title)
+        self.history.load_finish(self.uzbl, "'%s'" % uri)
+
+    def query(self, args):
+        response, _, _ = self.history.query(self.uzbl, None, args, cookie='1')
+        return response
+
+    def test_record_and_query(self):
+        self.load('http://uzbl.org/', 'Uzbl')
+        self.load('about:blank')
+        self.assertEqual(json.loads(self.query('prefix uzbl')),
+                         [['http://uzbl.org/', 'Uzbl']])
+        self.assertEqual(json.loads(self.query('fuzzy "" 10')),
+                         [['http://uzbl.org/', 'Uzbl']])
+
+    def test_late_title(self):
+        self.load('http://uzbl.org/')
+        self.history.title_changed(self.uzbl, "'Uzbl'")
+        self.assertEqual(json.loads(self.query('prefix uzbl')),
+                         [['http://uzbl.org/', 'Uzbl']])
+
+    def test_private(self):
+        Config[self.uzbl].data['enable_private'] = 1
+        self.load('http://uzbl.org/', 'Uzbl')
+        self.assertEqual(json.loads(self.query('prefix uzbl')), [])
+
+    def test_bad_query(self):
+        self.assertIsNone(self.query('prefix'))
+        self.assertIsNone(self.query('nonsense uzbl'))
+
+    def test_bad_limit(self):
+        self.load('http://uzbl.org/', 'Uzbl')
+        self.assertEqual(json.loads(self.query('prefix uzbl x')),
+                         [['http://uzbl.org/', 'Uzbl']])
+
+    def test_batched_commits(self):
+        self.load('http://uzbl.org/', 'Uzbl')
+        self.load('http://example.org/', 'Example')
+        self.assertTrue(self.history.store.db.in_transaction)
+        self.assertEqual(len(self.event_manager.timers), 1)
+
+        self.event_manager.run_timers()
+        self.assertFalse(self.history.store.db.in_transaction)
+        self.assertEqual(json.loads(self.query('prefix uzbl')),
+                         [['http://uzbl.org/', 'Uzbl']])
+
+
+class UrlHistoryFileTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        self.path = os.path.join(self.dir, 'uzbl', 'history.db')
+        self.event_manager = EventManagerMock(
+            (UrlHistory,), (Config,),
+            plugin_config={'url_history': {'path': self.path}})
+        self.uzbl = self.event_manager.add()
+        self.history = UrlHistory[self.uzbl]
+
+    def tearDown(self):
+        self.history.cleanup()
+        shutil.rmtree(self.dir)
+
+    def test_created_on_first_visit(self):
+        response, _, _ = self.history.query(self.uzbl, None, 'prefix uzbl',
+                                            cookie='1')
+        self.assertEqual(json.loads(response), [])
+        self.assertFalse(os.path.exists(self.path))
+
+        self.history.load_finish(self.uzbl, "'http://uzbl.org/'")
+        self.assertTrue(os.path.exists(self.path))
+
+
+if __name__ == '__main__':
+    unittest.main()
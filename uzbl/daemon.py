@@ -1,5 +1,8 @@
 import logging
 import asyncore
+import heapq
+import itertools
+import time
 from uzbl.net import Listener, Protocol
 from uzbl.core import Uzbl
 
@@ -37,6 +40,14 @@ def __init__(self, plugind, config, server_socket, auto_close=False,
         self._plugin_instances = []
         self._quit = False
 
+        # Callbacks to run after the current batch of socket events
+        self._deferred = []
+
+        # Callbacks to run once their time has come
+        # [(due time, sequence number, callback), ..]
+        self._timers = []
+        self._timer_ids = itertools.count()
+
         # Hold uzbl instances
         # {child socket: Uzbl instance, ..}
         self.uzbls = {}
@@ -69,13 +80,45 @@ def run(self):
 
         logger.debug('entering main loop')
 
-        asyncore.loop()
+        while asyncore.socket_map:
+            asyncore.loop(timeout=self.next_timeout(), count=1)
+            self.run_deferred()
 
         # Clean up and exit
         self.quit()
 
         logger.debug('exiting main loop')
 
+    def defer(self, callback, delay=None):
+        '''Call `callback` once all socket events that are ready in the
+        current main loop iteration have been handled. With `delay`, wait
+        at least that many seconds first.'''
+        if delay is None:
+            self._deferred.append(callback)
+        else:
+            heapq.heappush(self._timers,
+                           (time.time() + delay, next(self._timer_ids), callback))
+
+    def next_timeout(self):
+        '''How long the main loop may wait for socket events.'''
+        if self._deferred:
+            return 0
+        if not self._timers:
+            return 30.0
+        return min(30.0, max(0, self._timers[0][0] - time.time()))
+
+    def run_deferred(self):
+        '''Run the callbacks registered with `defer` which are due.'''
+        deferred, self._deferred = self._deferred, []
+        now = time.time()
+        while self._timers and self._timers[0][0] <= now:
+            deferred.append(heapq.heappop(self._timers)[2])
+        for callback in deferred:
+            try:
+                callback()
+            except Exception:
+                logger.error('error in deferred callback', exc_info=True)
+
     def add_instance(self, sock):
         proto = Protocol(sock)
         uzbl = Uzbl(self, proto, self.print_events)
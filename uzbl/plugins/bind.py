@@ -12,15 +12,15 @@
 import six
 import sys
 import re
+from collections import defaultdict
 from functools import partial
 from itertools import count
 
 from uzbl.arguments import unquote, splitquoted
 from uzbl.ext import PerInstancePlugin
-from .cmd_expand import cmd_expand
+from .cmd_expand import CommandTemplate, cmd_expand
 from .config import Config
-from .keycmd import KeyCmd
-import collections
+from .keycmd import KeyCmd, uzbl_quote
 
 # Commonly used regular expressions.
 MOD_START = re.compile('^<([A-Z][A-Za-z0-9-_]*)>').match
@@ -32,16 +32,104 @@
 # For accessing a bind glob stack.
 ON_EXEC, HAS_ARGS, MOD_CMD, GLOB, MORE = list(range(5))
 
+# Modifiers as uzbl-core names them, in the order it lists them.
+CORE_MODIFIERS = ['Shift', 'ScrollLock', 'Ctrl', 'Mod1', 'Mod3', 'Mod4', 'Mod5']
+
 
 # Custom errors.
 class ArgumentError(Exception): pass
 
 
+class BindTrie(object):
+    '''The binds of one mode (or of a stack level) indexed on the keys they
+    match at a given depth.
+
+    Binds matching the whole command live in a dict keyed on that command and
+    binds taking arguments in a character trie of their prefix, both split by
+    modkeys and exec/update. Looking up the candidates for a keycmd therefore
+    walks at most len(keycmd) trie nodes however many binds there are.'''
+
+    def __init__(self, depth=0):
+        self.depth = depth
+        self.binds = {}
+        self.order = {}
+        self.exact = {}
+        self.prefix = {}
+
+
+    def _slot(self, bind):
+        (on_exec, has_args, mods, keys, more) = bind[self.depth]
+        return (bool(mods), frozenset(mods), on_exec), has_args, keys
+
+
+    def add(self, name, bind):
+        '''Insert (or override) a bind. A None bind masks the name.'''
+
+        self.remove(name)
+        if name not in self.order:
+            self.order[name] = len(self.order)
+
+        self.binds[name] = bind
+        if bind is None:
+            return
+
+        slot, has_args, keys = self._slot(bind)
+        if not has_args:
+            self.exact.setdefault((slot, keys), set()).add(name)
+            return
+
+        node = self.prefix.setdefault(slot, ({}, set()))
+        for char in keys:
+            node = node[0].setdefault(char, ({}, set()))
+
+        node[1].add(name)
+
+
+    def remove(self, name):
+        bind = self.binds.get(name)
+        if bind is None:
+            return
+
+        slot, has_args, keys = self._slot(bind)
+        if not has_args:
+            self.exact[(slot, keys)].discard(name)
+            return
+
+        node = self.prefix[slot]
+        for char in keys:
+            node = node[0][char]
+
+        node[1].discard(name)
+
+
+    def lookup(self, mod_cmd, modstate, on_exec, cmd):
+        '''Return the names of the binds which may match cmd.'''
+
+        slot = (mod_cmd, frozenset(modstate or ()) if mod_cmd else frozenset(),
+                on_exec)
+        names = list(self.exact.get((slot, cmd), ()))
+
+        node = self.prefix.get(slot)
+        for char in cmd:
+            if node is None:
+                break
+
+            names.extend(node[1])
+            node = node[0].get(char)
+
+        else:
+            if node is not None:
+                names.extend(node[1])
+
+        return names
+
+
 class Bindlet(object):
     '''Per-instance bind status/state tracker.'''
 
     def __init__(self, uzbl):
         self.binds = {'global': {}}
+        self.tries = {'global': BindTrie()}
         self.uzbl = uzbl
         self.uzbl_config = Config[uzbl]
         self.depth = 0
@@ -49,6 +137,7 @@ def __init__(self, uzbl):
         self.last_mode = None
         self.after_cmds = None
         self.stack_binds = []
+        self.stack_trie = None
 
         # A subset of the global mode binds containing non-stack and modkey
         # activiated binds for use in the stack mode.
@@ -66,6 +155,7 @@ def reset(self):
         self.args = []
         self.after_cmds = None
         self.stack_binds = []
+        self.stack_trie = None
 
         if self.last_mode:
             mode, self.last_mode = self.last_mode, None
@@ -80,6 +170,7 @@ def stack(self, bind, args, depth):
         if self.depth != depth:
             if bind not in self.stack_binds:
                 self.stack_binds.append(bind)
+                self.stack_trie = None
 
             return
 
@@ -89,6 +180,7 @@ def stack(self, bind, args, depth):
             self.uzbl_config['mode'] = 'stack'
 
         self.stack_binds = [bind,]
+        self.stack_trie = None
         self.args += args
         self.depth += 1
         self.after_cmds = bind.prompts[depth]
@@ -134,18 +226,59 @@ def get_binds(self, mode=None):
         return [_f for _f in list(binds.values()) if _f]
 
 
+    def candidates(self, mod_cmd, on_exec, modstate, keylet, mode=None):
+        '''Return the binds which may match the keylet, in the order
+        get_binds would list them.'''
+
+        cmd = keylet.modcmd if mod_cmd else keylet.keycmd
+
+        if self.depth:
+            trie = self.stack_trie
+            if trie is None:
+                trie = self.stack_trie = BindTrie(self.depth)
+                for bind in self.stack_binds + self.globals:
+                    trie.add(bind.bid, bind)
+
+            names = trie.lookup(mod_cmd, modstate, on_exec, cmd)
+            return [trie.binds[n] for n in sorted(names, key=trie.order.get)]
+
+        if mode is None:
+            mode = self.uzbl_config.get('mode', None)
+
+        # Mode binds override global binds of the same glob but keep their
+        # place, as in the dict merge done by get_binds.
+        found = []
+        globals = self.tries['global']
+        trie = self.tries.get(mode) if mode != 'global' else None
+        for name in globals.lookup(mod_cmd, modstate, on_exec, cmd):
+            if trie is None or name not in trie.binds:
+                found.append(((0, globals.order[name]), globals.binds[name]))
+
+        if trie is not None:
+            for name in trie.lookup(mod_cmd, modstate, on_exec, cmd):
+                if name in globals.order:
+                    found.append(((0, globals.order[name]), trie.binds[name]))
+                else:
+                    found.append(((1, trie.order[name]), trie.binds[name]))
+
+        found.sort(key=lambda item: item[0])
+        return [bind for (order, bind) in found]
+
+
     def add_bind(self, mode, glob, bind=None):
         '''Insert (or override) a bind into the mode bind dict.'''
 
         if mode not in self.binds:
-            self.binds[mode] = {glob: bind}
-            return
+            self.binds[mode] = {}
+            self.tries[mode] = BindTrie()
 
         binds = self.binds[mode]
         binds[glob] = bind
+        self.tries[mode].add(glob, bind)
 
         if mode == 'global':
             # Regen the global-globals list.
+            self.stack_trie = None
             self.globals = []
             for bind in list(binds.values()):
                 if bind is not None and bind.is_global:
@@ -181,7 +314,7 @@ class Bind(object):
     nextid = count()
 
     def __init__(self, glob, handler, *args, **kargs):
-        self.is_callable = isinstance(handler, collections.Callable)
+        self.is_callable = callable(handler)
         self._repr_cache = None
 
         if not glob:
@@ -196,10 +329,11 @@ def __init__(self, glob, handler, *args, **kargs):
             raise ArgumentError('cannot supply kargs for uzbl commands')
 
         elif not isinstance(handler, str):
-            self.commands = handler
+            self.commands = list(map(CommandTemplate, handler))
 
         else:
-            self.commands = [handler,] + list(args)
+            commands = [handler,] + list(args)
+            self.commands = list(map(CommandTemplate, commands))
 
         self.glob = glob
 
@@ -288,6 +422,15 @@ def __init__(self, uzbl):
 
         self.bindlet = Bindlet(uzbl)
 
+        # Single keystroke binds may be run by uzbl-core itself, sparing the
+        # round trip through the event manager for every key press.
+        self.native = self.plugin_config.get('native', '0') == '1'
+        self.native_table = {}
+        self.native_globs = {}
+        self.native_index = defaultdict(set)
+        if self.native:
+            uzbl.connect('BIND_EXECUTED', self.native_executed)
+
         uzbl.connect('BIND', self.parse_bind)
         uzbl.connect('MODE_BIND', self.parse_mode_bind)
         uzbl.connect('MODE_CHANGED', self.mode_changed)
@@ -334,7 +477,7 @@ def mode_bind(self, modes, glob, handler=None, *args, **kargs):
         # Sort and filter binds.
         modes = [_f for _f in map(str.strip, modes) if _f]
 
-        if isinstance(handler, collections.Callable) or (handler is not None and handler.strip()):
+        if callable(handler) or (handler is not None and handler.strip()):
             bind = Bind(glob, handler, *args, **kargs)
 
         else:
@@ -349,9 +492,147 @@ def mode_bind(self, modes, glob, handler=None, *args, **kargs):
                 mode, bind = mode[1:], None
 
             bindlet.add_bind(mode, glob, bind)
+            if self.native:
+                self.native_update(mode, glob, bind)
             self.uzbl.event('ADDED_MODE_BIND', mode, glob, bind)
         self.logger.info('added bind %s %s %s', mode, glob, bind)
 
+    def native_strokes(self, bind):
+        '''Return the first keystroke of a bind as (modifiers, key) pairs named
+        like uzbl-core does, one for each key which modmaps to it. The key is
+        None for binds which take any key.'''
+
+        keycmd = KeyCmd[self.uzbl]
+
+        def raw_names(name):
+            names = [raw for (raw, mapped) in keycmd.modmaps.items()
+                     if mapped == name]
+            if keycmd.modmap_key(name) == name:
+                names.append(name)
+            return [n if len(n) == 1 else '<%s>' % n for n in names]
+
+        (on_exec, has_args, mods, keys, more) = bind[0]
+        modifiers, named = set(), []
+        for mod in mods:
+            names = raw_names(mod[1:-1])
+            core = [n for n in names if n[1:-1] in CORE_MODIFIERS]
+            if core:
+                modifiers.add(core[0][1:-1])
+            else:
+                named.append(names)
+
+        prefix = ''.join('<%s>' % m for m in CORE_MODIFIERS if m in modifiers)
+        if keys and not named:
+            return [(prefix, key) for key in raw_names(keys[0])]
+
+        elif not keys and len(named) == 1:
+            return [(prefix, key) for key in named[0]]
+
+        elif not keys and not named and has_args:
+            return [(prefix, None)]
+
+        return []
+
+    def native_eligible(self, bind):
+        '''Return True if uzbl-core can run the bind by itself.'''
+
+        if bind.is_callable or len(bind.stack) != 1 or bind.prompts:
+            return False
+
+        (on_exec, has_args, mods, keys, more) = bind.stack[0]
+        return (not on_exec and not has_args and len(keys) <= 1 and
+                len(bind.commands) == 1)
+
+    def native_entry(self, mode, prefix, key):
+        '''Return the bind uzbl-core should run for a keystroke in a mode,
+        None if it must send the keystroke to the event manager or False if
+        the mode has no entry for it.'''
+
+        binds, index = self.bindlet.binds, self.native_index
+        own = binds.get(mode, {})
+        globs = index.get((mode, prefix, key), set()) | \
+            index.get((mode, prefix, None), set())
+
+        if mode != 'global':
+            if not globs:
+                return False
+
+            for glob in index.get(('global', prefix, key), set()) | \
+                    index.get(('global', prefix, None), set()):
+                if glob not in own:
+                    globs.add(glob)
+
+        active = [own[g] if g in own else binds['global'][g] for g in globs]
+        active = [bind for bind in active if bind is not None]
+
+        if len(active) == 1 and self.native_eligible(active[0]):
+            return active[0]
+
+        elif not active and mode == 'global':
+            return False
+
+        return None
+
+    def native_update(self, mode, glob, bind):
+        '''Update the native bind table of uzbl-core after a bind changed.'''
+
+        if bind is None:
+            try:
+                strokes = self.native_strokes(Bind(glob, 'native'))
+            except (ArgumentError, SyntaxError):
+                strokes = []
+        else:
+            strokes = self.native_strokes(bind)
+
+        old = self.native_globs.pop((mode, glob), [])
+        for stroke in old:
+            self.native_index[(mode,) + stroke].discard(glob)
+
+        self.native_globs[(mode, glob)] = strokes
+        for stroke in strokes:
+            self.native_index[(mode,) + stroke].add(glob)
+
+        # Keystrokes taking any key affect every key with the same modifiers.
+        changed = set(old) | set(strokes)
+        for (prefix, key) in list(changed):
+            if key is None:
+                changed.update((p, k) for (m, p, k) in self.native_index
+                               if p == prefix and k is not None)
+
+        changed = sorted(stroke for stroke in changed if stroke[1] is not None)
+        modes = list(self.bindlet.binds) if mode == 'global' else [mode]
+        for m in modes:
+            for (prefix, key) in changed:
+                self.native_refresh(m, prefix, key)
+
+    def native_refresh(self, mode, prefix, key):
+        keystroke = prefix + key
+        entry = self.native_entry(mode, prefix, key)
+        if self.native_table.get((mode, keystroke), False) is entry:
+            return
+
+        args = '%s %s' % (uzbl_quote(mode), uzbl_quote(keystroke))
+        if entry is False:
+            del self.native_table[(mode, keystroke)]
+            self.uzbl.send('bind remove %s' % args)
+            return
+
+        self.native_table[(mode, keystroke)] = entry
+        KeyCmd[self.uzbl].native_binds = True
+        if entry is None:
+            self.uzbl.send('bind mask %s' % args)
+        else:
+            command = cmd_expand(entry.commands[0], [])
+            self.uzbl.send('bind add %s %s' % (args, uzbl_quote(command)))
+
+    def native_executed(self, args):
+        '''Handle BIND_EXECUTED events raised when uzbl-core ran a bind.'''
+
+        mode, keystroke = splitquoted(args)[:2]
+        bind = self.native_table.get((mode, keystroke))
+        if bind is not None:
+            self.uzbl.event('EXEC_BIND', bind, (), {})
+
     def bind(self, glob, handler, *args, **kargs):
         '''Legacy bind function.'''
 
@@ -447,11 +728,7 @@ def match_and_exec(self, bind, depth, modstate, keylet, bindlet):
     def key_event(self, modstate, keylet, mod_cmd=False, on_exec=False):
         bindlet = self.bindlet
         depth = bindlet.depth
-        for bind in bindlet.get_binds():
-            t = bind[depth]
-            if (bool(t[MOD_CMD]) != mod_cmd) or (t[ON_EXEC] != on_exec):
-                continue
-
+        for bind in bindlet.candidates(mod_cmd, on_exec, modstate, keylet):
             if self.match_and_exec(bind, depth, modstate, keylet, bindlet):
                 return
 
@@ -1,8 +1,81 @@
+import re
+
+ESCAPES = {'\\': 4 * '\\', "'": "\\\\'", '"': '\\\\"', '@': '\\@'}
+FIND_ESCAPES = re.compile(r'[\\\'"@]').sub
+
+# %s, %r and %n with n > 0
+FIND_SLOTS = re.compile(r'%(s|r|[1-9][0-9]*)')
+
+
 def escape(str):
-    for (level, char) in [(3, '\\'), (2, "'"), (2, '"'), (1, '@')]:
-        str = str.replace(char, (level * '\\') + char)
+    return FIND_ESCAPES(lambda match: ESCAPES[match.group()], str)
+
+
+class CommandTemplate(str):
+    '''A command string split into literal text and the %s, %r and %n slots
+    cmd_expand fills in, so expanding it is a single join.
+
+    %n is the longest run of digits naming an argument: with 3 arguments
+    "%12" expands to the first argument followed by "2", and to "%12" when
+    there are none.'''
+
+    def __new__(cls, cmd):
+        self = str.__new__(cls, cmd)
+        self.parts = []
+
+        last = 0
+        for match in FIND_SLOTS.finditer(cmd):
+            if match.start() > last:
+                self.parts.append(cmd[last:match.start()])
+
+            slot = match.group(1)
+            if slot in ('s', 'r'):
+                self.parts.append((slot, None))
+            else:
+                # Argument indexes of the prefixes of the digits, longest first
+                indexes = [(int(slot[:i]) - 1, slot[i:])
+                           for i in range(len(slot), 0, -1)]
+                self.parts.append((match.group(), indexes))
+
+            last = match.end()
+
+        if last < len(cmd):
+            self.parts.append(cmd[last:])
 
-    return str
+        self.has_slots = last > 0
+        return self
+
+    def expand(self, args):
+        if not self.has_slots:
+            return str(self)
+
+        # Ensure (1) all string representable and (2) correct string encoding.
+        args = list(map(str, args))
+        nargs = len(args)
+
+        result = []
+        for part in self.parts:
+            if not isinstance(part, tuple):
+                result.append(part)
+                continue
+
+            slot, indexes = part
+            if slot == 's':
+                result.append(' '.join(args))
+
+            elif slot == 'r':
+                result.append("'%s'" % escape(' '.join(args)))
+
+            else:
+                for (index, rest) in indexes:
+                    if index < nargs:
+                        result.append(args[index])
+                        result.append(rest)
+                        break
+                else:
+                    result.append(slot)
+
+        return ''.join(result)
 
 
 def cmd_expand(cmd, args):
@@ -14,25 +87,11 @@ def cmd_expand(cmd, args):
         %1 = replace('%1', arg[0])
         %2 = replace('%2', arg[1])
         %n = replace('%n', arg[n-1])
-    '''
-
-    # Ensure (1) all string representable and (2) correct string encoding.
-    args = list(map(str, args))
 
-    # Direct string replace.
-    if '%s' in cmd:
-        cmd = cmd.replace('%s', ' '.join(args))
-
-    # Escaped and quoted string replace.
-    if '%r' in cmd:
-        cmd = cmd.replace('%r', "'%s'" % escape(' '.join(args)))
+    Commands run often should be compiled once into a CommandTemplate.
+    '''
 
-    # Arg index string replace.
-    idx_list = list(enumerate(args))
-    idx_list.reverse()
-    for (index, arg) in idx_list:
-        index += 1
-        if '%%%d' % index in cmd:
-            cmd = cmd.replace('%%%d' % index, str(arg))
+    if not isinstance(cmd, CommandTemplate):
+        cmd = CommandTemplate(cmd)
 
-    return cmd
+    return cmd.expand(args)
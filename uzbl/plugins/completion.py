@@ -2,6 +2,7 @@
 
 import json
 import re
+from bisect import bisect_left
 
 from uzbl.arguments import splitquoted
 from uzbl.ext import PerInstancePlugin
@@ -19,12 +20,41 @@ def escape(str):
     return str.replace("@", "\@")
 
 
-class Completions(set):
+class Completions(object):
+    '''The completion words, kept in a sorted list so the words starting with
+    a prefix are a slice found by bisection.
+
+    New words are sorted in on the next query, so the many CONFIG_CHANGED
+    events after dump_config_as_events don't each insert into the list. The
+    last query is remembered: typing one more character only narrows its
+    result.'''
+
     def __init__(self):
-        set.__init__(self)
+        self.words = set()
+        self.sorted = []
+        self.dirty = False
+        self.last = (None, [])
         self.locked = False
         self.level = NONE
 
+    def __contains__(self, word):
+        return word in self.words
+
+    def __iter__(self):
+        return iter(self.words)
+
+    def __len__(self):
+        return len(self.words)
+
+    def add(self, word):
+        if word not in self.words:
+            self.words.add(word)
+            self.dirty = True
+
+    def update(self, words):
+        for word in words:
+            self.add(word)
+
     def lock(self):
         self.locked = True
 
@@ -34,6 +64,42 @@ def unlock(self):
     def add_var(self, var):
         self.add('@' + var)
 
+    def prefix(self, partial):
+        '''Return the sorted words starting with partial.'''
+
+        if self.dirty:
+            self.sorted = sorted(self.words)
+            self.dirty = False
+            self.last = (None, [])
+
+        last, hints = self.last
+        if last is not None and partial.startswith(last):
+            hints = [h for h in hints if h.startswith(partial)]
+
+        else:
+            words = self.sorted
+            start = bisect_left(words, partial)
+            end = bisect_left(words, partial + u'\U0010ffff', start)
+            hints = words[start:end]
+
+        self.last = (partial, hints)
+        return list(hints)
+
+    @staticmethod
+    def common_prefix(hints):
+        '''Return the longest prefix of the sorted hints, which is the common
+        prefix of the first and last one.'''
+
+        if not hints:
+            return ''
+
+        first, last = hints[0], hints[-1]
+        i, end = 0, min(len(first), len(last))
+        while i < end and first[i] == last[i]:
+            i += 1
+
+        return first[:i]
+
 
 class CompletionListFormatter(object):
     LIST_FORMAT = "<span> %s </span>"
@@ -115,7 +181,7 @@ def update_completion_list(self, *args):
 
         config = Config[self.uzbl]
 
-        hints = [h for h in self.completion if h.startswith(partial)]
+        hints = self.completion.prefix(partial)
         if not hints:
             del config['completion_list']
             return
@@ -133,7 +199,7 @@ def start_completion(self, *args):
         if self.completion.level < COMPLETE:
             self.completion.level += 1
 
-        hints = [h for h in self.completion if h.startswith(partial)]
+        hints = self.completion.prefix(partial)
         if not hints:
             return
 
@@ -149,20 +215,7 @@ def start_completion(self, *args):
             self.completion.unlock()
             return
 
-        smalllen, smallest = sorted([(len(h), h) for h in hints])[0]
-        common = ''
-        for i in range(len(partial), smalllen):
-            char, same = smallest[i], True
-            for hint in hints:
-                if hint[i] != char:
-                    same = False
-                    break
-
-            if not same:
-                break
-
-            common += char
-
+        common = self.completion.common_prefix(hints)[len(partial):]
         if common:
             self.completion.lock()
             self.partial_completion(partial, partial + common)
@@ -2,7 +2,9 @@
     forwards cookies to all other instances connected to the event manager"""
 
 from __future__ import print_function
-from collections import defaultdict
+from collections import defaultdict, OrderedDict
+from itertools import groupby
+from operator import itemgetter
 import os
 import re
 import stat
@@ -32,22 +34,13 @@ def match(key, cookie):
     return True
 
 
-def match_list(_list, cookie):
-    for matcher in _list:
-        for component, match in matcher:
-            if match(cookie[component]) is None:
-                break
-        else:
-            return True
-    return False
-
-
-def add_cookie_matcher(_list, arg):
-    ''' add a cookie matcher to a whitelist or a blacklist.
-        a matcher is a list of (component, re) tuples that matches a cookie
-        when the "component" part of the cookie matches the regular expression
-        "re". "component" is one of the keys defined in the variable
-        "symbolic" above, or the index of a component of a cookie tuple.
+def parse_cookie_matcher(arg):
+    ''' parse a cookie matcher for a whitelist or a blacklist.
+        a matcher is a list of (component, regexp) tuples that matches a
+        cookie when the "component" part of the cookie matches the regular
+        expression "regexp". "component" is one of the keys defined in the
+        variable "symbolic" above, or the index of a component of a cookie
+        tuple.
     '''
 
     args = splitquoted(arg)
@@ -58,8 +51,103 @@ def add_cookie_matcher(_list, arg):
         except KeyError:
             component = int(component)
         assert component <= 5
-        mlist.append((component, re.compile(regexp).search))
-    _list.append(mlist)
+        # compile here so that invalid rules are rejected when added
+        re.compile(regexp)
+        mlist.append((component, regexp))
+    return mlist
+
+
+# backreferences and global inline flags change meaning when a pattern is
+# merged into an alternation with others
+_unmergeable = re.compile(r'\\[1-9]|\(\?P=|\(\?[aiLmsux]+\)')
+
+
+class CookieMatcher(object):
+    ''' A compiled set of cookie matchers.
+
+        Rules which only test a single component (typically the domain) are
+        merged into one alternation per component so that a cookie is checked
+        with at most one regular expression search per component. Rules
+        testing multiple components are evaluated one by one. Verdicts are
+        kept in an LRU cache keyed on the cookie components the rules look at,
+        which for the usual rules is (domain, path, name).
+    '''
+
+    def __init__(self, cache_size=256):
+        self.rules = []
+        self.cache_size = cache_size
+        self._compiled = None
+        self._cache = OrderedDict()
+
+    def __len__(self):
+        return len(self.rules)
+
+    def __bool__(self):
+        return bool(self.rules)
+    __nonzero__ = __bool__
+
+    def add(self, arg):
+        self.rules.append(parse_cookie_matcher(arg))
+        self._compiled = None
+        self._cache.clear()
+
+    def clear(self):
+        self.rules = []
+        self._compiled = None
+        self._cache.clear()
+
+    def compile(self):
+        single = defaultdict(list)
+        multi = []
+        for rule in self.rules:
+            if len(rule) == 1 and not _unmergeable.search(rule[0][1]):
+                component, regexp = rule[0]
+                single[component].append(regexp)
+            else:
+                multi.append(rule)
+
+        merged = []
+        for component, regexps in sorted(single.items()):
+            try:
+                pattern = '|'.join('(?:%s)' % r for r in regexps)
+                merged.append((component, re.compile(pattern).search))
+            except re.error:
+                # e.g. the same group name in two rules; keep them apart
+                multi.extend([(component, r)] for r in regexps)
+
+        multi = [[(c, re.compile(r).search) for c, r in rule] for rule in multi]
+        key = sorted(set(c for rule in self.rules for c, _ in rule))
+        self._compiled = (merged, multi, key)
+        return self._compiled
+
+    def _match(self, cookie, merged, multi):
+        for component, search in merged:
+            if search(cookie[component]) is not None:
+                return True
+        for matcher in multi:
+            for component, search in matcher:
+                if search(cookie[component]) is None:
+                    break
+            else:
+                return True
+        return False
+
+    def match(self, cookie):
+        if not self.rules:
+            return False
+        merged, multi, key = self._compiled or self.compile()
+        if self.cache_size <= 0:
+            return self._match(cookie, merged, multi)
+
+        ckey = tuple(cookie[c] for c in key)
+        try:
+            verdict = self._cache.pop(ckey)
+        except KeyError:
+            verdict = self._match(cookie, merged, multi)
+            if len(self._cache) >= self.cache_size:
+                self._cache.popitem(last=False)
+        self._cache[ckey] = verdict
+        return verdict
 
 
 class NullStore(object):
@@ -192,15 +280,69 @@ def delete_cookie(self, rkey, key):
 }
 
 
+class CookieBroadcast(GlobalPlugin):
+    ''' Coalesces cookie changes for other instances.
+
+        Changes are queued per recipient and sent once per event loop
+        iteration, so that a page setting many cookies results in a single
+        "cookie add_many" command per instance instead of one command per
+        cookie and instance.
+    '''
+
+    CONFIG_SECTION = 'cookies'
+
+    # number of leading cookie fields the core uses for each command
+    FIELDS = {
+        'add': 6,
+        'delete': 4,
+    }
+
+    def __init__(self, event_manager):
+        super(CookieBroadcast, self).__init__(event_manager)
+        self.pending = OrderedDict()
+        self.scheduled = False
+
+    def queue(self, uzbls, command, cookie):
+        fields = self.FIELDS[command]
+        if len(cookie) >= fields:
+            delta = (command, True, cookie.safe_raw(0, fields - 1).strip())
+        else:
+            # malformed; pass it on by itself like before
+            delta = (command, False, cookie.safe_raw())
+
+        for u in uzbls:
+            self.pending.setdefault(u, []).append(delta)
+
+        if self.pending and not self.scheduled:
+            self.scheduled = True
+            self.event_manager.defer(self.flush)
+
+    def flush(self):
+        self.scheduled = False
+        pending, self.pending = self.pending, OrderedDict()
+        for u, deltas in pending.items():
+            for (command, batch), group in groupby(deltas, itemgetter(0, 1)):
+                cookies = [raw for _, _, raw in group]
+                if batch and len(cookies) > 1:
+                    u.send('cookie %s_many %s' % (command, ' '.join(cookies)))
+                else:
+                    for raw in cookies:
+                        u.send('cookie %s %s' % (command, raw))
+
+    def free_uzbl(self, uzbl):
+        self.pending.pop(uzbl, None)
+
+
 class Cookies(PerInstancePlugin):
     CONFIG_SECTION = 'cookies'
 
     def __init__(self, uzbl):
         super(Cookies, self).__init__(uzbl)
 
-        self.secure = []
-        self.whitelist = []
-        self.blacklist = []
+        cache_size = int(self.plugin_config.get('filter.cache_size', 256))
+        self.secure = CookieMatcher(cache_size)
+        self.whitelist = CookieMatcher(cache_size)
+        self.blacklist = CookieMatcher(cache_size)
 
         uzbl.connect('ADD_COOKIE', self.add_cookie)
         uzbl.connect('DELETE_COOKIE', self.delete_cookie)
@@ -216,11 +358,11 @@ def __init__(self, uzbl):
     # b. the cookie is in the whitelist and not in the blacklist
     def accept_cookie(self, cookie):
         if self.whitelist:
-            if match_list(self.whitelist, cookie):
-                return not match_list(self.blacklist, cookie)
+            if self.whitelist.match(cookie):
+                return not self.blacklist.match(cookie)
             return False
 
-        return not match_list(self.blacklist, cookie)
+        return not self.blacklist.match(cookie)
 
     def expires_with_session(self, cookie):
         return cookie[5] == ''
@@ -279,7 +421,7 @@ def add_cookie(self, cookie):
         cookie = splitquoted(cookie)
 
         if self.secure:
-            if match_list(self.secure, cookie):
+            if self.secure.match(cookie):
                 make_secure = {
                     'http': 'https',
                     'httpOnly': 'httpsOnly'
@@ -295,8 +437,8 @@ def add_cookie(self, cookie):
                     return
 
         if self.accept_cookie(cookie):
-            for u in self.get_recipents():
-                u.send('cookie add %s' % cookie.safe_raw())
+            CookieBroadcast[self.uzbl].queue(self.get_recipents(), 'add',
+                                             cookie)
 
             store = self.get_store(self.expires_with_session(cookie))
             store.add_cookie(cookie.raw(), cookie)
@@ -306,8 +448,8 @@ def add_cookie(self, cookie):
 
     def delete_cookie(self, cookie):
         cookie = splitquoted(cookie)
-        for u in self.get_recipents():
-            u.send('cookie delete %s' % cookie.safe_raw())
+        CookieBroadcast[self.uzbl].queue(self.get_recipents(), 'delete',
+                                         cookie)
 
         if len(cookie) == 6:
             store = self.get_store(self.expires_with_session(cookie))
@@ -318,13 +460,13 @@ def delete_cookie(self, cookie):
                 store.delete_cookie(cookie.raw(), cookie)
 
     def blacklist_cookie(self, arg):
-        add_cookie_matcher(self.blacklist, arg)
+        self.blacklist.add(arg)
 
     def whitelist_cookie(self, arg):
-        add_cookie_matcher(self.whitelist, arg)
+        self.whitelist.add(arg)
 
     def secure_cookie(self, arg):
-        add_cookie_matcher(self.secure, arg)
+        self.secure.add(arg)
 
     def clear_secure_cookies(self, arg):
-        self.secure = []
+        self.secure.clear()
@@ -1,7 +1,10 @@
 # this plugin does a very simple display of download progress. to use it, add
-# @downloads to your status_format.
+# @downloads to your status_format. @downloads_rate holds the combined
+# throughput of all downloads in bytes per second.
 
 import os
+import time
+from collections import OrderedDict
 try:
     from html import escape
 except ImportError:
@@ -19,37 +22,124 @@ def __init__(self, uzbl):
         uzbl.connect('DOWNLOAD_STARTED', self.download_started)
         uzbl.connect('DOWNLOAD_PROGRESS', self.download_progress)
         uzbl.connect('DOWNLOAD_COMPLETE', self.download_complete)
+        uzbl.connect('DOWNLOAD_ERROR', self.download_error)
         self.active_downloads = {}
 
+        # the markup of each download, in the order they were started
+        self.fragments = OrderedDict()
+
+        # bytes received per download and in total since the rate was last
+        # computed
+        self.received = {}
+        self.new_bytes = 0
+        self.rate_since = None
+        self.rate = 0
+
+        # progress only updates the variables this often (in seconds). while
+        # downloads are running a timer refreshes them at the same rate, so
+        # held back progress is shown and the rate drops when they stall.
+        self.interval = float(self.plugin_config.get('update_interval', 0.5))
+        self.last_update = None
+        self.dirty = False
+        self.flush_pending = False
+        self.timer_pending = False
+        self.closed = False
+
+    def cleanup(self):
+        self.closed = True
+        super(Downloads, self).cleanup()
+
+    def render(self, path):
+        """renders the markup of a single download"""
+
+        fn = os.path.basename(path)
+        dl = " %s (%d%%)" % (fn, self.active_downloads[path] * 100)
+
+        # replace entities to make sure we don't break our markup
+        # (this could be done with an @[]@ expansion in uzbl, but then we
+        # can't use the &#10; above to make a new line)
+        self.fragments[path] = escape(dl)
+
     def update_download_section(self):
         """after a download's status has changed this
            is called to update the status bar
         """
 
-        if self.active_downloads:
+        self.dirty = False
+        now = time.time()
+        self.last_update = now
+
+        if self.fragments:
             # add a newline before we list downloads
-            result = '&#10;downloads:'
-            for path, progress in list(self.active_downloads.items()):
-                # add each download
-                fn = os.path.basename(path)
-
-                dl = " %s (%d%%)" % (fn, progress * 100)
-
-                # replace entities to make sure we don't break our markup
-                # (this could be done with an @[]@ expansion in uzbl, but then we
-                # can't use the &#10; above to make a new line)
-                dl = escape(dl)
-                result += dl
+            result = '&#10;downloads:' + ''.join(self.fragments.values())
         else:
             result = ''
 
-
         # and the result gets saved to an uzbl variable that can be used in
         # status_format
         config = Config[self.uzbl]
         if config.get('downloads', None) != result:
               config['downloads'] = result
 
+        if not self.fragments:
+            rate = 0
+            self.rate_since = None
+        elif self.rate_since is not None and now > self.rate_since:
+            rate = int(self.new_bytes / (now - self.rate_since))
+            self.new_bytes = 0
+            self.rate_since = now
+        else:
+            rate = self.rate
+
+        if rate != self.rate:
+            self.rate = rate
+            config['downloads_rate'] = rate
+
+        if self.fragments:
+            self.schedule_timer(self.interval)
+
+    def flush(self):
+        self.flush_pending = False
+        if self.dirty and not self.closed:
+            self.update_download_section()
+
+    def tick(self):
+        self.timer_pending = False
+        if self.closed or not self.fragments:
+            return
+
+        wait = self.last_update + self.interval - time.time()
+        if wait > 0:
+            self.schedule_timer(wait)
+        else:
+            self.update_download_section()
+
+    def schedule_timer(self, delay):
+        if not self.timer_pending:
+            self.timer_pending = True
+            self.uzbl.parent.defer(self.tick, delay)
+
+    def schedule_update(self):
+        """progress is coalesced into one update per event loop iteration and
+           update_interval. updates held back by the interval are sent by
+           the timer.
+        """
+
+        self.dirty = True
+        if self.flush_pending:
+            return
+
+        if self.last_update is None:
+            wait = 0
+        else:
+            wait = self.last_update + self.interval - time.time()
+
+        if wait <= 0:
+            self.flush_pending = True
+            self.uzbl.parent.defer(self.flush)
+        else:
+            self.schedule_timer(wait)
+
     def download_started(self, args):
         # parse the arguments
         args = splitquoted(args)
@@ -57,6 +147,7 @@ def download_started(self, args):
 
         # add to the list of active downloads
         self.active_downloads[destination_path] = 0.0
+        self.render(destination_path)
 
         # update the progress
         self.update_download_section()
@@ -67,11 +158,23 @@ def download_progress(self, args):
         destination_path = args[0]
         progress = float(args[1])
 
-        # update the progress
+        if len(args) > 2:
+            received = int(args[2])
+            previous = self.received.get(destination_path, 0)
+            self.new_bytes += max(0, received - previous)
+            self.received[destination_path] = received
+            if self.rate_since is None:
+                self.rate_since = time.time()
+
+        # update the progress, only rendering when the shown percentage
+        # changes
+        old = self.active_downloads.get(destination_path)
         self.active_downloads[destination_path] = progress
+        if old is None or int(old * 100) != int(progress * 100):
+            self.render(destination_path)
 
         # update the status bar variable
-        self.update_download_section()
+        self.schedule_update()
 
     def download_complete(self, args):
         # TODO(tailhook) be more userfriendly: show download for some time!
@@ -80,8 +183,24 @@ def download_complete(self, args):
         args = splitquoted(args)
         destination_path = args[0]
 
+        self.remove_download(destination_path)
+
+    def download_error(self, args):
+        # failed and cancelled downloads are dropped as well. the
+        # destination is sent as an uri here
+        args = splitquoted(args)
+        destination_path = args[0]
+        if destination_path.startswith('file://'):
+            destination_path = destination_path[len('file://'):]
+
+        if destination_path in self.active_downloads:
+            self.remove_download(destination_path)
+
+    def remove_download(self, destination_path):
         # remove from the list of active downloads
         del self.active_downloads[destination_path]
+        self.fragments.pop(destination_path, None)
+        self.received.pop(destination_path, None)
 
         # update the status bar variable
         self.update_download_section()
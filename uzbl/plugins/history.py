@@ -1,36 +1,186 @@
+from bisect import bisect_left, bisect_right
+from collections import defaultdict
+import json
+import os
 import random
 
 from .on_set import OnSetPlugin
 from .keycmd import KeyCmd
 from .config import Config
 from uzbl.ext import GlobalPlugin, PerInstancePlugin
+from uzbl.xdg import xdg_data_home
+
+
+def trigrams(line):
+    return set(line[i:i + 3] for i in range(len(line) - 2))
+
+
+def contains(plist, pos):
+    i = bisect_left(plist, pos)
+    return i < len(plist) and plist[i] == pos
+
+
+class HistoryList(object):
+    ''' The history of a single prompt with a trigram index.
+
+        Each trigram maps to the (ascending) indices of the lines containing
+        it, so a substring search only has to check the lines containing
+        every trigram of the search key. Keys shorter than a trigram match
+        most lines anyway and are found by scanning.
+    '''
+
+    def __init__(self):
+        self.lines = []
+        self.index = defaultdict(list)
+
+    def __len__(self):
+        return len(self.lines)
+
+    def __getitem__(self, index):
+        return self.lines[index]
+
+    def append(self, line):
+        pos = len(self.lines)
+        self.lines.append(line)
+        for gram in trigrams(line):
+            self.index[gram].append(pos)
+
+    def candidates(self, key):
+        if len(key) < 3:
+            return None
+        postings = []
+        for gram in trigrams(key):
+            plist = self.index.get(gram)
+            if not plist:
+                return []
+            postings.append(plist)
+        # intersect the lists, starting with the shortest
+        postings.sort(key=len)
+        result = postings[0]
+        for plist in postings[1:]:
+            result = [pos for pos in result if contains(plist, pos)]
+            if not result:
+                break
+        return result
+
+    def find_prev(self, key, start):
+        ''' index of the last line at or before start containing key '''
+        plist = self.candidates(key)
+        if plist is None:
+            plist = range(len(self.lines))
+        for i in range(bisect_right(plist, start) - 1, -1, -1):
+            pos = plist[i]
+            if key in self.lines[pos]:
+                return pos
+        return None
+
+    def find_next(self, key, start):
+        ''' index of the first line at or after start containing key '''
+        plist = self.candidates(key)
+        if plist is None:
+            plist = range(len(self.lines))
+        for i in range(bisect_left(plist, start), len(plist)):
+            pos = plist[i]
+            if key in self.lines[pos]:
+                return pos
+        return None
+
 
 class SharedHistory(GlobalPlugin):
     CONFIG_SECTION = 'history'
 
     def __init__(self, event_manager):
         super(SharedHistory, self).__init__(event_manager)
-        self.history = {}  #TODO(tailhook) save and load from file
+        self._history = None
+        self.max_lines = int(self.plugin_config.get('max_lines', 1000))
+        # lines in the file, which is trimmed once it is twice max_lines
+        self.saved_lines = 0
 
-    def get_line_number(self, prompt):
+        store_type = self.plugin_config.get('type', 'memory')
+        if store_type == 'text':
+            default_path = os.path.join(xdg_data_home, 'uzbl',
+                                        'command-history')
+            self.path = self.plugin_config.get('path', default_path)
+        else:
+            if store_type != 'memory':
+                self.logger.error('history: unknown store type: %s',
+                                  store_type)
+            self.path = None
+
+    @property
+    def history(self):
+        # read the file on first use rather than at startup
+        if self._history is None:
+            self._history = defaultdict(HistoryList)
+            if self.path:
+                self.load()
+        return self._history
+
+    def load(self):
         try:
-            return len(self.history[prompt])
-        except KeyError:
+            with open(self.path) as f:
+                for line in f:
+                    self.saved_lines += 1
+                    try:
+                        prompt, entry = json.loads(line)
+                    except ValueError:
+                        continue
+                    self._history[prompt].append(entry)
+        except IOError:
+            pass
+
+    def save(self, prompt, entry):
+        try:
+            dirname = os.path.dirname(self.path)
+            if dirname and not os.path.isdir(dirname):
+                os.makedirs(dirname)
+            fd = os.open(self.path, os.O_WRONLY | os.O_APPEND | os.O_CREAT,
+                         0o600)
+            with os.fdopen(fd, 'a') as f:
+                f.write(json.dumps([prompt, entry]) + '\n')
+            self.saved_lines += 1
+            if self.saved_lines > 2 * self.max_lines:
+                self.trim()
+        except (IOError, OSError):
+            self.logger.error('failed to save history to %r', self.path,
+                              exc_info=True)
+
+    def trim(self):
+        ''' keep only the last max_lines lines of the file '''
+        with open(self.path) as f:
+            lines = f.readlines()[-self.max_lines:]
+        tmp = self.path + '.tmp'
+        fd = os.open(tmp, os.O_WRONLY | os.O_TRUNC | os.O_CREAT, 0o600)
+        with os.fdopen(fd, 'w') as f:
+            f.writelines(lines)
+        os.rename(tmp, self.path)
+        self.saved_lines = len(lines)
+
+    def get_line_number(self, prompt):
+        if prompt not in self.history:
             return 0
+        return len(self.history[prompt])
 
     def addline(self, prompt, entry):
-        lst = self.history.get(prompt)
-        if lst is None:
-            self.history[prompt] = [entry]
-        else:
-            lst.append(entry)
+        self.history[prompt].append(entry)
+        if self.path:
+            self.save(prompt, entry)
 
     def getline(self, prompt, index):
-        try:
-            return self.history[prompt][index]
-        except KeyError:
+        if prompt not in self.history:
             # not existent list is same as empty one
             raise IndexError()
+        return self.history[prompt][index]
+
+    def find_prev(self, prompt, key, start):
+        if prompt not in self.history:
+            return None
+        return self.history[prompt].find_prev(key, start)
+
+    def find_next(self, prompt, key, start):
+        if prompt not in self.history:
+            return None
+        return self.history[prompt].find_next(key, start)
 
 
 class History(PerInstancePlugin):
@@ -56,12 +206,12 @@ def prev(self):
         else:
             self.cursor -= 1
 
-        if self.search_key:
-            while self.cursor >= 0:
-                line = shared.getline(self.prompt, self.cursor)
-                if self.search_key in line:
-                    return line
-                self.cursor -= 1
+        if self.search_key and self.cursor >= 0:
+            found = shared.find_prev(self.prompt, self.search_key, self.cursor)
+            if found is not None:
+                self.cursor = found
+                return shared.getline(self.prompt, found)
+            self.cursor = -1
 
         if self.cursor >= 0:
             return shared.getline(self.prompt, self.cursor)
@@ -79,12 +229,12 @@ def __next__(self):
         self.cursor += 1
 
         num = shared.get_line_number(self.prompt)
-        if self.search_key:
-            while self.cursor < num:
-                line = shared.getline(self.prompt, self.cursor)
-                if self.search_key in line:
-                    return line
-                self.cursor += 1
+        if self.search_key and self.cursor < num:
+            found = shared.find_next(self.prompt, self.search_key, self.cursor)
+            if found is not None:
+                self.cursor = found
+                return shared.getline(self.prompt, found)
+            self.cursor = num
 
         if self.cursor >= num:
             self.cursor = None
@@ -110,9 +260,16 @@ def search(self, key):
     def __str__(self):
         return "(History %s, %s)" % (self.cursor, self.prompt)
 
+    def is_private(self):
+        try:
+            return Config[self.uzbl].get('enable_private', 0) == 1
+        except KeyError:
+            return False
+
     def keycmd_exec(self, modstate, keylet):
         cmd = keylet.get_keycmd()
-        if cmd:
+        # like url_history, private instances leave nothing behind
+        if cmd and not self.is_private():
             SharedHistory[self.uzbl].addline(self.prompt, cmd)
         self._tail = None
         self.cursor = None
@@ -1,5 +1,4 @@
 import re
-import six
 
 from uzbl.arguments import splitquoted
 from uzbl.ext import PerInstancePlugin
@@ -22,6 +21,23 @@ def uzbl_escape(str):
     return "@[%s]@" % escape(str) if str else ''
 
 
+def markup_escape(str):
+    '''Escape text for pango markup the way uzbl-core's @[...]@ does.'''
+
+    for (char, entity) in [('&', '&amp;'), ('<', '&lt;'), ('>', '&gt;'),
+                           ("'", '&#39;'), ('"', '&quot;')]:
+        str = str.replace(char, entity)
+
+    return str
+
+
+def uzbl_quote(str):
+    for char in ['\\', "'", '@']:
+        str = str.replace(char, '\\'+char)
+
+    return "'%s'" % str
+
+
 def inject_str(str, index, inj):
     '''Inject a string into string at at given index.'''
 
@@ -211,6 +227,24 @@ def markup(self):
         chunks = [self.keycmd[:self.cursor], curchar, self.keycmd[self.cursor+1:]]
         return KEYCMD_FORMAT % tuple(map(uzbl_escape, chunks))
 
+    def expanded_markup(self, cursor_style):
+        ''' Returns markup() as uzbl-core stores it in @keycmd, that is with
+        the text escaped and @cursor_style expanded
+
+        >>> k = Keylet()
+        >>> k.set_keycmd('a<b')
+        >>> k.expanded_markup('underline="single"')
+        'a&lt;b<span underline="single"> </span>'
+    '''
+
+        if self.cursor < len(self.keycmd):
+            curchar = self.keycmd[self.cursor]
+        else:
+            curchar = ' '
+        chunks = [self.keycmd[:self.cursor], curchar, self.keycmd[self.cursor+1:]]
+        return KEYCMD_FORMAT.replace('@cursor_style', cursor_style) % \
+            tuple(map(markup_escape, chunks))
+
     def __repr__(self):
         ''' Return a string representation of the keylet. '''
 
@@ -235,6 +269,13 @@ def __init__(self, uzbl):
         self.modmaps = {}
         self.ignores = {}
 
+        # Set by the bind plugin once uzbl-core matches binds natively.
+        self.native_binds = False
+
+        # The keycmd and cursor position uzbl-core was last sent, None until
+        # the keycmd it may have kept from an earlier event manager is cleared.
+        self.core_keycmd = None
+
         uzbl.connect('APPEND_KEYCMD', self.append_keycmd)
         uzbl.connect('IGNORE_KEY', self.add_key_ignore)
         uzbl.connect('INJECT_KEYCMD', self.inject_keycmd)
@@ -252,6 +293,10 @@ def __init__(self, uzbl):
         uzbl.connect('SET_KEYCMD', self.set_keycmd)
         uzbl.connect('FOCUS_LOST', self.clear_modifiers)
 
+        # Must run after key_press and the handlers of the events it raises.
+        uzbl.connect('KEY_PRESS', self.native_sync)
+        uzbl.connect('MOD_PRESS', self.native_sync)
+
     def modmap_key(self, key):
         '''Make some obscure names for some keys friendlier.'''
 
@@ -331,8 +376,7 @@ def clear_keycmd(self, *args):
         '''Clear the keycmd for this uzbl instance.'''
 
         self.keylet.clear_keycmd()
-        config = Config[self.uzbl]
-        del config['keycmd']
+        self.send_keycmd()
         self.uzbl.event('KEYCMD_CLEARED')
 
     def clear_modcmd(self):
@@ -379,13 +423,53 @@ def update_event(self, modstate, k, execute=True):
         if config.get('keycmd_events', '1') != '1':
             return
 
-        new_keycmd = k.get_keycmd()
-        if not new_keycmd:
-            del config['keycmd']
+        self.send_keycmd()
+
+    def send_keycmd(self):
+        '''Send the change to the keycmd since the last call to uzbl-core,
+        which renders the @keycmd variable (as markup()) itself.'''
 
-        elif new_keycmd == keycmd:
-            # Generate the pango markup for the cursor in the keycmd.
-            config['keycmd'] = six.text_type(k.markup())
+        k = self.keylet
+        new, cursor = k.keycmd, k.cursor
+        if self.core_keycmd is None:
+            self.core_keycmd = ('', 0)
+            self.uzbl.send('keycmd clear')
+
+        old, old_cursor = self.core_keycmd
+        if old == new and old_cursor == cursor:
+            return
+
+        self.core_keycmd = (new, cursor)
+
+        # uzbl-core sets @keycmd without a VARIABLE_SET event, so raise it
+        # here for the config and @on_set handlers.
+        if new:
+            style = Config[self.uzbl].get('cursor_style', '')
+            self.uzbl.event('VARIABLE_SET', 'keycmd str ' +
+                            uzbl_quote(k.expanded_markup(style)))
+        else:
+            self.uzbl.event('VARIABLE_SET', 'keycmd str')
+
+        if not new:
+            self.uzbl.send('keycmd clear')
+            return
+
+        # Only the part between the common prefix and suffix changed.
+        start, common = 0, min(len(old), len(new))
+        while start < common and old[start] == new[start]:
+            start += 1
+
+        end = 0
+        while end < common - start and old[-end-1] == new[-end-1]:
+            end += 1
+
+        splice = 'keycmd splice %d %d %d' % (start, len(old) - start - end,
+                                             cursor)
+        text = new[start:len(new)-end]
+        if text:
+            splice += ' ' + uzbl_quote(text)
+
+        self.uzbl.send(splice)
 
     def parse_key_event(self, key):
         ''' Build a set from the modstate part of the event, and pass all keys through modmap '''
@@ -419,7 +503,7 @@ def key_press(self, key):
                 # TODO, make a note on what's going on here
                 k.keycmd = ''
                 k.cursor = 0
-                del config['keycmd']
+                self.send_keycmd()
                 return
 
             k.insert_keycmd(key)
@@ -434,6 +518,14 @@ def key_press(self, key):
 
         self.update_event(modstate, k)
 
+    def native_sync(self, key):
+        '''Tell uzbl-core that a key press has been handled, so it may match
+        native binds again. Presses are only counted once native binds are
+        in use, so there is nothing to answer before.'''
+
+        if self.native_binds:
+            self.uzbl.send('bind sync')
+
     def key_release(self, key):
         '''Respond to KEY_RELEASE event. Things done by this function include:
 
@@ -22,16 +22,25 @@
 from functools import partial
 
 from uzbl.arguments import splitquoted
-from .cmd_expand import cmd_expand
+from .cmd_expand import CommandTemplate
 from uzbl.ext import PerInstancePlugin
 
-def match_args(pattern, args):
-    if len(pattern) > len(args):
-        return False
-    for p, a in zip(pattern, args):
-        if not fnmatch.fnmatch(a, p):
+class ArgPattern(list):
+    '''An argument pattern with its globs compiled to regular expressions
+    once, instead of by fnmatch for every event.'''
+
+    def __init__(self, pattern):
+        super(ArgPattern, self).__init__(pattern)
+        self.matchers = [re.compile(fnmatch.translate(p)).match
+                         for p in pattern]
+
+    def match(self, args):
+        if len(self.matchers) > len(args):
             return False
-    return True
+        for m, a in zip(self.matchers, args):
+            if not m(a):
+                return False
+        return True
 
 
 class OnEventPlugin(PerInstancePlugin):
@@ -59,9 +68,8 @@ def event_handler(self, *args, **kargs):
 
         commands = self.events[event]
         for cmd, pattern in commands:
-            if not pattern or match_args(pattern, args):
-                cmd = cmd_expand(cmd, args)
-                self.uzbl.send(cmd)
+            if not pattern or pattern.match(args):
+                self.uzbl.send(cmd.expand(args))
 
     def on_event(self, event, pattern, cmd):
         '''Add a new event to watch and respond to.'''
@@ -75,7 +83,7 @@ def on_event(self, event, pattern, cmd):
 
         cmds = self.events[event]
         if cmd not in cmds:
-            cmds.append((cmd, pattern))
+            cmds.append((CommandTemplate(cmd), ArgPattern(pattern)))
 
     def parse_on_event(self, args):
         '''Parse ON_EVENT events and pass them to the on_event function.
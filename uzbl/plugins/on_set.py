@@ -2,17 +2,16 @@
 from functools import partial
 
 import uzbl.plugins.config
-from .cmd_expand import cmd_expand
+from .cmd_expand import CommandTemplate
 from uzbl.arguments import splitquoted
 from uzbl.ext import PerInstancePlugin
-import collections
 
 valid_glob = compile('^[A-Za-z0-9_\*\.]+$').match
 
 def make_matcher(glob):
     '''Make matcher function from simple glob.'''
 
-    pattern = "^%s$" % glob.replace('*', '[^\s]*')
+    pattern = "^%s$" % glob.replace('.', '\\.').replace('*', '[^\s]*')
     return compile(pattern).match
 
 
@@ -22,6 +21,12 @@ class OnSetPlugin(PerInstancePlugin):
     def __init__(self, uzbl):
         super(OnSetPlugin, self).__init__(uzbl)
         self.on_sets = {}
+
+        # The handlers of globs without wildcards by key, and the matchers and
+        # handlers of the others, so most keys are a dict lookup.
+        self.literal = {}
+        self.wildcards = []
+
         uzbl.connect('ON_SET', self.parse_on_set)
         uzbl.connect('CONFIG_CHANGED', self.check_for_handlers)
 
@@ -29,15 +34,19 @@ def _exec_handlers(self, handlers, key, arg):
         '''Execute the on_set handlers that matched the key.'''
 
         for handler in handlers:
-            if isinstance(handler, collections.Callable):
+            if callable(handler):
                 handler(key, arg)
             else:
-                self.uzbl.send(cmd_expand(handler, [key, arg]))
+                self.uzbl.send(handler.expand([key, arg]))
 
     def check_for_handlers(self, key, arg):
         '''Check for handlers for the current key.'''
 
-        for (matcher, handlers) in list(self.on_sets.values()):
+        handlers = self.literal.get(key)
+        if handlers:
+            self._exec_handlers(handlers, key, arg)
+
+        for (matcher, handlers) in list(self.wildcards):
             if matcher(key):
                 self._exec_handlers(handlers, key, arg)
 
@@ -53,13 +62,13 @@ def on_set(self, glob, handler, prepend=True):
         while '**' in glob:
             glob = glob.replace('**', '*')
 
-        if isinstance(handler, collections.Callable):
+        if callable(handler):
             orig_handler = handler
             if prepend:
                 handler = partial(handler, self.uzbl)
 
         else:
-            orig_handler = handler = str(handler)
+            orig_handler = handler = CommandTemplate(str(handler))
 
         if glob in self.on_sets:
             (matcher, handlers) = self.on_sets[glob]
@@ -68,6 +77,10 @@ def on_set(self, glob, handler, prepend=True):
         else:
             matcher = make_matcher(glob)
             self.on_sets[glob] = (matcher, [handler,])
+            if '*' in glob:
+                self.wildcards.append(self.on_sets[glob])
+            else:
+                self.literal[glob] = self.on_sets[glob][1]
 
         self.logger.info('on set %r call %r' % (glob, orig_handler))
 
@@ -0,0 +1,229 @@
+'''URL history
+
+Records every finished page load into an SQLite database shared by all
+instances and answers prefix and fuzzy queries over it, ranked by frecency
+(how often and how recently a page was visited).'''
+
+import json
+import math
+import os
+import re
+import sqlite3
+import time
+from functools import partial
+
+from uzbl.arguments import splitquoted
+from uzbl.ext import GlobalPlugin
+from uzbl.xdg import xdg_data_home
+from .config import Config
+
+SCHEMA = '''
+CREATE TABLE IF NOT EXISTS urls (
+    uri TEXT PRIMARY KEY,
+    key TEXT NOT NULL,
+    title TEXT NOT NULL DEFAULT '',
+    visits INTEGER NOT NULL DEFAULT 0,
+    last_visit REAL NOT NULL,
+    frecency REAL NOT NULL
+);
+CREATE INDEX IF NOT EXISTS urls_key ON urls (key);
+CREATE INDEX IF NOT EXISTS urls_frecency ON urls (frecency);
+'''
+
+strip_uri = re.compile(r'^[a-z][a-z0-9+.-]*://(www\.)?', re.IGNORECASE)
+
+
+def uri_key(uri):
+    ''' the part of an uri users type: no scheme, no "www." '''
+    return strip_uri.sub('', uri).lower()
+
+
+def like_escape(s):
+    return s.replace('\\', '\\\\').replace('%', '\\%').replace('_', '\\_')
+
+
+class UrlHistoryStore(object):
+    ''' The visited pages with their frecency.
+
+        A page's score decays exponentially with a time constant "tau" and
+        every visit adds one to it. Rather than the score itself, the
+        time-independent value log(score) + t / tau is stored so pages can be
+        ranked through an index without updating every row as time passes.
+    '''
+
+    def __init__(self, path, half_life=30 * 86400):
+        self.tau = half_life / math.log(2)
+        self.db = sqlite3.connect(path)
+        self.db.executescript(SCHEMA)
+
+    def close(self):
+        self.db.close()
+
+    def visit(self, uri, title=None, now=None, commit=True):
+        if now is None:
+            now = time.time()
+        row = self.db.execute('SELECT frecency FROM urls WHERE uri = ?',
+                              (uri,)).fetchone()
+        if row is None:
+            frecency = now / self.tau
+            self.db.execute(
+                'INSERT INTO urls (uri, key, title, visits, last_visit, '
+                'frecency) VALUES (?, ?, ?, 1, ?, ?)',
+                (uri, uri_key(uri), title or '', now, frecency))
+        else:
+            score = math.exp(row[0] - now / self.tau)
+            frecency = math.log(score + 1) + now / self.tau
+            self.db.execute(
+                'UPDATE urls SET visits = visits + 1, last_visit = ?, '
+                'frecency = ? WHERE uri = ?', (now, frecency, uri))
+            if title:
+                self.db.execute('UPDATE urls SET title = ? WHERE uri = ?',
+                                (title, uri))
+        if commit:
+            self.db.commit()
+
+    def set_title(self, uri, title, commit=True):
+        self.db.execute('UPDATE urls SET title = ? WHERE uri = ?',
+                        (title, uri))
+        if commit:
+            self.db.commit()
+
+    def commit(self):
+        self.db.commit()
+
+    def prefix(self, text, limit=20):
+        ''' pages whose address starts with text '''
+        key = uri_key(text)
+        return self.db.execute(
+            'SELECT uri, title FROM urls WHERE key >= ? AND key < ? '
+            'ORDER BY frecency DESC LIMIT ?',
+            (key, key + u'\U0010ffff', limit)).fetchall()
+
+    def fuzzy(self, text, limit=20):
+        ''' pages whose address or title contains the characters of text in
+            order '''
+        pattern = '%' + '%'.join(like_escape(c) for c in text.lower()) + '%'
+        return self.db.execute(
+            "SELECT uri, title FROM urls WHERE key LIKE ? ESCAPE '\\' "
+            "OR title LIKE ? ESCAPE '\\' ORDER BY frecency DESC LIMIT ?",
+            (pattern, pattern, limit)).fetchall()
+
+
+class UrlHistory(GlobalPlugin):
+    CONFIG_SECTION = 'url_history'
+
+    def __init__(self, event_manager):
+        super(UrlHistory, self).__init__(event_manager)
+        default_path = os.path.join(xdg_data_home, 'uzbl', 'history.db')
+        self.path = self.plugin_config.get('path', default_path)
+        self.half_life = float(self.plugin_config.get('half_life_days', 30))
+        self.limit = int(self.plugin_config.get('limit', 20))
+        self.commit_interval = float(
+            self.plugin_config.get('commit_interval', 5))
+
+        # opened once there is something to read or write
+        self.store = None
+        self.commit_pending = False
+
+        # [uri, title, recorded] of the page loading in each instance
+        self.pages = {}
+
+    def open_store(self, create):
+        ''' the database; it is only created once a page is recorded '''
+        if self.store is not None:
+            return self.store
+        if self.path != ':memory:':
+            if not create and not os.path.exists(self.path):
+                return None
+            dirname = os.path.dirname(self.path)
+            if dirname and not os.path.isdir(dirname):
+                os.makedirs(dirname)
+        self.store = UrlHistoryStore(self.path, self.half_life * 86400)
+        return self.store
+
+    def schedule_commit(self):
+        ''' writes are committed together every commit_interval seconds
+            rather than once per page load '''
+        if self.commit_pending:
+            return
+        self.commit_pending = True
+        self.event_manager.defer(self.commit, self.commit_interval)
+
+    def commit(self):
+        self.commit_pending = False
+        if self.store is not None:
+            self.store.commit()
+
+    def new_uzbl(self, uzbl):
+        uzbl.connect('LOAD_COMMIT', partial(self.load_commit, uzbl))
+        uzbl.connect('TITLE_CHANGED', partial(self.title_changed, uzbl))
+        uzbl.connect('LOAD_FINISH', partial(self.load_finish, uzbl))
+        uzbl.answer_request('URL_HISTORY_QUERY', 0,
+                            partial(self.query, uzbl))
+
+    def free_uzbl(self, uzbl):
+        self.pages.pop(uzbl, None)
+
+    def is_private(self, uzbl):
+        try:
+            return Config[uzbl].get('enable_private', 0) == 1
+        except KeyError:
+            return False
+
+    def load_commit(self, uzbl, args):
+        self.pages[uzbl] = [splitquoted(args)[0], '', False]
+
+    def title_changed(self, uzbl, args):
+        page = self.pages.get(uzbl)
+        if page is None:
+            return
+        page[1] = splitquoted(args)[0]
+        # titles may also change after the page has finished loading
+        if page[2]:
+            self.open_store(True).set_title(page[0], page[1], commit=False)
+            self.schedule_commit()
+
+    def load_finish(self, uzbl, args):
+        uri = splitquoted(args)[0]
+        if self.is_private(uzbl) or not uri or uri.startswith('about:'):
+            return
+        page = self.pages.get(uzbl)
+        if page is None or page[0] != uri:
+            page = self.pages[uzbl] = [uri, '', False]
+        page[2] = True
+        self.open_store(True).visit(uri, page[1], commit=False)
+        self.schedule_commit()
+
+    def query(self, uzbl, response, args, **kargs):
+        ''' URL_HISTORY_QUERY <prefix|fuzzy> <text> [limit]
+
+            Replies with a JSON list of [uri, title] pairs, best match first.
+        '''
+        query = splitquoted(args)
+        if len(query) < 2:
+            return (response, (args,), kargs)
+        mode, text = query[0], query[1]
+        limit = self.limit
+        if len(query) > 2:
+            try:
+                limit = int(query[2])
+            except ValueError:
+                self.logger.error('url_history: invalid limit: %s', query[2])
+        if mode not in ('prefix', 'fuzzy'):
+            self.logger.error('url_history: unknown query mode: %s', mode)
+            return (response, (args,), kargs)
+        store = self.open_store(False)
+        if store is None:
+            rows = []
+        elif mode == 'prefix':
+            rows = store.prefix(text, limit)
+        else:
+            rows = store.fuzzy(text, limit)
+        return (json.dumps([list(row) for row in rows]), (args,), kargs)
+
+    def cleanup(self):
+        if self.store is not None:
+            self.store.commit()
+            self.store.close()
+            self.store = None
+        super(UrlHistory, self).cleanup()